@@ -7,6 +7,7 @@
 #include <glm/glm.hpp>
 
 #include "render_engine.hpp"
+#include "scene/aq_async_model_loader.hpp"
 #include "scene/aq_camera.hpp"
 #include "scene/aq_node.hpp"
 #include "scene/aq_light.hpp"
@@ -29,6 +30,14 @@ namespace aq {
         // Adds the materials to the material manager
         void upload_materials(const std::vector<std::shared_ptr<Material>>& materials);
 
+        // Loads the model at `path` in the background and adds it to `root_node` once it's uploaded (see `AsyncModelLoader`)
+        // The future holds the model's root node (nullptr if loading failed) and is ready from the `update` that added it
+        std::shared_future<std::shared_ptr<Node>> load_model_async(
+            const std::string& path,
+            const mesh_util::OptimizationOptions& optimization_options={},
+            const std::optional<mesh_util::LodOptions>& lod_options=mesh_util::LodOptions{}
+        );
+
         // Should be called for every SDL event
         // Returns `true` if the event is "consumed" (it should be ignored)
         // Example:
@@ -50,6 +59,7 @@ namespace aq {
 
     private:
         RenderEngine render_engine;
+        AsyncModelLoader model_loader;
 
         class NodeHierarchyEditor* nhe;
     };
@@ -16,12 +16,14 @@
 namespace aq {
 
     // Forward declare
-    class InitializationEngine;
+    class RenderEngine;
+    class AsyncModelLoader;
 
     class NodeHierarchyEditor {
     public:
         // If `RenderEngine` is set, `NodeHierarchyEditor` will be able to load models
-        NodeHierarchyEditor(MaterialManager* material_manager, LightMemoryManager* light_memory_manager=nullptr, InitializationEngine* init_engine=nullptr);
+        // With `model_loader` they are loaded in the background instead of blocking the frame
+        NodeHierarchyEditor(MaterialManager* material_manager, LightMemoryManager* light_memory_manager=nullptr, RenderEngine* render_engine=nullptr, AsyncModelLoader* model_loader=nullptr);
         ~NodeHierarchyEditor();
 
         void draw_tree(std::shared_ptr<Node> root_node, ImGuiTreeNodeFlags flags=ImGuiTreeNodeFlags_AllowItemOverlap);
@@ -37,7 +39,8 @@ namespace aq {
         // For when materials are updated
         MaterialManager* material_manager;
         LightMemoryManager* light_memory_manager;
-        InitializationEngine* init_engine;
+        RenderEngine* render_engine;
+        AsyncModelLoader* model_loader;
 
         // Persistent data
         class NodeHierarchyEditorData* data;
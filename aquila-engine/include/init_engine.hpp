@@ -12,6 +12,8 @@
 
 #include "util/vk_types.hpp"
 #include "util/vk_initializers.hpp"
+#include "util/vk_upload_scheduler.hpp"
+#include "util/vk_memory_budget.hpp"
 
 namespace aq {
 
@@ -40,6 +42,10 @@ namespace aq {
 
         // Usually used for `immediate_submit`
         vk_util::UploadContext get_default_upload_context(); 
+        // Prefer this over `immediate_submit` for uploading resources
+        UploadScheduler* get_upload_scheduler() { return &upload_scheduler; }
+        // GPU memory use per owner and against the driver's budget
+        MemoryBudget* get_memory_budget() { return &memory_budget; }
 
     protected:
         InitializationState initialization_state{ InitializationState::Uninitialized };
@@ -69,12 +75,25 @@ namespace aq {
         vk_init::GPUSupport gpu_support;
         vk::PhysicalDeviceProperties gpu_properties;
         vk::PhysicalDeviceFeatures gpu_features;
+        vk::PhysicalDeviceVulkan12Features gpu_vulkan12_features;
 
         // Just an alias for `gpu_support.graphics_present_queue_family`
         uint32_t& graphics_queue_family{ gpu_support.graphics_present_queue_family };
         vk::Queue graphics_queue;
 
+        // Just an alias for `gpu_support.transfer_queue_family`
+        // Might be the same as `graphics_queue_family` (in which case `transfer_queue == graphics_queue`)
+        uint32_t& transfer_queue_family{ gpu_support.transfer_queue_family };
+        vk::Queue transfer_queue;
+
         vma::Allocator allocator;
+        MemoryBudget memory_budget;
+
+        // Batches uploads onto `transfer_queue`; flushed every frame
+        UploadScheduler upload_scheduler;
+
+        // Resources that might still be in use by frames in flight; advanced every frame
+        RetirementQueue retirement_queue{ FRAME_OVERLAP };
 
         // Initialized in `choose_surface_format`
 
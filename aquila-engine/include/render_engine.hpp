@@ -3,15 +3,20 @@
 
 #include <array>
 #include <memory>
+#include <optional>
 
 #include <glm/glm.hpp>
 
 #include "init_engine.hpp"
 #include "util/vk_types.hpp"
 #include "util/vk_descriptor_set_builder.hpp"
+#include "util/vk_geometry_arena.hpp"
+#include "util/vk_defragmentation.hpp"
+#include "util/vk_frame_allocator.hpp"
 #include "scene/aq_texture.hpp"
 #include "scene/aq_material.hpp"
 #include "scene/aq_mesh.hpp"
+#include "scene/aq_meshlet_culler.hpp"
 #include "scene/aq_node.hpp"
 #include "scene/aq_light.hpp"
 #include "scene/aq_camera.hpp"
@@ -22,6 +27,10 @@ namespace aq {
         glm::mat4 model;
         uint material_index;
         uint nr_lights;
+        glm::vec2 padding;
+        // Dequantizes `VertexFormat::Quantized` positions (`position_offset + position * position_scale`)
+        glm::vec4 position_offset;
+        glm::vec4 position_scale;
     };
 
     struct GPUCameraData {
@@ -31,7 +40,8 @@ namespace aq {
 
     class RenderEngine : public InitializationEngine {
     public:
-        RenderEngine(uint max_nr_textures=1);
+        // The texture table starts with room for `initial_nr_textures` and grows up to what the device supports
+        RenderEngine(uint initial_nr_textures=1);
         virtual ~RenderEngine();
 
         void update();
@@ -41,9 +51,26 @@ namespace aq {
 
         uint64_t get_frame_number() const {return frame_number;}
 
+        GeometryArena* get_geometry_arena() { return &geometry_arena; }
+        // `get_stats()` reports how much memory defragmentation has reclaimed
+        DefragmentationService* get_defragmentation_service() { return &defragmentation_service; }
+
         MaterialManager material_manager;
         LightMemoryManager light_memory_manager;
 
+        // Mesh LODs are picked so their simplification error is at most this many pixels on screen
+        float lod_pixel_threshold = 1.0f;
+        // Skip meshlets facing away from the camera
+        // Off by default: the pipelines don't cull back faces, so this removes the back of open or double-sided
+        // meshes. Only turn it on if every mesh is closed. Mirrored meshes are never cone culled.
+        bool meshlet_cone_culling = false;
+        // Blend between texture mip levels; the sampler is immutable so this has to be set before the engine is initialized
+        bool trilinear_filtering = true;
+        // KTX2 textures (eg. of cooked models) load at a low resolution and stream in the mip levels needed for the
+        // meshes' sizes on screen
+        // Only read when the engine is initialized; `std::nullopt` uploads every mip level right away
+        std::optional<MaterialManager::TextureStreamingOptions> texture_streaming = MaterialManager::TextureStreamingOptions{};
+
     protected:
         virtual bool init_render_resources() override;
         // If redefined in child class, either `RenderEngine::cleanup_render_resources` MUST still be called 
@@ -52,28 +79,28 @@ namespace aq {
 
         bool init_pipelines();
         vk::PipelineLayout triangle_pipeline_layout;
-        vk::Pipeline triangle_pipeline;
+        std::array<vk::Pipeline, (size_t) VertexFormat::Count> triangle_pipelines{}; // Indexed by `VertexFormat`
 
         virtual bool resize_window() override; // Calls inherited `resize_window` method from `InitializationEngine`
 
         bool init_data();
 
-        unsigned char* p_cam_buff_mem;
-        AllocatedBuffer camera_buffer; // Holds GPUCameraData
+        // Transient per frame uniform/storage data (eg. `GPUCameraData`), bound with dynamic offsets
+        FrameAllocator frame_allocator;
 
         bool init_descriptors();
 
-        vk::DescriptorPool descriptor_pool;
+        // See `DescriptorSetIndices`
         vk::DescriptorSetLayout global_set_layout;
-        
-        struct FrameData {
-            vk::DescriptorSet global_descriptor;
-        };
-        std::array<FrameData, FRAME_OVERLAP> frame_data{};
-        FrameData& get_frame_data(uint64_t frame_number) {return frame_data[frame_number%FRAME_OVERLAP];}
+        vk::DescriptorSet global_descriptor; // Only holds immutable state so it's never written
+        vk::DescriptorSetLayout per_pass_set_layout;
+        vk::DescriptorSet per_pass_descriptor; // Points into `frame_allocator` so it's shared by every frame and pass
 
         bool init_imgui();
 
+        // Picks every draw's LOD, queues the full detail meshes that have meshlets and records their culling
+        // Has to be called before the render pass (and `draw_objects`)
+        void cull_meshlets(AbstractCamera* camera, const std::vector<std::pair<std::shared_ptr<Node>, glm::mat4>>& flattened_hierarchy);
         void draw_objects(AbstractCamera* camera, const std::vector<std::pair<std::shared_ptr<Node>, glm::mat4>>& flattened_hierarchy);
         void traverse_node_hierarchy(std::shared_ptr<Node> node, NodeHierarchyTraceback traceback, std::vector<std::pair<std::shared_ptr<Node>, glm::mat4>>& flattened_hierarchy, glm::mat4 parent_transform=glm::mat4(1.0f));
         uint64_t frame_number{0};
@@ -83,7 +110,18 @@ namespace aq {
         std::vector<vk::DescriptorSet> per_frame_descriptor_sets;
 
     private:
-        uint32_t max_nr_textures;
+        uint32_t initial_nr_textures;
+
+        // Every mesh's vertices and indices live in here
+        GeometryArena geometry_arena;
+        // Compacts the geometry arena and textures over time
+        DefragmentationService defragmentation_service;
+
+        MeshletCuller meshlet_culler;
+        // One per mesh drawn this frame in the order of the flattened hierarchy; `UINT32_MAX` if not culled per meshlet
+        std::vector<uint32_t> meshlet_draw_indices;
+        // The LOD of every mesh drawn (in the same order), kept between frames for `Mesh::select_lod`
+        std::vector<uint32_t> draw_lods;
 
         // Ensure meshes being rendered are alive until the rendering stops
         std::array<std::vector<std::shared_ptr<Mesh>>, FRAME_OVERLAP> meshes_in_render;
@@ -0,0 +1,76 @@
+#ifndef SCENE_AQUILA_ASYNC_MODEL_LOADER_HPP
+#define SCENE_AQUILA_ASYNC_MODEL_LOADER_HPP
+
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "util/vk_geometry_arena.hpp"
+#include "util/vk_upload_scheduler.hpp"
+#include "scene/aq_material.hpp"
+#include "scene/aq_mesh_optimizer.hpp"
+#include "scene/aq_mesh_simplifier.hpp"
+#include "scene/aq_node.hpp"
+
+namespace aq {
+
+    // Loads models without stalling the render loop
+    // Importing (or reading a cooked model) and decoding its textures run on `ThreadPool::get_shared()`; `update`
+    // then uploads the meshes and materials and attaches the model to its parent once every upload has finished,
+    // so a model is never drawn half uploaded.
+    // Not thread safe; only use it from the render thread.
+    class AsyncModelLoader {
+    public:
+        AsyncModelLoader(GeometryArena* geometry_arena, MaterialManager* material_manager, UploadScheduler* upload_scheduler);
+        ~AsyncModelLoader();
+
+        // Starts loading `path` (a `cooked_model::extension` file or anything `ModelLoader` imports)
+        // The future is ready once the model's root node was added to `parent`; it holds nullptr if loading failed.
+        // Don't wait on it from the render thread: `update` does the rest of the work.
+        std::shared_future<std::shared_ptr<Node>> load(
+            const std::filesystem::path& path,
+            std::shared_ptr<Node> parent,
+            const mesh_util::OptimizationOptions& optimization_options={},
+            const std::optional<mesh_util::LodOptions>& lod_options=mesh_util::LodOptions{}
+        );
+
+        // Call once per frame before the frame's uploads are flushed
+        void update();
+        bool is_loading() { return !pending_models.empty(); }
+
+        // Waits for the background work and frees what was already uploaded; the pending futures are given nullptr
+        // The GPU has to be idle.
+        void destroy();
+
+    private:
+        struct LoadedModel {
+            std::shared_ptr<Node> root_node;
+            std::vector<std::shared_ptr<Material>> materials;
+        };
+
+        struct PendingModel {
+            std::filesystem::path path;
+            std::shared_ptr<Node> parent;
+            std::future<LoadedModel> loading;
+            std::optional<LoadedModel> model; // Once `loading` is done
+            bool uploaded = false;
+            std::promise<std::shared_ptr<Node>> attached;
+        };
+
+        // Returns true once the model can be uploaded (its textures are decoded)
+        bool is_loaded(PendingModel& pending_model);
+        void upload(LoadedModel& model);
+        bool is_resident(LoadedModel& model);
+
+        std::vector<std::unique_ptr<PendingModel>> pending_models;
+
+        GeometryArena* geometry_arena;
+        MaterialManager* material_manager;
+        UploadScheduler* upload_scheduler;
+    };
+
+}
+
+#endif
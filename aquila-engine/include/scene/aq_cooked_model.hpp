@@ -0,0 +1,82 @@
+#ifndef SCENE_AQUILA_COOKED_MODEL_HPP
+#define SCENE_AQUILA_COOKED_MODEL_HPP
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "scene/aq_material.hpp"
+#include "scene/aq_mesh.hpp"
+#include "scene/aq_node.hpp"
+#include "scene/aq_model_loader.hpp"
+#include "util/asset_cache.hpp"
+#include "util/mapped_file.hpp"
+
+namespace aq {
+
+    // Cooked models (`.aqmesh`) hold a node hierarchy with its meshes already packed the way they are laid out
+    // in the geometry arena (see `Mesh::PackedData`) and its materials, so loading one needs no importing,
+    // optimizing or vertex conversion.
+    namespace cooked_model {
+
+        constexpr const char* extension = ".aqmesh";
+
+        // Bump whenever the file layout or anything that is written as is (eg. `CompactVertex`,
+        // `GPUMeshlet`, `Material::Properties`) changes; files with another version are rejected
+        constexpr uint32_t version = 1;
+
+        // Writes the hierarchy below `root_node` with its meshes and materials to `path`
+        // Meshes that are shared between nodes are only written once. Meshes must still have their CPU data
+        // (`vertices`/`indices` or `packed_data`). Texture paths are written relative to `path`'s directory so the
+        // cooked model can be loaded from any working directory.
+        bool write(const std::string& path, std::shared_ptr<Node> root_node, const std::vector<std::shared_ptr<Material>>& materials);
+
+        // Offline cook step: imports `directory + file` with `ModelLoader` and writes the result to `output_path`
+        // With `compress_textures` every texture is block compressed for its role (see
+        // `texture_util::choose_compressed_format`) into `output_path + ".<n>.ktx2"`, which the model references
+        bool cook(
+            const std::string& directory,
+            const std::string& file,
+            const std::string& output_path,
+            const mesh_util::OptimizationOptions& optimization_options={},
+            const std::optional<mesh_util::LodOptions>& lod_options=mesh_util::LodOptions{},
+            bool compress_textures=true
+        );
+
+        // Writes the model into `cache` under `key` (with `extension`)
+        // Every texture is block compressed like in `cook` and stored in the cache under the hash of its own source,
+        // so textures that didn't change are reused instead of compressed again. Textures are kept as they are if
+        // `texture_util::is_block_compression_supported` is false.
+        bool write_to_cache(
+            AssetCache& cache,
+            uint64_t key,
+            std::shared_ptr<Node> root_node,
+            const std::vector<std::shared_ptr<Material>>& materials
+        );
+
+    } // namespace cooked_model
+
+    // Loads a cooked model by memory mapping it
+    // The meshes' `packed_data` points straight into the mapping and is copied into staging memory by
+    // `Mesh::upload`; the mapping is released once every mesh has been uploaded (or destroyed).
+    // Files aren't trusted: every offset, size and index the GPU or a copy would use is checked and corrupt files
+    // fail to load.
+    class CookedModelLoader {
+    public:
+        CookedModelLoader(const std::string& path);
+
+        // nullptr if the file couldn't be loaded
+        std::shared_ptr<Node> get_root_node() { return root_node; }
+        const std::vector<std::shared_ptr<Material>>& get_materials() { return materials; }
+
+    private:
+        bool load(const std::string& path);
+
+        std::shared_ptr<Node> root_node = nullptr;
+        std::vector<std::shared_ptr<Material>> materials;
+    };
+
+}
+
+#endif
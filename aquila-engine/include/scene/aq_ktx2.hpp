@@ -0,0 +1,23 @@
+#ifndef SCENE_AQUILA_KTX2_HPP
+#define SCENE_AQUILA_KTX2_HPP
+
+#include <optional>
+#include <string>
+
+#include "scene/aq_texture.hpp"
+
+namespace aq {
+namespace texture_util {
+
+    // KTX2 (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html) containers for 2D textures with mip levels
+    // Only the formats `ImageData` is used with are supported (RGBA8 and the BC formats of `compress`) and
+    // supercompression isn't.
+
+    // Memory maps `path`; the returned image points into the mapping
+    std::optional<ImageData> read_ktx2(const std::string& path);
+    bool write_ktx2(const std::string& path, const ImageData& image);
+
+} // namespace texture_util
+} // namespace aq
+
+#endif
@@ -83,7 +83,8 @@ namespace aq {
             size_t initial_capacity,
             DescriptorSetBuilder& per_frame_descriptor_set_builder, // should have multiplicity of `frame_overlap`
             vma::Allocator* allocator,
-            vk_util::UploadContext upload_context
+            vk_util::UploadContext upload_context,
+            RetirementQueue* retirement_queue
         );
 
         // Call after `per_frame_descriptor_set_builder.build()` where `per_frame_descriptor_set_builder` is the same one from `init`
@@ -110,6 +111,7 @@ namespace aq {
 
         vma::Allocator* allocator;
         vk_util::UploadContext ctx;
+        RetirementQueue* retirement_queue;
     };
 
     class PointLight : public Light {
@@ -2,9 +2,9 @@
 #define SCENE_AQUILA_MATERIAL_HPP
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
-#include <list>
 #include <unordered_map>
 #include <utility>
 
@@ -14,6 +14,8 @@
 #include "util/vk_resizable_buffer.hpp"
 #include "util/vk_descriptor_set_builder.hpp"
 #include "util/vk_memory_manager_retained.hpp"
+#include "util/vk_defragmentation.hpp"
+#include "util/vk_memory_budget.hpp"
 #include "scene/aq_texture.hpp"
 
 namespace aq {
@@ -62,13 +64,18 @@ namespace aq {
 
         // Initialize the `MaterialManager`
         // Call `descriptor_sets_created(...)` after `per_frame_descriptor_set_builder.build()`
+        // Textures live in a single bindless texture table (see `get_texture_table`) that grows as needed
         void init(
             uint frame_overlap,
-            size_t texture_capacity, // texture capacity is fixed
+            uint32_t initial_texture_capacity,
+            uint32_t max_texture_capacity, // Upper bound of the texture table; limited by the device
             size_t initial_material_capacity, // material capacity can grow as needed
             DescriptorSetBuilder& per_frame_descriptor_set_builder, // should have multiplicity of `frame_overlap`
             vma::Allocator* allocator,
-            vk_util::UploadContext upload_context
+            vk_util::UploadContext upload_context,
+            UploadScheduler* upload_scheduler, // Used for texture uploads
+            RetirementQueue* retirement_queue,
+            bool trilinear_filtering=true // Blend between mip levels instead of picking the nearest
         );
 
         // Call after `per_frame_descriptor_set_builder.build()` where `per_frame_descriptor_set_builder` is the same one from `init`
@@ -79,23 +86,58 @@ namespace aq {
         // Destroy material buffer and other resources
         void destroy();
 
+        // Textures added afterwards can be moved by `defragmentation_service`; their descriptors are rewritten when they move
+        void set_defragmentation_service(DefragmentationService* defragmentation_service) { this->defragmentation_service = defragmentation_service; }
+        // Textures are replaced by the placeholder texture when the device is close to running out of memory budget
+        void set_memory_budget(MemoryBudget* memory_budget) { this->memory_budget = memory_budget; }
+
+        struct TextureStreamingOptions {
+            vk::DeviceSize budget = vk::DeviceSize(512) << 20; // Device memory for the mip levels of every streamed texture
+            uint32_t initial_extent = 64; // Textures are first uploaded with only the mip levels at most this many texels wide and high
+            vk::DeviceSize max_bytes_per_update = 16 << 20; // Finer mip levels are spread over several `update`s to avoid hitches
+            uint64_t eviction_delay = 120; // `update`s a texture has to go unseen before its finer mip levels can be evicted
+        };
+        // Textures added afterwards (that are read from KTX2 files, see `Texture::upload`) load at a low resolution and
+        // stream in finer mip levels when they're requested
+        // (see `request_texture_detail`); the least recently seen textures are evicted to stay within `budget`
+        // Streaming stops for every texture while it is turned off (`std::nullopt`).
+        void set_texture_streaming(const std::optional<TextureStreamingOptions>& options) { texture_streaming = options; }
+        // Requests the mip levels of `material`'s textures needed to draw it `screen_size` pixels wide (see `Mesh::get_screen_size`)
+        // Call for every mesh drawn; the levels are streamed in by the next `update`
+        void request_texture_detail(const std::shared_ptr<Material>& material, float screen_size);
+
         // Returns false if material is not being managed (has not been added)
         bool add_material(std::shared_ptr<Material> material); // Material memory will not actually be uploaded to the GPU until `update` is called
         bool update_material(std::shared_ptr<Material> material);
         bool remove_material(std::shared_ptr<Material> material);
 
         // If the texture has not been uploaded, will upload texture from its path
-        // Returns texture index
+        // A texture with the same image as one already added (see `Texture::get_content_hash`) shares its slot
+        // A texture that is still decoding (see `Texture::upload_later`) shows the placeholder texture and is
+        // uploaded by `update` once it's decoded
+        // Returns texture index (its slot in the texture table)
         uint add_texture(std::shared_ptr<Texture> texture);
 
         // `safe_frame` must be finished rendering (usually the frame about to be rendered onto)
-        // Uploads material memory to the buffer for `safe_frame`
+        // Uploads decoded textures, streams textures and uploads material memory to the buffer for `safe_frame`
         void update(uint safe_frame);
 
+        // Long lived set holding every texture (see `LongLivedBindings`)
+        // The set can change when the table grows so it should be queried every frame
+        vk::DescriptorSet get_texture_table() { return texture_table; }
+        vk::DescriptorSetLayout get_texture_table_layout() { return texture_table_layout; }
+        // Used as an immutable sampler in the global set (see `GlobalBindings`)
+        vk::Sampler get_default_sampler() { return default_sampler; }
+
         // Gets the index for `material` in the buffer
         // An unknown material will return index 0 (error material)
+        // The index can change after `compact` so it should be queried every frame
         ManagedMemoryIndex get_material_index(std::shared_ptr<Material> material);
 
+        // Fills the holes left by removed materials so the material buffers can shrink
+        // Returns the number of materials moved
+        size_t compact();
+
         // Returns a texture if `MaterialManager` has a texture with path `path`
         // Otherwise returns null
         std::shared_ptr<Texture> get_texture(std::string path);
@@ -103,26 +145,59 @@ namespace aq {
         std::shared_ptr<Material> default_material;
 
     private:
-        // std::vector<vk::DescriptorSet> descriptor_sets;
-        void create_descriptor_writes();
+        bool create_texture_table(uint32_t capacity); // Replaces the current table (if any) and writes every texture into it
+        void write_texture(uint texture_index);
+        // Returns `UINT_MAX` if the texture table is full
+        uint allocate_texture_slot();
+        // Moves a texture whose image was replaced into a new slot; frames in flight keep reading the old one
+        void texture_moved(Texture* texture);
+        // Points the materials and paths using `old_index` at `new_index` and frees `old_index` once frames in flight are done with it
+        void retarget_texture_slot(uint old_index, uint new_index);
+        void upload_decoded_textures();
+        // Registers a texture that was just uploaded with `defragmentation_service` and texture streaming
+        void texture_uploaded(Texture* texture);
+        void register_texture_image(Texture* texture); // With `defragmentation_service`
+
+        struct StreamedTexture {
+            uint32_t initial_level; // Kept resident while the texture isn't seen
+            uint32_t requested_level = UINT32_MAX; // Finest level requested in `last_requested`
+            uint64_t last_requested = 0; // `streaming_update` of the last request
+        };
+        void stream_textures();
+        // Replaces the texture's image with the mip levels from `first_level` and moves it to a new slot
+        bool stream_texture(Texture* texture, uint32_t first_level);
+        std::optional<TextureStreamingOptions> texture_streaming;
+        std::unordered_map<Texture*, StreamedTexture> streamed_textures;
+        uint64_t streaming_update = 1; // Incremented by every `stream_textures`
 
         MemoryManagerRetained material_memory;
         std::unordered_map<std::shared_ptr<Material>, ManagedMemoryIndex> material_indices;
 
-        std::vector<std::shared_ptr<Texture>> textures;
-        std::list<std::pair<uint, std::vector<uint>>> added_textures; // the vector of frames the texture descriptor has been updated
+        std::vector<std::shared_ptr<Texture>> textures; // Indexed by slot in the texture table; empty slots are null
+        std::vector<uint> free_texture_slots;
         std::unordered_map<std::string, uint> texture_indices; // Texture path to texture index
+        std::unordered_map<uint64_t, std::string> texture_content_paths; // Content hash to the path of the uploaded texture holding it
+        std::vector<std::shared_ptr<Texture>> decoding_textures; // Added while decoding; their slots show the placeholder
 
         vk::Sampler default_sampler;
 
+        vk::DescriptorSetLayout texture_table_layout;
+        vk::DescriptorPool texture_table_pool;
+        vk::DescriptorSet texture_table;
+        uint32_t texture_table_capacity = 0;
+        uint32_t max_texture_capacity;
+
         uint frame_overlap;
-        size_t texture_capacity;
         size_t initial_material_capacity;
 
         std::vector<vk::DescriptorSet> descriptor_sets;
 
         vma::Allocator* allocator;
         vk_util::UploadContext ctx;
+        UploadScheduler* upload_scheduler;
+        RetirementQueue* retirement_queue;
+        DefragmentationService* defragmentation_service = nullptr;
+        MemoryBudget* memory_budget = nullptr;
     };
 
 }
@@ -2,13 +2,17 @@
 #define SCENE_AQUILA_MESH_HPP
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
 #include <glm/glm.hpp>
 
 #include "util/vk_types.hpp"
+#include "util/vk_geometry_arena.hpp"
 #include "scene/aq_vertex.hpp"
+#include "scene/aq_mesh_simplifier.hpp"
+#include "scene/aq_meshlet_builder.hpp"
 #include "scene/aq_material.hpp"
 
 namespace aq {
@@ -23,30 +27,96 @@ namespace aq {
 
         std::vector<Vertex> vertices;
         std::vector<Index> indices;
+        // Progressively coarser versions of `indices` sharing `vertices`; uploaded after the full detail indices
+        std::vector<mesh_util::Lod> lods;
+
+        // Fills `lods` from `indices`; call before `upload`
+        void generate_lods(const mesh_util::LodOptions& options={});
+
+        // Clusters of the full detail `indices` for culling per meshlet (see `MeshletCuller`)
+        std::vector<mesh_util::Meshlet> meshlets;
+
+        // Fills `meshlets` from `indices`; call before `upload`
+        void build_meshlets();
 
         std::shared_ptr<Material> material;
 
+        // Layout of the vertices on the GPU; only read by `upload`
+        VertexFormat vertex_format = VertexFormat::Compact;
+
         // `name` should never be used as an ID; it's just an easy way for users to identify meshes
         std::string name;
 
-        // Stores both the index data and the vertex data in the same buffer
-        // The index data is first and the vertex data starts at `vertex_data_offset`
-        AllocatedBuffer combined_iv_buffer;
-        vk::DeviceSize vertex_data_offset;
+        // Location of the mesh data inside the `GeometryArena` (only valid after `upload`)
+        // Bind the arena index buffer with `index_type` and draw with `drawIndexed(index_count, 1, first_index, vertex_offset, 0)`
+        GeometryArena::Allocation vertex_allocation;
+        GeometryArena::Allocation index_allocation;
+        GeometryArena::Allocation meshlet_allocation;
+        int32_t vertex_offset = 0; // In vertices
+        uint32_t first_index = 0; // In indices of `index_type`
+        uint32_t index_count = 0;
+        vk::IndexType index_type = vk::IndexType::eUint32; // `eUint16` if the mesh has few enough vertices
+        uint32_t first_meshlet = 0; // In `GPUMeshlet`s
+        uint32_t meshlet_count = 0;
+        VertexBounds bounds; // Needed to dequantize `VertexFormat::Quantized` positions
+
+        struct LodRange {
+            uint32_t first_index; // In indices of `index_type`
+            uint32_t index_count;
+            float error; // Object space
+        };
+        std::vector<LodRange> lod_ranges; // [0] is the full detail mesh (`first_index`/`index_count`)
+
+        // Picks the coarsest LOD whose error projects to at most `pixel_threshold` pixels on screen
+        // `projection_scale` converts a size at distance 1 to pixels (`projection[1][1] * screen_height / 2`)
+        // Switching to a coarser LOD needs some margin so meshes near a threshold don't flicker between LODs.
+        // `current_lod` is the LOD the draw used last frame and is set to the chosen one; it's kept per draw since
+        // meshes can be drawn by several nodes.
+        const LodRange& select_lod(const glm::mat4& model, const glm::vec3& camera_position, float projection_scale, float pixel_threshold, uint32_t& current_lod) const;
+        // Diameter of the bounding sphere on screen in pixels (infinite if the camera is inside it); see `select_lod`
+        float get_screen_size(const glm::mat4& model, const glm::vec3& camera_position, float projection_scale) const;
+
+        UploadScheduler::Ticket upload_ticket = 0; // Check with `UploadScheduler::is_complete`
 
-        // Uploads the mesh on CPU visible memory
-        void upload(vma::Allocator* allocator);
-        // Uploads the mesh on GPU local memory (not necessarily CPU visible)
-        void upload(vma::Allocator* allocator, const vk_util::UploadContext& upload_context);
-        // Will only free `vertex_buffer` if it was allocated through `upload`
+        // The mesh as it is laid out in the geometry arena
+        // Index and meshlet `first_index`es are relative to the mesh's first index
+        struct PackedData {
+            VertexFormat vertex_format = VertexFormat::Compact;
+            vk::IndexType index_type = vk::IndexType::eUint32;
+            VertexBounds bounds;
+            uint32_t vertex_count = 0;
+
+            const void* vertex_data = nullptr;
+            vk::DeviceSize vertex_data_size = 0;
+            const void* index_data = nullptr; // The full detail indices followed by the LODs'
+            vk::DeviceSize index_data_size = 0;
+            std::vector<LodRange> lod_ranges; // [0] is the full detail mesh
+            const mesh_util::GPUMeshlet* meshlets = nullptr;
+            uint32_t meshlet_count = 0;
+
+            std::shared_ptr<const void> storage; // Keeps the memory pointed to alive (eg. a file mapping)
+        };
+
+        // Packs `vertices`, `indices`, `lods` and `meshlets` into their GPU layout
+        PackedData pack() const;
+
+        // Already packed data (eg. from a cooked model); used by `upload` instead of packing the mesh
+        // Released once it's uploaded
+        std::optional<PackedData> packed_data;
+
+        // Suballocates the mesh from `arena` and schedules the upload of the vertices, indices and meshlets
+        // A mesh with the same content as one already in the arena shares its allocations instead
+        void upload(GeometryArena* arena);
+        // Uploads `packed` as is; the data is copied into staging memory before this returns
+        void upload(GeometryArena* arena, const PackedData& packed);
+        // Will only free the arena allocations if they were allocated through `upload` (and no other mesh shares them)
         void free(); 
 
-        bool is_uploaded() {return bool(combined_iv_buffer.buffer);}
+        bool is_uploaded() {return arena != nullptr;}
 
     private:
-        AllocatedBuffer create_buffer_with_iv_data(vk::BufferUsageFlags buffer_usage, vma::MemoryUsage memory_usage);
-
-        vma::Allocator* allocator = nullptr;
+        GeometryArena* arena = nullptr;
+        uint64_t content_hash = 0; // Of the uploaded data; see `GeometryArena::SharedGeometry`
     };
 
 }
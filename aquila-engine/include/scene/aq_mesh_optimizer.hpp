@@ -0,0 +1,63 @@
+#ifndef SCENE_AQUILA_MESH_OPTIMIZER_HPP
+#define SCENE_AQUILA_MESH_OPTIMIZER_HPP
+
+#include <string>
+#include <vector>
+
+#include "scene/aq_vertex.hpp"
+
+namespace aq {
+namespace mesh_util {
+
+    // Size of the FIFO cache used to measure ACMR; close to the post-transform cache of most desktop GPUs
+    constexpr uint32_t default_cache_size = 16;
+
+    // Average cache miss ratio: vertex shader invocations per triangle (0.5 is ideal for large meshes, 3.0 is worst)
+    float calculate_acmr(const std::vector<Index>& indices, size_t vertex_count, uint32_t cache_size=default_cache_size);
+    // Average transformed to vertex ratio: vertex shader invocations per vertex (1.0 is ideal)
+    float calculate_atvr(const std::vector<Index>& indices, size_t vertex_count, uint32_t cache_size=default_cache_size);
+
+    // Merges bitwise identical vertices and updates `indices`
+    // Returns the number of vertices removed
+    size_t weld_vertices(std::vector<Vertex>& vertices, std::vector<Index>& indices);
+
+    // Reorders triangles for the post-transform vertex cache
+    // "Linear-Speed Vertex Cache Optimisation" by Tom Forsyth
+    void optimize_vertex_cache(std::vector<Index>& indices, size_t vertex_count);
+
+    // Reorders clusters of triangles so outward facing clusters are drawn first, reducing overdraw
+    // Run after `optimize_vertex_cache`; clusters are only split at cache restarts so
+    // ACMR gets at most `threshold` times worse
+    void optimize_overdraw(std::vector<Index>& indices, const std::vector<Vertex>& vertices, float threshold=1.05f);
+
+    // Reorders vertices in the order they are first used so vertex fetches are mostly sequential
+    // Unused vertices are removed
+    void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<Index>& indices);
+
+    struct OptimizationOptions {
+        bool weld = true;
+        bool vertex_cache = true;
+        bool overdraw = false; // Only helps meshes that overlap themselves on screen (eg. closed, convex-ish shapes)
+        float overdraw_threshold = 1.05f;
+        bool vertex_fetch = true;
+    };
+
+    // The ACMR/vertex count after every step of `optimize_mesh`
+    struct OptimizationReport {
+        struct Step {
+            std::string name;
+            size_t vertex_count;
+            float acmr;
+            float atvr;
+        };
+        std::vector<Step> steps; // The first step is the unoptimized mesh
+
+        std::string to_string() const;
+    };
+
+    OptimizationReport optimize_mesh(std::vector<Vertex>& vertices, std::vector<Index>& indices, const OptimizationOptions& options={});
+
+} // namespace mesh_util
+} // namespace aq
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SCENE_AQUILA_MESH_SIMPLIFIER_HPP
+#define SCENE_AQUILA_MESH_SIMPLIFIER_HPP
+
+#include <vector>
+
+#include "scene/aq_vertex.hpp"
+
+namespace aq {
+namespace mesh_util {
+
+    // Simplifies the triangles in `indices` by collapsing edges in order of their quadric error
+    // ("Surface Simplification Using Quadric Error Metrics" by Garland and Heckbert)
+    // Vertices are never moved or created so the result indexes into the same `vertices`.
+    // Vertices on attribute seams (same position, different normal/tex coord) are kept so no cracks open up.
+    // Stops at `target_index_count` or when the next collapse would exceed `target_error` (object space distance)
+    // Returns the simplified indices; `result_error` is set to the error of the simplified mesh
+    std::vector<Index> simplify(
+        const std::vector<Vertex>& vertices,
+        const std::vector<Index>& indices,
+        size_t target_index_count,
+        float target_error,
+        float* result_error=nullptr
+    );
+
+    struct Lod {
+        std::vector<Index> indices;
+        float error = 0.0f; // Object space distance from the full detail mesh
+    };
+
+    struct LodOptions {
+        uint32_t max_lods = 6; // Excluding the full detail mesh
+        float reduction = 0.5f; // Triangle count of every level relative to the previous one
+        size_t min_triangles = 64; // Meshes this small aren't simplified any further
+        float max_relative_error = 0.25f; // Relative to the radius of the mesh's bounding sphere
+    };
+
+    // Generates progressively coarser versions of `indices`
+    // Stops early if a level can't reduce the triangle count meaningfully
+    std::vector<Lod> generate_lods(const std::vector<Vertex>& vertices, const std::vector<Index>& indices, const LodOptions& options={});
+
+} // namespace mesh_util
+} // namespace aq
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef SCENE_AQUILA_MESHLET_BUILDER_HPP
+#define SCENE_AQUILA_MESHLET_BUILDER_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "scene/aq_vertex.hpp"
+
+namespace aq {
+namespace mesh_util {
+
+    // 64 vertices and 124 triangles keep a meshlet's local data within common mesh shader limits
+    // and the triangle count a multiple of 4 (with 2 triangles of slack for the 128 limit)
+    constexpr uint32_t max_meshlet_vertices = 64;
+    constexpr uint32_t max_meshlet_triangles = 124;
+
+    // A cluster of triangles that is culled as a whole
+    struct Meshlet {
+        uint32_t first_index; // Into the mesh's `indices`; the meshlet's triangles are contiguous
+        uint32_t index_count;
+        uint32_t vertex_count; // Unique vertices
+
+        // Bounding sphere
+        glm::vec3 center;
+        float radius;
+
+        // Every triangle's normal is within the cone around `cone_axis`
+        // The meshlet is backfacing from `camera_position` if
+        // `dot(center - camera_position, cone_axis) >= cone_cutoff * length(center - camera_position) + radius`
+        glm::vec3 cone_axis;
+        float cone_cutoff; // Sine of the cone's half angle; 1 if the normals spread too much to ever cull
+    };
+
+    // `Meshlet` as read by the meshlet culling shader (std430 layout)
+    struct GPUMeshlet {
+        glm::vec4 sphere; // xyz: center, w: radius
+        glm::vec4 cone; // xyz: axis, w: cutoff
+        uint32_t first_index; // Into the geometry arena's index buffer
+        uint32_t index_count;
+        uint32_t padding[2];
+    };
+
+    // Smaller meshes are cheaper to draw whole than to cull per meshlet
+    constexpr size_t min_triangles_for_meshlets = 4096;
+
+    // Splits `indices` into meshlets without reordering the triangles
+    // Run after `optimize_vertex_cache`; its order keeps neighbouring triangles together so the
+    // meshlets are spatially compact
+    std::vector<Meshlet> build_meshlets(
+        const std::vector<Vertex>& vertices,
+        const std::vector<Index>& indices,
+        uint32_t max_vertices=max_meshlet_vertices,
+        uint32_t max_triangles=max_meshlet_triangles
+    );
+
+} // namespace mesh_util
+} // namespace aq
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef SCENE_AQUILA_MESHLET_CULLER_HPP
+#define SCENE_AQUILA_MESHLET_CULLER_HPP
+
+#include <array>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "util/vk_types.hpp"
+#include "util/vk_descriptor_set_builder.hpp"
+#include "util/vk_frame_allocator.hpp"
+#include "util/vk_geometry_arena.hpp"
+#include "scene/aq_mesh.hpp"
+
+namespace aq {
+
+    // Culls the meshlets of dense meshes on the GPU
+    // A compute pass tests every meshlet against the view frustum and its normal cone, then copies the indices
+    // of the visible meshlets into a compacted index buffer and counts them into an indirect draw command.
+    // Only compute shaders and `drawIndexedIndirect` are used (no mesh shaders).
+    class MeshletCuller {
+    public:
+        MeshletCuller();
+
+        bool init(
+            vk::Device device,
+            vma::Allocator* allocator,
+            uint frame_overlap,
+            const char* shader_path, // The compiled `meshlet_cull.comp.glsl`
+            DescriptorSetAllocator* descriptor_set_allocator,
+            FrameAllocator* frame_allocator // Holds the draws and initial commands (needs `eTransferSrc` usage)
+        );
+        void destroy();
+
+        // Call once per frame after waiting on the frame's fence; forgets the draws of the last frame
+        void next_frame(uint64_t frame_number);
+
+        // Meshlets are dispatched as workgroups; this is the smallest `maxComputeWorkGroupCount[0]` allowed
+        static constexpr uint32_t max_meshlets_per_draw = 65535;
+
+        // Queues `mesh` to be culled with `model`
+        // `cone_culling` also drops meshlets facing away from the camera; it's ignored for mirrored `model`s
+        // Returns the index of its indirect draw command or `UINT32_MAX` if the mesh has no (or too many) meshlets
+        uint32_t add_draw(const Mesh& mesh, const glm::mat4& model, bool cone_culling);
+
+        // Records the culling of every queued draw into `cmd` outside of a render pass
+        // Returns false if nothing can be drawn with `draw` (the meshes should be drawn normally instead)
+        bool cull(vk::CommandBuffer cmd, const glm::mat4& view_projection, const glm::vec3& camera_position, GeometryArena* arena);
+
+        // Draws the visible meshlets of a queued draw
+        // `get_index_buffer()` must be bound with `vk::IndexType::eUint32`
+        void draw(vk::CommandBuffer cmd, uint32_t draw_index);
+        vk::Buffer get_index_buffer() { return frames[frame_index].indices.buffer; }
+
+    private:
+        // Read by the culling shader (std430 layout)
+        struct GPUMeshletDraw {
+            glm::mat4 model;
+            uint32_t first_meshlet;
+            uint32_t meshlet_count;
+            uint32_t output_first_index; // Where the draw's visible indices start in the output index buffer
+            uint32_t index_size; // Of the mesh's indices in the arena (2 or 4 bytes)
+            float scale; // Largest axis scale of `model`
+            uint32_t cone_culling;
+            uint32_t padding[2];
+        };
+
+        struct CullConstants {
+            std::array<glm::vec4, 6> frustum_planes; // Point towards the inside
+            glm::vec4 camera_position;
+        };
+
+        struct FrameBuffers {
+            AllocatedBuffer indices; // Compacted 32 bit indices of the visible meshlets
+            AllocatedBuffer commands; // `vk::DrawIndexedIndirectCommand`s
+            vk::DeviceSize index_capacity = 0; // In indices
+            vk::DeviceSize command_capacity = 0; // In commands
+        };
+
+        bool reserve(FrameBuffers& frame, vk::DeviceSize index_count, vk::DeviceSize command_count);
+
+        static std::array<glm::vec4, 6> extract_frustum_planes(const glm::mat4& view_projection);
+
+        vk::Device device;
+        vma::Allocator* allocator = nullptr;
+        DescriptorSetAllocator* descriptor_set_allocator = nullptr;
+        FrameAllocator* frame_allocator = nullptr;
+
+        vk::DescriptorSetLayout set_layout;
+        vk::PipelineLayout pipeline_layout;
+        vk::Pipeline pipeline;
+
+        std::vector<FrameBuffers> frames; // Indexed by `frame_number % frame_overlap`
+        uint frame_overlap = 1;
+        uint64_t frame_number = 0;
+        uint frame_index = 0;
+
+        std::vector<GPUMeshletDraw> draws;
+        std::vector<vk::DrawIndexedIndirectCommand> commands;
+        uint32_t max_meshlet_count = 0; // Of any queued draw
+        uint32_t output_index_count = 0;
+    };
+
+}
+
+#endif
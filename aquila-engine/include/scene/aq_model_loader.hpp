@@ -2,6 +2,7 @@
 #define SCENE_AQUILA_MODEL_LOADER_HPP
 
 #include <memory>
+#include <optional>
 #include <vector>
 #include <string>
 
@@ -9,6 +10,7 @@
 #include "aq_material.hpp"
 #include "aq_mesh.hpp"
 #include "aq_node.hpp"
+#include "aq_mesh_optimizer.hpp"
 
 struct aiNode;
 struct aiMesh;
@@ -16,23 +18,51 @@ struct aiScene;
 
 namespace aq {
 
+    class AssetCache;
+
     class ModelLoader {
     public:
         // Loads model with name `file` located in `directory`
         // Finds textures relative to `directory`
-        ModelLoader(std::string directory, std::string file);
+        // Every mesh is optimized with `optimization_options` (see `mesh_util::optimize_mesh`)
+        // and gets a LOD chain generated with `lod_options` unless it is `std::nullopt`
+        // Meshes are processed in parallel on `ThreadPool::get_shared()`; the result is the same as loading them in order
+        // If `AssetCache::get_shared()` is set, the processed model (with block compressed textures) is stored in the
+        // cache and loaded from there as long as the model file, its texture files and the options are unchanged.
+        // Other files the model references (eg. a glTF's .bin buffers) aren't tracked. A model loaded from the cache
+        // has no optimization reports.
+        ModelLoader(
+            std::string directory,
+            std::string file,
+            const mesh_util::OptimizationOptions& optimization_options={},
+            const std::optional<mesh_util::LodOptions>& lod_options=mesh_util::LodOptions{}
+        );
 
         std::shared_ptr<Node> get_root_node() { return root_node; }
         const std::vector<std::shared_ptr<Material>>& get_materials() { return aq_materials; }
+        // One report per mesh, in the order of the meshes in the file
+        const std::vector<std::pair<std::string, mesh_util::OptimizationReport>>& get_optimization_reports() { return optimization_reports; }
 
     private:
+        // Returns false if the model isn't cached
+        bool load_from_cache(AssetCache& cache, uint64_t model_key);
+        void import_model(const std::string& path);
+
         std::shared_ptr<Node> process_node(aiNode* ai_node, const aiScene* ai_scene);
-        std::shared_ptr<Mesh> process_mesh(aiMesh* ai_mesh, const aiScene* ai_scene);
+        // Only touches the new mesh so it can run on any thread
+        std::shared_ptr<Mesh> process_mesh(aiMesh* ai_mesh, mesh_util::OptimizationReport& report);
+        // Creates the material the first time it's used
+        std::shared_ptr<Material> process_material(uint material_index, const aiScene* ai_scene);
 
         std::shared_ptr<Node> root_node = nullptr;
 
+        std::vector<std::shared_ptr<Mesh>> aq_meshes; // Indexed like the scene's meshes
         std::vector<std::shared_ptr<Material>> aq_materials;
 
+        mesh_util::OptimizationOptions optimization_options;
+        std::optional<mesh_util::LodOptions> lod_options;
+        std::vector<std::pair<std::string, mesh_util::OptimizationReport>> optimization_reports;
+
         std::string directory;
         std::string file;
     };
@@ -1,41 +1,128 @@
 #ifndef SCENE_AQUILA_TEXTURE_HPP
 #define SCENE_AQUILA_TEXTURE_HPP
 
+#include <future>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
 #include "util/vk_types.hpp"
+#include "util/vk_upload_scheduler.hpp"
 
 namespace aq {
 
+    namespace texture_util {
+
+        // An image on the CPU with its mip chain; either RGBA8 texels or blocks of a compressed format
+        struct ImageData {
+            vk::Format format = vk::Format::eR8G8B8A8Unorm;
+            vk::Extent2D extent; // Of mip level 0
+
+            struct Level {
+                vk::DeviceSize offset; // Into `data`
+                vk::DeviceSize size;
+            };
+            std::vector<Level> levels; // [0] is the full size image
+
+            const unsigned char* data = nullptr;
+            std::shared_ptr<const void> storage; // Keeps `data` alive (eg. a file mapping)
+            bool mapped = false; // `data` is a file mapping (eg. a KTX2 file) so keeping it costs no heap memory
+
+            uint64_t content_hash = 0; // See `hash_image`; 0 if it wasn't hashed
+        };
+
+        // Decodes an image file (eg. png, jpg) into RGBA8 with a full mip chain, or reads a KTX2 file as it is stored
+        // The decoded image is stored in (and next time read from) `AssetCache::get_shared()` if it is set
+        std::optional<ImageData> load_image(const std::string& path);
+        // Decodes a compressed image format (eg. png, jpg) from memory into RGBA8 with a full mip chain; cached like `load_image`
+        // `name` is only used for error messages
+        std::optional<ImageData> load_image_from_memory(const unsigned char* data, size_t size, const std::string& name);
+
+        // Returns a copy of level 0 of an RGBA8 `image` followed by every mip level down to 1x1, each a 2x2 box filter
+        // of the one before; the edge texels of odd sizes are repeated
+        // Other formats (and images that already have mip levels) are returned unchanged.
+        ImageData generate_mips(const ImageData& image);
+
+        // xxHash64 of the format, size and texels of mip level 0; identical images hash the same regardless of their path
+        uint64_t hash_image(const ImageData& image);
+
+    } // namespace texture_util
+
     class Texture {
     public:
         Texture();
         ~Texture();
 
+        // Both `upload_later`s start decoding the image on `ThreadPool::get_shared()` right away
         void upload_later(std::string path);
         // Embedded path should be unique to the texture. It is used for finding texture hashes
         // `data` will be copied into a private buffer
         // If `height` is 0, the size of data should be `width` and it will be read as a "compressed format" (eg. png, jpg, etc.)
         void upload_later(std::string embedded_path, unsigned char* data, int width, int height, std::string format_hint={});
+        // True while the image from `upload_later` is still being decoded; `upload` would block until it's done
+        bool is_decoding();
+        // Finishes decoding the image from `upload_later` without uploading it (waits if it's still decoding)
+        // `upload` uses the decoded image; returns false if it couldn't be decoded
+        bool decode();
+        // `texture_util::hash_image` of the decoded image; 0 until `decode` (or `upload`) has decoded it
+        uint64_t get_content_hash() { return content_hash; }
         // Uploads texture with data from `upload_later`
-        bool upload(vma::Allocator* allocator, const vk_util::UploadContext& upload_context);
+        // The transfer is only scheduled; `image.upload_ticket` can be used to check if it has finished
+        // If `streamed_extent` isn't 0 and the image is mapped (KTX2 files) the texture is streamed: the file stays mapped
+        // and only the levels at most `streamed_extent` texels wide and high are uploaded until `stream_levels` is called.
+        // Decoded images would have to stay in memory so they're uploaded whole.
+        bool upload(UploadScheduler* upload_scheduler, uint32_t streamed_extent=0);
 
         // Use texture path
-        bool upload_from_file(std::string path, vma::Allocator* allocator, const vk_util::UploadContext& upload_context);
-        bool upload_from_data(void* data, int width, int height, vma::Allocator* allocator, const vk_util::UploadContext& upload_context);
+        bool upload_from_file(std::string path, UploadScheduler* upload_scheduler);
+        // `data` is RGBA8; the mip levels are generated before uploading
+        bool upload_from_data(void* data, int width, int height, UploadScheduler* upload_scheduler);
+        // Uploads every mip level of `image_data` in its format
+        bool upload_from_image_data(const texture_util::ImageData& image_data, UploadScheduler* upload_scheduler);
         void clear_cpu_data();
+
+        // Replaces the image with one holding the mip levels from `first_level` of a streamed texture
+        // The old image and view are destroyed through `retirement_queue`; the caller has to stop using them
+        // (eg. by moving the texture to a new slot) and unregister the old image from defragmentation.
+        bool stream_levels(uint32_t first_level, UploadScheduler* upload_scheduler, RetirementQueue* retirement_queue);
+        bool is_streamed() { return bool(streamed_image); }
+        uint32_t get_first_resident_level() { return first_resident_level; }
+        uint32_t get_level_count() { return streamed_image ? uint32_t(streamed_image->levels.size()) : image.mip_levels; }
+        // First mip level that is at most `extent` texels wide and high
+        uint32_t get_level_for_extent(uint32_t extent);
+        // Bytes of the mip levels from `first_level` of a streamed texture
+        vk::DeviceSize get_streamed_size(uint32_t first_level);
+        // Recreates the image view after `image` was moved (eg. by defragmentation); the old view is destroyed through `stale_resources`
+        bool image_moved(DeletionQueue& stale_resources);
         void destroy(); // Only works if the object was allocated/uploaded with a member function
 
         bool is_uploaded() { return bool(image.image); };
         const std::string& get_path() { return path; };
+        // Data passed to `upload_later` for embedded textures; empty otherwise
+        const std::vector<unsigned char>& get_embedded_data() { return data; };
+        const std::string& get_format_hint() { return format_hint; };
         vk::DescriptorImageInfo get_image_info(vk::Sampler sampler=nullptr);
 
         AllocatedImage image;
         vk::ImageView image_view;
-        vk::Extent2D size;
+        vk::Extent2D size; // Of mip level 0, even if it isn't resident
     
     private:
+        bool create_image_view();
+        // Uploads the mip levels from `first_level` into `image`
+        bool upload_levels(const texture_util::ImageData& image_data, uint32_t first_level, UploadScheduler* upload_scheduler);
+
+        // Only reads `source`, which has to outlive the returned future
+        // The image is empty if decoding failed
+        static std::future<std::optional<texture_util::ImageData>> decode_async(std::string path, const std::vector<unsigned char>* source);
+        std::future<std::optional<texture_util::ImageData>> decoding;
+        std::optional<texture_util::ImageData> decoded_image; // Until it's uploaded
+        uint64_t content_hash = 0;
+
+        std::optional<texture_util::ImageData> streamed_image; // Every mip level of a streamed texture
+        uint32_t first_resident_level = 0;
+
         std::string path;
 
         // Used for `upload_later` with embedded data
@@ -0,0 +1,52 @@
+#ifndef SCENE_AQUILA_TEXTURE_COMPRESSOR_HPP
+#define SCENE_AQUILA_TEXTURE_COMPRESSOR_HPP
+
+#include <cstdint>
+
+#include "util/vk_types.hpp"
+#include "scene/aq_texture.hpp"
+#include "scene/aq_material.hpp"
+
+namespace aq {
+namespace texture_util {
+
+    // Checks if `physical_device` can sample every format `compress` encodes and remembers the result for
+    // `is_block_compression_supported`; called by the engine once the GPU is chosen
+    bool query_block_compression_support(vk::PhysicalDevice physical_device);
+    // False once `query_block_compression_support` found that the GPU can't sample BC textures; textures are then
+    // kept as RGBA8 and BC textures fail to upload. True if it was never queried (eg. when cooking offline).
+    bool is_block_compression_supported();
+
+    // Block compressed formats are stored as 4x4 texel blocks of 8 or 16 bytes
+    bool is_block_compressed(vk::Format format);
+    // Bytes per 4x4 block, or per texel for uncompressed formats
+    vk::DeviceSize get_block_size(vk::Format format);
+    // Bytes of one mip level of `extent`
+    vk::DeviceSize get_level_size(vk::Format format, vk::Extent2D extent);
+
+    // Picks the compressed format for a texture by how the shaders read it
+    // - Albedo: BC7 (BC1 or BC3 with `high_quality` off; quicker to encode and BC1 is half the size)
+    // - Roughness, metalness and ambient occlusion: BC4; only the red channel is read
+    // - Normal: BC5; only x and y are stored so z has to be reconstructed when sampling
+    vk::Format choose_compressed_format(Material::TextureType type, bool has_alpha, bool high_quality=true);
+
+    // True if any texel of an RGBA8 image isn't opaque
+    bool has_alpha(const ImageData& image);
+
+    // Encodes every mip level of an RGBA8 `image` into `format` (`eBc1RgbUnormBlock`, `eBc3UnormBlock`,
+    // `eBc4UnormBlock`, `eBc5UnormBlock` or `eBc7UnormBlock`) on `ThreadPool::get_shared()`
+    // Meant for cooking; the encoders favour speed over finding the best endpoints.
+    // Returns nothing if `image` isn't RGBA8 or `format` isn't supported.
+    std::optional<ImageData> compress(const ImageData& image, vk::Format format);
+
+    // Single block encoders; `texels` are 16 RGBA8 texels in row-major order
+    void encode_bc1_block(const uint8_t texels[16][4], uint8_t block[8]);
+    void encode_bc3_block(const uint8_t texels[16][4], uint8_t block[16]);
+    void encode_bc4_block(const uint8_t values[16], uint8_t block[8]);
+    void encode_bc5_block(const uint8_t texels[16][4], uint8_t block[16]);
+    void encode_bc7_block(const uint8_t texels[16][4], uint8_t block[16]);
+
+} // namespace texture_util
+} // namespace aq
+
+#endif
@@ -1,16 +1,23 @@
 #ifndef SCENE_AQUILA_VERTEX_HPP
 #define SCENE_AQUILA_VERTEX_HPP
 
+#include <array>
+#include <cstddef>
+#include <vector>
+
 #include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
 
 #include "util/vk_types.hpp"
 
 namespace aq {
 
+    // Full precision vertex used on the CPU (loading, editing, generating meshes)
+    // Meshes are packed into one of the `VertexFormat`s when they are uploaded
     struct Vertex {
         Vertex(
-            glm::vec4 position = glm::vec4(0.0f,0.0f,0.0f,1.0f), 
-            glm::vec4 normal = glm::vec4(0.0f), 
+            glm::vec4 position = glm::vec4(0.0f,0.0f,0.0f,1.0f),
+            glm::vec4 normal = glm::vec4(0.0f),
             glm::vec2 tex_coord = glm::vec4(0.0f)
         );
 
@@ -28,9 +35,106 @@ namespace aq {
         vk::PipelineVertexInputStateCreateFlags flags = {};
     };
 
+    // Vertex layouts stored on the GPU; every format has its own vertex shader (`VertexLayout<V>::vertex_shader`)
+    enum class VertexFormat : uint32_t {
+        Full, // `Vertex` as is; 40 bytes
+        Compact, // `CompactVertex`; 20 bytes
+        Quantized, // `QuantizedVertex`; 16 bytes
+        Count
+    };
+
+    // Float3 position, octahedral encoded normal (snorm16x2) and half float tex coords
+    struct CompactVertex {
+        glm::vec3 position;
+        glm::i16vec2 normal;
+        glm::u16vec2 tex_coord;
+    };
+
+    // Like `CompactVertex` but the position is a unorm16 relative to the mesh bounds
+    // The bounds are passed to the vertex shader (see `VertexBounds`) to dequantize the position
+    struct QuantizedVertex {
+        glm::u16vec4 position; // w is unused (3 component 16 bit formats are rarely supported as vertex inputs)
+        glm::i16vec2 normal;
+        glm::u16vec2 tex_coord;
+    };
+
+    // Axis aligned bounds of a mesh's vertices
+    struct VertexBounds {
+        glm::vec3 min{0.0f};
+        glm::vec3 extent{0.0f}; // max - min
+
+        static VertexBounds from_vertices(const std::vector<Vertex>& vertices);
+    };
+
+    glm::i16vec2 encode_octahedral(glm::vec3 normal);
+    glm::vec3 decode_octahedral(glm::i16vec2 encoded);
+
+    // Compile time description of a GPU vertex layout
+    // Every layout has a position (location 0), normal (location 1) and tex coord (location 2) attribute
+    template <typename V>
+    struct VertexLayout;
+
+    template <>
+    struct VertexLayout<Vertex> {
+        static constexpr VertexFormat format = VertexFormat::Full;
+        static constexpr std::array<vk::Format, 3> attribute_formats{
+            vk::Format::eR32G32B32A32Sfloat, vk::Format::eR32G32B32A32Sfloat, vk::Format::eR32G32Sfloat
+        };
+        static constexpr const char* vertex_shader = "color.vert.spv";
+        static Vertex pack(const Vertex& vertex, const VertexBounds&) { return vertex; }
+    };
+
+    template <>
+    struct VertexLayout<CompactVertex> {
+        static constexpr VertexFormat format = VertexFormat::Compact;
+        static constexpr std::array<vk::Format, 3> attribute_formats{
+            vk::Format::eR32G32B32Sfloat, vk::Format::eR16G16Snorm, vk::Format::eR16G16Sfloat
+        };
+        static constexpr const char* vertex_shader = "color_compact.vert.spv";
+        static CompactVertex pack(const Vertex& vertex, const VertexBounds& bounds);
+    };
+
+    template <>
+    struct VertexLayout<QuantizedVertex> {
+        static constexpr VertexFormat format = VertexFormat::Quantized;
+        static constexpr std::array<vk::Format, 3> attribute_formats{
+            vk::Format::eR16G16B16A16Unorm, vk::Format::eR16G16Snorm, vk::Format::eR16G16Sfloat
+        };
+        static constexpr const char* vertex_shader = "color_quantized.vert.spv";
+        static QuantizedVertex pack(const Vertex& vertex, const VertexBounds& bounds);
+    };
+
+    template <typename V>
+    struct VertexInputDescription {
+        static constexpr vk::VertexInputBindingDescription binding{0, sizeof(V), vk::VertexInputRate::eVertex};
+        static constexpr std::array<vk::VertexInputAttributeDescription, 3> attributes{{
+            {0, 0, VertexLayout<V>::attribute_formats[0], offsetof(V, position)},
+            {1, 0, VertexLayout<V>::attribute_formats[1], offsetof(V, normal)},
+            {2, 0, VertexLayout<V>::attribute_formats[2], offsetof(V, tex_coord)}
+        }};
+
+        static Vertex::InputDescription get() {
+            return Vertex::InputDescription{{binding}, {attributes.begin(), attributes.end()}};
+        }
+    };
+
+    static_assert(sizeof(CompactVertex) == 20, "Unexpected padding in `CompactVertex`");
+    static_assert(sizeof(QuantizedVertex) == 16, "Unexpected padding in `QuantizedVertex`");
+
+    // Returns the tightly packed vertex data in `format`
+    std::vector<unsigned char> pack_vertices(VertexFormat format, const std::vector<Vertex>& vertices, const VertexBounds& bounds);
+    vk::DeviceSize get_vertex_size(VertexFormat format);
+    Vertex::InputDescription get_vertex_description(VertexFormat format);
+    const char* get_vertex_shader(VertexFormat format);
+
+    // Indices are always 32 bit on the CPU; meshes with few enough vertices are uploaded with 16 bit indices
     using Index = uint32_t;
-    constexpr vk::IndexType index_vk_type = vk::IndexType::eUint32;
+    constexpr size_t max_vertices_for_uint16_indices = size_t(UINT16_MAX) + 1;
+
+    inline vk::DeviceSize get_index_size(vk::IndexType index_type) {
+        return index_type == vk::IndexType::eUint16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,51 @@
+#ifndef UTIL_AQUILA_ASSET_CACHE_HPP
+#define UTIL_AQUILA_ASSET_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace aq {
+
+    // A directory of processed assets (eg. cooked models, mipmapped and compressed textures) keyed by a hash of
+    // their source and the settings they were processed with
+    // Entries are never modified: a changed source or setting hashes to a new key, so stale entries are just no
+    // longer found (delete the directory to reclaim their space). Entries are written to a temporary file and
+    // renamed into place so they are never seen half written, even by other processes.
+    // Thread safe.
+    class AssetCache {
+    public:
+        // Creates `directory` if it doesn't exist
+        AssetCache(const std::string& directory);
+
+        // The cache `ModelLoader` and `Texture` check before processing assets; nullptr (the default) disables caching
+        static std::shared_ptr<AssetCache> get_shared();
+        static void set_shared(std::shared_ptr<AssetCache> cache);
+
+        // xxHash64 of the file's contents; 0 if it can't be read
+        static uint64_t hash_file(const std::string& path);
+        // Mixes `value` (eg. a setting or a version) into `key`
+        static uint64_t combine(uint64_t key, uint64_t value);
+        static uint64_t combine(uint64_t key, const void* data, size_t size);
+
+        // Where the entry is (or would be) stored
+        std::string get_path(uint64_t key, const std::string& extension) const;
+        bool contains(uint64_t key, const std::string& extension) const;
+
+        // Writes the entry in one go
+        bool write(uint64_t key, const std::string& extension, const void* data, size_t size);
+        // For entries written by other functions: write to a unique temporary path, then `commit` it
+        std::string get_temporary_path(uint64_t key, const std::string& extension);
+        // Moves the file at `temporary_path` into the cache; it is removed if the entry already exists
+        bool commit(const std::string& temporary_path, uint64_t key, const std::string& extension);
+
+        const std::string& get_directory() const { return directory; }
+
+    private:
+        std::string directory; // Ends with a separator
+    };
+
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef UTIL_AQUILA_HASH_HPP
+#define UTIL_AQUILA_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace aq {
+
+    // XXH64 (https://github.com/Cyan4973/xxHash); a fast non-cryptographic hash for identifying content
+    // Data in several pieces can be hashed by passing the previous hash as `seed`.
+    uint64_t xxhash64(const void* data, size_t size, uint64_t seed=0);
+
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef UTIL_AQUILA_MAPPED_FILE_HPP
+#define UTIL_AQUILA_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace aq {
+
+    // A read-only memory mapping of a whole file
+    // Pages are only read from disk when they are touched so large files open instantly
+    class MappedFile {
+    public:
+        // Returns nullptr if the file can't be opened or mapped
+        static std::shared_ptr<MappedFile> open(const std::string& path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const unsigned char* data() const { return mapping; }
+        size_t size() const { return mapping_size; }
+
+    private:
+        MappedFile() = default;
+
+        const unsigned char* mapping = nullptr;
+        size_t mapping_size = 0;
+#ifdef _WIN32
+        void* file_handle = nullptr;
+        void* mapping_handle = nullptr;
+#endif
+    };
+
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef UTIL_AQUILA_THREAD_POOL_HPP
+#define UTIL_AQUILA_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace aq {
+
+    // A fixed set of worker threads running CPU work (asset importing, decoding, etc.) off the main thread
+    // Tasks must not touch Vulkan objects that are externally synchronized by the render loop.
+    class ThreadPool {
+    public:
+        // `thread_count` of 0 uses one thread per core, minus one for the main thread
+        ThreadPool(uint thread_count=0);
+        // Finishes the queued tasks before joining the workers
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Shared by the engine's loaders; created on first use
+        static ThreadPool& get_shared();
+
+        // Queues `task` and returns a future for its result
+        template <typename F>
+        std::future<std::invoke_result_t<F>> submit(F&& task) {
+            using Result = std::invoke_result_t<F>;
+            // `std::function` needs a copyable callable so the packaged task is shared
+            auto packaged_task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+            std::future<Result> future = packaged_task->get_future();
+            enqueue([packaged_task]() { (*packaged_task)(); });
+            return future;
+        }
+
+        // Calls `func(i)` for every `i` in [0, `count`) across the workers and the calling thread
+        // Returns once every call has finished. The calling thread takes part so this can be used from a task.
+        void parallel_for(size_t count, const std::function<void(size_t)>& func);
+
+        uint get_thread_count() { return uint(workers.size()); }
+
+    private:
+        void enqueue(std::function<void()> task);
+        void work();
+
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable task_available;
+        bool stopping = false;
+    };
+
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef UTIL_AQUILA_DEFRAGMENTATION_HPP
+#define UTIL_AQUILA_DEFRAGMENTATION_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <functional>
+
+#include "util/vk_types.hpp"
+#include "util/vk_upload_scheduler.hpp"
+
+namespace aq {
+
+    // Incrementally defragments device memory with VMA's defragmentation passes
+    // Only registered (device local) buffers and images are moved; everything else is ignored.
+    // Each pass is bounded by `max_bytes_per_pass`/`max_moves_per_pass` and stays open for
+    // `frame_overlap` frames so frames in flight can finish with the old resources.
+    class DefragmentationService {
+    public:
+        struct Stats {
+            uint64_t bytes_moved = 0;
+            uint64_t bytes_reclaimed = 0;
+            uint64_t allocations_moved = 0;
+            uint64_t device_memory_blocks_freed = 0;
+            uint64_t runs = 0;
+        };
+
+        DefragmentationService();
+
+        bool init(
+            vma::Allocator* allocator,
+            vk::Device device,
+            UploadScheduler* upload_scheduler, // Buffer copies are batched through here
+            uint64_t frame_overlap,
+            vk::DeviceSize max_bytes_per_pass,
+            uint32_t max_moves_per_pass,
+            uint64_t auto_start_period=0 // Start a run every `auto_start_period` frames (0 to disable)
+        );
+        // The device must be idle
+        void destroy();
+
+        // `on_moved` is called after the resource has switched to its new handle
+        // Handles derived from the old resource (eg. image views) should be destroyed through `stale_resources`
+        void register_buffer(AllocatedBuffer* buffer, vk::DeviceSize size, vk::BufferUsageFlags usage, std::function<void(DeletionQueue& stale_resources)>&& on_moved={});
+        // The image must be in `eShaderReadOnlyOptimal` layout
+        void register_image(AllocatedImage* image, std::function<void(DeletionQueue& stale_resources)>&& on_moved={});
+        // Called by `AllocatedBuffer::destroy` and `AllocatedImage::destroy`
+        // If `allocation` is being moved, waits for the device to idle and finishes the pass first (should be rare)
+        void release(vma::Allocation allocation);
+
+        void start();
+        bool is_running() { return running; }
+
+        // Call once per frame after waiting on the frame's fence and before any registered resource is used
+        // Image copies are recorded into `cmd` which must be recording and outside of a render pass
+        void update(uint64_t frame_number, vk::CommandBuffer cmd);
+
+        const Stats& get_stats() { return stats; }
+
+    private:
+        struct Registration {
+            AllocatedBuffer* buffer = nullptr;
+            AllocatedImage* image = nullptr;
+            vk::DeviceSize size = 0;
+            vk::BufferUsageFlags usage;
+            std::function<void(DeletionQueue&)> on_moved;
+        };
+
+        void begin_pass(uint64_t frame_number, vk::CommandBuffer cmd);
+        void end_pass();
+        void finish(); // Ends the run
+
+        bool move_buffer(Registration& registration, vma::DefragmentationMove& move);
+        bool move_image(Registration& registration, vma::DefragmentationMove& move, vk::CommandBuffer cmd);
+
+        vma::Allocator* allocator = nullptr;
+        vk::Device device;
+        UploadScheduler* upload_scheduler = nullptr;
+        uint64_t frame_overlap;
+        vk::DeviceSize max_bytes_per_pass;
+        uint32_t max_moves_per_pass;
+        uint64_t auto_start_period;
+        uint64_t last_run_frame = 0;
+
+        std::unordered_map<VmaAllocation, Registration> registrations;
+
+        bool running = false;
+        vma::DefragmentationContext context;
+
+        bool pass_pending = false;
+        uint64_t pass_frame = 0;
+        vma::DefragmentationPassMoveInfo pass_info;
+        DeletionQueue stale_resources; // Old handles of moved resources; flushed when the pass ends
+
+        Stats stats;
+    };
+
+}
+
+#endif
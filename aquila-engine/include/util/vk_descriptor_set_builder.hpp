@@ -7,17 +7,54 @@
 
 namespace aq {
 
+    // Allocates descriptor sets from pools that are created on demand
+    // Pools are sized by `PoolSizeRatio`s (descriptors per set) and grow as more are needed. When a pool runs
+    // out of memory the allocation is retried in a fresh pool.
+    // Long lived sets live until `destroy`. Per frame sets are freed in bulk when their pools are reset with
+    // `next_frame` so they are cheap to allocate every frame (eg. per pass or per draw sets).
     class DescriptorSetAllocator {
     public:
+        struct PoolSizeRatio {
+            vk::DescriptorType type;
+            float ratio; // Descriptors of `type` per set
+        };
+
         DescriptorSetAllocator();
 
-        void init(vk::Device device);
+        void init(vk::Device device, uint frame_overlap=1, const std::vector<PoolSizeRatio>& pool_size_ratios=default_pool_size_ratios);
         void destroy();
 
-        vk::DescriptorPool new_pool(const std::vector<vk::DescriptorPoolSize>& pool_sizes);
+        // `required_sizes` are the descriptors needed by one set with `layout`; only used if a set with `layout`
+        // doesn't fit in a new pool (eg. big arrays of descriptors)
+        vk::DescriptorSet allocate(vk::DescriptorSetLayout layout, const std::vector<vk::DescriptorPoolSize>& required_sizes={});
+        // The set is only valid until `next_frame` is called for a frame with the same `frame_number % frame_overlap`
+        vk::DescriptorSet allocate_per_frame(uint64_t frame_number, vk::DescriptorSetLayout layout, const std::vector<vk::DescriptorPoolSize>& required_sizes={});
+
+        // Call once per frame after waiting on the frame's fence
+        // Resets the pools of the per frame sets allocated `frame_overlap` frames ago
+        void next_frame(uint64_t frame_number);
+
+        // Creates a pool that is destroyed with the allocator
+        vk::DescriptorPool new_pool(const std::vector<vk::DescriptorPoolSize>& pool_sizes, uint32_t max_sets=0);
+
+        static const std::vector<PoolSizeRatio> default_pool_size_ratios;
 
     private:
-        std::vector<vk::DescriptorPool> descriptor_pools;
+        struct Pools {
+            std::vector<vk::DescriptorPool> ready_pools; // Have space left
+            std::vector<vk::DescriptorPool> full_pools;
+            uint32_t sets_per_pool = 16;
+        };
+
+        vk::DescriptorSet allocate_from(Pools& pools, vk::DescriptorSetLayout layout, const std::vector<vk::DescriptorPoolSize>& required_sizes);
+        vk::DescriptorPool get_pool(Pools& pools);
+        void reset(Pools& pools);
+
+        std::vector<PoolSizeRatio> pool_size_ratios;
+        Pools long_lived_pools;
+        std::vector<Pools> frame_pools; // Indexed by `frame_number % frame_overlap`
+
+        std::vector<vk::DescriptorPool> descriptor_pools; // Every pool that was created
         vk::Device device;
     };
 
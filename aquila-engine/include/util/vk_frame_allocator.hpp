@@ -0,0 +1,69 @@
+#ifndef UTIL_AQUILA_FRAME_ALLOCATOR_HPP
+#define UTIL_AQUILA_FRAME_ALLOCATOR_HPP
+
+#include <cstring>
+
+#include "util/vk_types.hpp"
+
+namespace aq {
+
+    // Linear allocator for transient uniform/storage data that only lives for one frame
+    // A single persistently mapped buffer is split into `frame_overlap` regions; every allocation is
+    // bumped from the current frame's region which is reset as a whole in `next_frame`.
+    // Allocations are bound with dynamic offsets (`vk::DescriptorType::eUniformBufferDynamic` or
+    // `eStorageBufferDynamic`) so one descriptor set works for every allocation in every frame.
+    class FrameAllocator {
+    public:
+        struct Allocation {
+            void* data = nullptr; // Mapped memory; write the data here
+            uint32_t offset = 0; // Dynamic offset from the start of the buffer
+            vk::DeviceSize size = 0;
+
+            bool is_valid() const { return data != nullptr; }
+        };
+
+        FrameAllocator();
+
+        bool init(
+            vma::Allocator* allocator,
+            uint frame_overlap,
+            vk::DeviceSize frame_size, // Bytes available to each frame
+            const vk::PhysicalDeviceLimits& limits // For the offset alignments
+        );
+        void destroy();
+
+        // Call once per frame after waiting on the frame's fence
+        void next_frame(uint64_t frame_number);
+
+        // Returns an invalid allocation if the frame's region is full
+        Allocation allocate(vk::DeviceSize size);
+        template <typename T>
+        Allocation push(const T& data) {
+            Allocation allocation = allocate(sizeof(T));
+            if (allocation.is_valid()) memcpy(allocation.data, &data, sizeof(T));
+            return allocation;
+        }
+
+        // Use with a dynamic descriptor whose range is the size of the data read by the shader
+        vk::DescriptorBufferInfo get_descriptor_info(vk::DeviceSize range) { return {buffer.buffer, 0, range}; }
+
+        vk::Buffer get_buffer() { return buffer.buffer; }
+        vk::DeviceSize get_frame_size() { return frame_size; }
+        vk::DeviceSize get_used_size() { return offset - frame_offset; } // Used by the current frame
+
+    private:
+        vma::Allocator* allocator = nullptr;
+        AllocatedBuffer buffer;
+        unsigned char* p_buffer_memory = nullptr;
+
+        uint frame_overlap = 1;
+        vk::DeviceSize frame_size = 0;
+        vk::DeviceSize alignment = 1;
+
+        vk::DeviceSize frame_offset = 0; // Start of the current frame's region
+        vk::DeviceSize offset = 0; // Next free byte
+    };
+
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef UTIL_AQUILA_GEOMETRY_ARENA_HPP
+#define UTIL_AQUILA_GEOMETRY_ARENA_HPP
+
+#include <unordered_map>
+#include <vector>
+
+#include "util/vk_types.hpp"
+#include "util/vk_resizable_buffer.hpp"
+#include "util/vk_upload_scheduler.hpp"
+
+namespace aq {
+
+    // A single GPU buffer that is suballocated into many smaller ranges
+    // Offsets are managed by VMA virtual blocks. When the buffer runs out of space it is
+    // grown and a new virtual block is added to manage the new space so existing
+    // offsets stay valid.
+    class SuballocatedBuffer {
+    public:
+        struct Allocation {
+            vk::DeviceSize offset = 0; // Offset in bytes from the start of the buffer
+            vk::DeviceSize size = 0;
+
+            uint32_t chunk = UINT32_MAX;
+            vma::VirtualAllocation virtual_allocation;
+
+            bool is_valid() const { return chunk != UINT32_MAX; }
+        };
+
+        SuballocatedBuffer();
+
+        bool init(vma::Allocator* allocator, vk::DeviceSize initial_size, vk::BufferUsageFlags usage, UploadScheduler* upload_scheduler, RetirementQueue* retirement_queue, MemoryOwner owner=MemoryOwner::Other);
+        void destroy();
+
+        // Returns an invalid allocation if the buffer could not be grown to fit `size`
+        // `offset` is a multiple of `alignment` from the start of the buffer; it doesn't have to be a power of two
+        // (eg. a vertex size so the offset can be divided into a `vertexOffset`)
+        Allocation allocate(vk::DeviceSize size, vk::DeviceSize alignment);
+        void free(Allocation& allocation);
+
+        void enable_defragmentation(DefragmentationService* defragmentation_service) { buffer.enable_defragmentation(defragmentation_service); }
+
+        vk::Buffer get_buffer() { return buffer.get_buffer(); }
+        vk::DeviceSize get_size() { return buffer.get_size(); }
+
+    private:
+        bool grow(vk::DeviceSize min_additional_size);
+
+        struct Chunk {
+            vk::DeviceSize offset;
+            vma::VirtualBlock block;
+        };
+        std::vector<Chunk> chunks;
+
+        ResizableBuffer buffer;
+        UploadScheduler* upload_scheduler = nullptr;
+        RetirementQueue* retirement_queue = nullptr;
+    };
+
+    // Global device-local vertex and index buffers shared by every mesh
+    // Meshes suballocate from the arena and are drawn with `vertexOffset`/`firstIndex`
+    // so the buffers only need to be bound once per frame
+    // Meshlets (`GPUMeshlet`s) of meshes that are culled per cluster are kept in a third buffer
+    class GeometryArena {
+    public:
+        using Allocation = SuballocatedBuffer::Allocation;
+
+        GeometryArena();
+
+        bool init(
+            vma::Allocator* allocator,
+            vk::DeviceSize initial_vertex_capacity, // In bytes
+            vk::DeviceSize initial_index_capacity, // In bytes
+            vk::DeviceSize initial_meshlet_capacity, // In bytes
+            UploadScheduler* upload_scheduler,
+            RetirementQueue* retirement_queue // The old buffers are retired here when the arena grows
+        );
+        void destroy();
+
+        // `alignment` should be the vertex stride so the allocation's offset can be used as a `vertexOffset`
+        Allocation allocate_vertices(vk::DeviceSize size, vk::DeviceSize alignment) { return vertices.allocate(size, alignment); }
+        // `alignment` should be the index size so the allocation's offset can be used as a `firstIndex`
+        Allocation allocate_indices(vk::DeviceSize size, vk::DeviceSize alignment) { return indices.allocate(size, alignment); }
+        // `alignment` should be `sizeof(GPUMeshlet)` so the allocation's offset is a meshlet index
+        Allocation allocate_meshlets(vk::DeviceSize size, vk::DeviceSize alignment) { return meshlets.allocate(size, alignment); }
+        void free_vertices(Allocation& allocation) { vertices.free(allocation); }
+        void free_indices(Allocation& allocation) { indices.free(allocation); }
+        void free_meshlets(Allocation& allocation) { meshlets.free(allocation); }
+
+        // Geometry that is uploaded once and shared by every mesh with the same content (see `Mesh::upload`)
+        struct SharedGeometry {
+            Allocation vertices;
+            Allocation indices;
+            Allocation meshlets;
+            uint64_t upload_ticket = 0; // See `UploadScheduler::Ticket`
+            uint32_t references = 0;
+        };
+        // Adds a reference to the geometry with content hash `hash`; returns nullptr if there is none
+        const SharedGeometry* acquire_shared_geometry(uint64_t hash);
+        // Takes over the allocations of `geometry`, which starts with one reference
+        void add_shared_geometry(uint64_t hash, const SharedGeometry& geometry);
+        // Frees the allocations once the last reference is released
+        void release_shared_geometry(uint64_t hash);
+
+        // Lets `defragmentation_service` move the arena's buffers to compact device memory
+        void enable_defragmentation(DefragmentationService* defragmentation_service);
+
+        // The buffers may change when the arena grows (or is moved by defragmentation) so they should be queried every frame
+        vk::Buffer get_vertex_buffer() { return vertices.get_buffer(); }
+        vk::Buffer get_index_buffer() { return indices.get_buffer(); }
+        vk::Buffer get_meshlet_buffer() { return meshlets.get_buffer(); }
+
+        vma::Allocator* get_allocator() { return allocator; }
+        UploadScheduler* get_upload_scheduler() { return upload_scheduler; }
+
+    private:
+        SuballocatedBuffer vertices;
+        SuballocatedBuffer indices;
+        SuballocatedBuffer meshlets;
+        std::unordered_map<uint64_t, SharedGeometry> shared_geometries; // By content hash
+
+        vma::Allocator* allocator = nullptr;
+        UploadScheduler* upload_scheduler = nullptr;
+    };
+
+}
+
+#endif
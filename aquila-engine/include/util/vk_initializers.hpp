@@ -50,6 +50,9 @@ namespace aq {
 
             std::vector<vk::QueueFamilyProperties> supported_queue_families;
             uint32_t graphics_present_queue_family;
+            // A transfer-only queue family if the GPU has one (usually backed by a dedicated DMA engine)
+            // Otherwise the same as `graphics_present_queue_family`
+            uint32_t transfer_queue_family = UINT32_MAX;
 
             SwapChainSupportDetails sw_ch_support;
 
@@ -88,7 +91,9 @@ namespace aq {
                 vk::SurfaceKHR compatible_surface
             );
 
-            bool create_device(std::unordered_map<std::string, bool>& device_extensions, const vk::PhysicalDeviceFeatures& requested_features);
+            // `features_p_next` is used as the `pNext` chain of `vk::DeviceCreateInfo` (eg. for `vk::PhysicalDeviceVulkan12Features`)
+            // Creates one queue for `graphics_present_queue_family` and one for `transfer_queue_family` if they differ
+            bool create_device(std::unordered_map<std::string, bool>& device_extensions, const vk::PhysicalDeviceFeatures& requested_features, const void* features_p_next=nullptr);
 
             GPUSupport get_gpu_support();
 
@@ -0,0 +1,58 @@
+#ifndef UTIL_AQUILA_MEMORY_BUDGET_HPP
+#define UTIL_AQUILA_MEMORY_BUDGET_HPP
+
+#include <string>
+#include <vector>
+
+#include "util/vk_types.hpp"
+
+namespace aq {
+
+    const char* to_string(MemoryOwner owner);
+
+    // Tracks GPU memory use per `MemoryOwner` and against the heap budgets reported by the driver
+    // (VK_EXT_memory_budget if it is enabled, otherwise VMA's estimate)
+    // `AllocatedBuffer` and `AllocatedImage` account their allocations automatically; the per owner
+    // totals are global and thread safe.
+    class MemoryBudget {
+    public:
+        struct OwnerUsage {
+            vk::DeviceSize bytes = 0;
+            uint64_t allocations = 0;
+        };
+
+        struct HeapUsage {
+            vk::DeviceSize size = 0; // Size of the heap
+            vk::DeviceSize budget = 0; // How much the application can use before allocations may fail or start to slow down
+            vk::DeviceSize usage = 0; // How much is used (by this process)
+            vk::DeviceSize block_bytes = 0; // Allocated by VMA as `vk::DeviceMemory`
+            vk::DeviceSize allocation_bytes = 0; // Used by allocations inside those blocks
+            bool device_local = false;
+        };
+
+        MemoryBudget();
+
+        void init(vma::Allocator* allocator, bool memory_budget_extension_enabled);
+
+        static void track(MemoryOwner owner, vk::DeviceSize size);
+        static void untrack(MemoryOwner owner, vk::DeviceSize size);
+        static OwnerUsage get_owner_usage(MemoryOwner owner);
+
+        std::vector<HeapUsage> get_heap_usages();
+        // Memory left in the device local heaps before the budget is exceeded
+        // Subsystems should check this and degrade (eg. skip or downscale textures) instead of running out of memory
+        vk::DeviceSize get_remaining_budget();
+
+        std::string to_json();
+        bool dump_json(const std::string& path);
+
+        bool is_memory_budget_extension_enabled() { return memory_budget_extension_enabled; }
+
+    private:
+        vma::Allocator* allocator = nullptr;
+        bool memory_budget_extension_enabled = false;
+    };
+
+}
+
+#endif
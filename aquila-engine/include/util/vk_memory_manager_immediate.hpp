@@ -22,7 +22,9 @@ namespace aq {
             size_t reserve_size, // Number of objects the first allocation should be able to hold
             vk::WriteDescriptorSet* descriptors, // A pointer to `frame_overlap` `vk::WriteDescriptorSet`s. The memory only needs to stay valid until `init` returns. `pBufferInfo` and `descriptorType` will be filled in by `MaterialManager`.
             vma::Allocator* allocator, 
-            vk_util::UploadContext upload_context
+            vk_util::UploadContext upload_context,
+            RetirementQueue* retirement_queue, // Buffers replaced by a resize are retired here
+            MemoryOwner owner=MemoryOwner::Other // What the buffers are accounted to (see `MemoryBudget`)
         );
 
         // Release allocated data.
@@ -65,6 +67,7 @@ namespace aq {
 
         vma::Allocator* allocator;
         vk_util::UploadContext ctx;
+        RetirementQueue* retirement_queue;
     };
 
 }
@@ -2,8 +2,6 @@
 #define UTIL_AQUILA_MEMORY_MANAGER_RETAINED_HPP
 
 #include <vector>
-#include <list>
-#include <deque>
 #include <unordered_map>
 #include <memory>
 #include <utility>
@@ -25,7 +23,9 @@ namespace aq {
             size_t reserve_size, // Number of objects the first allocation should be able to hold
             vk::WriteDescriptorSet* descriptors, // A pointer to `frame_overlap` `vk::WriteDescriptorSet`s. The memory only needs to stay valid until `init` returns. `pBufferInfo` and `descriptorType` will be filled in by `MaterialManager`.
             vma::Allocator* allocator, 
-            vk_util::UploadContext upload_context
+            vk_util::UploadContext upload_context,
+            RetirementQueue* retirement_queue, // Buffers replaced by a resize are retired here
+            MemoryOwner owner=MemoryOwner::Other // What the buffers are accounted to (see `MemoryBudget`)
         );
 
         // Release allocated data.
@@ -33,7 +33,8 @@ namespace aq {
 
         // `object` should be a pointer to `object_size` bytes of memory.
         // `object` will be copied; it only needs to be a valid pointer until this function returns
-        // Returns the index `object` will be located at.
+        // Returns a handle to `object`. The handle stays valid until `remove_object` but the location of
+        // the object in the buffer (`get_slot`) can change when `compact` is called.
         ManagedMemoryIndex add_object(void* object);
 
         // `object` should be a pointer to `object_size` bytes of memory
@@ -45,43 +46,54 @@ namespace aq {
         // `index` will no longer be valid.
         void remove_object(ManagedMemoryIndex index);
 
+        // Location of the object with handle `index` in the buffer (in objects, not bytes)
+        size_t get_slot(ManagedMemoryIndex index) { return handle_slots[index]; }
+
+        // Moves objects at the end of the buffer into the holes left by `remove_object` and shrinks the buffers
+        // Slots change but handles stay valid. Returns the number of objects moved.
+        size_t compact();
+        size_t get_nr_objects() { return end_index - free_slots.size(); }
+        size_t get_nr_free_slots() { return free_slots.size(); }
+
         // Uploads object memory to the GPU for `safe_frame`
         // `safe_frame` must be finished rendering (usually the frame about to be rendered onto)
         void update(uint safe_frame);
 
     private:
-        struct Action {
-            enum class Type {
-                Add,
-                Update,
-                Remove
-            };
-            Type type;
-            uint count = 1;
-            ManagedMemoryIndex index; 
-
-            // `memory` should be an array of size `object_size*count` bytes (uchars)
-            std::shared_ptr<std::byte[]> memory;
-        };
-
         struct QueuedBuffer {
             ResizableBuffer buffer;
             std::byte* buff_mem;
             vk::WriteDescriptorSet write_descriptor;
 
-            std::vector<Action> update_queue;
+            // One bit per object; set if the object changed since this buffer was last updated
+            std::vector<uint64_t> dirty;
         };
         std::vector<QueuedBuffer> buffers;
 
+        void mark_dirty(size_t slot);
+
+        // CPU copy of every object. Buffers are updated from here so repeated updates to an
+        // object between uploads are merged and adjacent dirty objects are copied in one `memcpy`
+        std::vector<std::byte> shadow;
+
+        static constexpr size_t INVALID_SLOT = SIZE_MAX;
+
+        // Handle -> slot indirection so objects can be moved by `compact`
+        std::vector<size_t> handle_slots; // `INVALID_SLOT` for removed handles
+        std::vector<ManagedMemoryIndex> slot_handles; // Only valid for occupied slots
+        std::vector<ManagedMemoryIndex> free_handles;
+
         // Holes in the memory caused by `remove_object` that can be filled
-        std::deque<ManagedMemoryIndex> free_memory;
+        std::vector<size_t> free_slots;
 
         uint object_size;
         size_t buffer_size; // Might not be accurate; buffer sizes are updated in `update`
         size_t end_index; // End of where the buffer is filled. Memory at `end_index` and beyond is free
+        size_t reserve_size;
 
         vma::Allocator* allocator;
         vk_util::UploadContext ctx;
+        RetirementQueue* retirement_queue;
     };
 
 }
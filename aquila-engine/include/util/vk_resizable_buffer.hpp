@@ -1,7 +1,10 @@
 #ifndef UTIL_AQUILA_RESIZABLE_BUFFER_HPP
 #define UTIL_AQUILA_RESIZABLE_BUFFER_HPP
 
+#include <vector>
+
 #include "util/vk_types.hpp"
+#include "util/vk_upload_scheduler.hpp"
 
 namespace aq {
 
@@ -10,26 +13,43 @@ namespace aq {
         ResizableBuffer();
 
         // Will add `vk::BufferUsageFlagBits::eTransferSrc` and `vk::BufferUsageFlagBits::eTransferDst` to `usage` 
-        bool allocate(vma::Allocator* allocator, vk::DeviceSize allocation_size, const vk::BufferUsageFlags& usage, const vma::MemoryUsage& memory_usage, vk::MemoryPropertyFlags memory_property_flags={});
-        // If `allocator` is nullptr (default) the original allocator will be used
-        // Ideally shouldn't be called very often.
-        // Resizing where `new_size == old_size` will still recreate the buffer (to use the new allocator if provided).
-        bool resize(vk::DeviceSize new_size, const vk_util::UploadContext& ctx, vma::Allocator* allocator=nullptr);
+        bool allocate(vma::Allocator* allocator, vk::DeviceSize allocation_size, const vk::BufferUsageFlags& usage, const vma::MemoryUsage& memory_usage, vk::MemoryPropertyFlags memory_property_flags={}, const std::vector<uint32_t>& queue_families={});
+        // Ideally shouldn't be called very often. Neither overload blocks.
+        // The old buffer is handed to `retirement_queue` so frames that are still reading it can finish.
+        // If the buffer is host visible the contents are copied on the host. Otherwise the copy is recorded into
+        // `cmd`, which must be submitted before the new buffer is used.
+        bool resize(vk::DeviceSize new_size, RetirementQueue* retirement_queue, vk::CommandBuffer cmd=nullptr);
+        // Same as above but the copy is batched by `upload_scheduler`; the old buffer is also kept until the copy has finished
+        bool resize(vk::DeviceSize new_size, UploadScheduler* upload_scheduler, RetirementQueue* retirement_queue);
 
         void destroy(); // Only works if the object was allocated/uploaded with a member function
 
+        // Lets `defragmentation_service` move the buffer (also after resizes)
+        // Only for buffers that are not persistently mapped; the buffer handle may change between frames
+        void enable_defragmentation(DefragmentationService* defragmentation_service);
+
+        // Call before `allocate`; replacement buffers are accounted to `owner` too
+        void set_owner(MemoryOwner owner) { this->owner = owner; }
+
         vk::Buffer get_buffer() {return buffer.buffer;};
         vma::Allocation get_allocation() {return buffer.allocation;};
         vk::DeviceSize get_size() {return buffer_size;}
+        bool is_host_visible();
 
     private:
+        bool create_replacement(vk::DeviceSize new_size, AllocatedBuffer& new_buffer);
+        void retire(RetirementQueue* retirement_queue, AllocatedBuffer& new_buffer, vk::DeviceSize new_size, UploadScheduler* upload_scheduler=nullptr, UploadScheduler::Ticket ticket=0);
+
         AllocatedBuffer buffer;
         vk::DeviceSize buffer_size;
 
         vk::BufferUsageFlags usage_flags;
         vma::MemoryUsage memory_usage_flags;
         vk::MemoryPropertyFlags memory_property_flags;
+        std::vector<uint32_t> queue_families;
         vma::Allocator* allocator = nullptr;
+        MemoryOwner owner = MemoryOwner::Other;
+        DefragmentationService* defragmentation_service = nullptr;
     };
 
 }
@@ -5,28 +5,34 @@
 
 namespace aq {
 
+    // Descriptor set indices in the pipeline layout, ordered by how often the sets change
+    // Binding a set only disturbs the sets after it so the rarely changing sets come first
+    // Per draw data (model matrix, material index) is passed with push constants
+    enum class DescriptorSetIndices {
+        Global = 0, // Never written after creation
+        LongLived = 1, // Written when resources are added; shared by every frame
+        PerFrame = 2, // One per frame in flight
+        PerPass = 3 // One per frame in flight for every pass/view
+    };
+
+    enum class GlobalBindings {
+        DefaultSampler = 0 // Immutable sampler
+    };
+
+    // `Textures` has a variable descriptor count so it must be the last binding
+    enum class LongLivedBindings {
+        Textures = 0
+    };
+
     // Buffer bindings for the per-frame `vk::DescriptorSet`s
     enum class PerFrameBufferBindings {
         MaterialPropertiesBuffer = 0,
-        DefaultSampler = 1,
-        Textures = 2,
-        LightPropertiesBuffer = 3
+        LightPropertiesBuffer = 1
     };
 
-    /*
-    Ideal Buffer Bindings:
-    enum class PerFrameBufferBindings {
-        CameraBuffer = 0,
-        MaterialPropertiesBuffer = 1,
-        LightPropertiesBuffer = 2,
-        LightShadowMaps = 3, ???
-        LightShadowCubeMaps = 4 ???
-    };
-    enum class LongLivedBufferBindings {
-        Sampler = 1,
-        Textures = 2 ??? (might be the same as PerFrameBufferBindings::LightShadowMaps)
+    enum class PerPassBindings {
+        CameraBuffer = 0
     };
-    */
 
     vk::ShaderModule load_shader_module(const char* file_path, vk::Device device);
     vk::UniqueShaderModule load_shader_module_unique(const char* file_path, vk::Device device);
@@ -5,6 +5,7 @@
 #include <deque>
 #include <unordered_map>
 #include <functional>
+#include <vector>
 
 #define VULKAN_HPP_NO_EXCEPTIONS
 #define VULKAN_HPP_ASSERT_ON_RESULT
@@ -37,6 +38,22 @@ namespace aq {
         };
     }
 
+    class UploadScheduler;
+    class DefragmentationService;
+
+    // What an allocation is used for; see `MemoryBudget`
+    enum class MemoryOwner : uint32_t {
+        Other,
+        Mesh,
+        Texture,
+        MaterialTable,
+        LightTable,
+        Staging,
+        Swapchain,
+        Transient, // Per frame data (see `FrameAllocator`)
+        Count
+    };
+
     class DeletionQueue {
     public:
         void push_function(std::function<void()>&& function);
@@ -47,11 +64,30 @@ namespace aq {
         std::deque<std::function<void()>> deletors;
     };
 
+    // Delays the destruction of resources until every frame that might still be using them has finished rendering
+    class RetirementQueue {
+    public:
+        RetirementQueue(uint64_t frame_overlap=1);
+
+        // Call once per frame after waiting on the frame's fence
+        // Calls every function that was retired at least `frame_overlap` frames ago
+        void next_frame(uint64_t frame_number);
+        void retire(std::function<void()>&& function);
+        // Only call when the device is idle
+        void flush();
+
+    private:
+        uint64_t frame_overlap;
+        uint64_t frame_number = 0;
+        std::deque<std::pair<uint64_t, std::function<void()>>> deletors; // Sorted by the frame they were retired in
+    };
+
     class AllocatedBuffer {
     public:
         AllocatedBuffer();
 
-        bool allocate(vma::Allocator* allocator, vk::DeviceSize allocation_size, vk::BufferUsageFlags usage, vma::MemoryUsage memory_usage, vk::MemoryPropertyFlags memory_property_flags={});
+        // If `queue_families` has more than one queue family, the buffer will be created with `vk::SharingMode::eConcurrent`
+        bool allocate(vma::Allocator* allocator, vk::DeviceSize allocation_size, vk::BufferUsageFlags usage, vma::MemoryUsage memory_usage, vk::MemoryPropertyFlags memory_property_flags={}, const std::vector<uint32_t>& queue_families={});
         // Buffer memory must be CPU writeable
         bool upload(void* data, vma::Allocator* allocator, vk::DeviceSize allocation_size, vk::BufferUsageFlags usage, vma::MemoryUsage memory_usage, vk::MemoryPropertyFlags memory_property_flags={});
         void destroy(); // Only works if the object was allocated/uploaded with a member function
@@ -61,24 +97,49 @@ namespace aq {
 
         vk::Buffer buffer;
         vma::Allocation allocation;
+        MemoryOwner owner = MemoryOwner::Other; // Set before allocating
     
     private:
+        friend class DefragmentationService;
+
         vma::Allocator* allocator = nullptr;
+        vk::DeviceSize tracked_size = 0; // Bytes accounted to `owner`
+        DefragmentationService* defragmentation_service = nullptr; // Set if the buffer can be moved by defragmentation
     };
 
     struct AllocatedImage {
         AllocatedImage();
 
-        bool upload(void* data, int width, int height, vma::Allocator* allocator, const vk_util::UploadContext& upload_context);
+        // The upload is only scheduled; `upload_ticket` can be used to check if it has finished
+        bool upload(void* data, int width, int height, UploadScheduler* upload_scheduler); // RGBA8 texels
+        // Uploads a mip chain of `format` (which can be block compressed)
+        // `level_offsets` are where each mip level's tightly packed texels (or blocks) start in `data`
+        bool upload(
+            const void* data, vk::DeviceSize size,
+            vk::Format format, vk::Extent2D extent,
+            const std::vector<vk::DeviceSize>& level_offsets,
+            UploadScheduler* upload_scheduler
+        );
         void destroy(); // Only works if the object was allocated/uploaded with a member function
 
         void set(const std::pair<vk::Image, vma::Allocation>& rhs);
 
         vk::Image image;
         vma::Allocation allocation;
+        uint64_t upload_ticket = 0; // See `UploadScheduler::Ticket`
+
+        vk::Format format = vk::Format::eUndefined;
+        vk::Extent3D extent;
+        uint32_t mip_levels = 1;
+        vk::ImageUsageFlags usage;
+        MemoryOwner owner = MemoryOwner::Other; // Set before uploading
 
     private:
+        friend class DefragmentationService;
+
         vma::Allocator* allocator = nullptr;
+        vk::DeviceSize tracked_size = 0; // Bytes accounted to `owner`
+        DefragmentationService* defragmentation_service = nullptr; // Set if the image can be moved by defragmentation
     };
 
     using ManagedMemoryIndex = size_t;
@@ -0,0 +1,114 @@
+#ifndef UTIL_AQUILA_UPLOAD_SCHEDULER_HPP
+#define UTIL_AQUILA_UPLOAD_SCHEDULER_HPP
+
+#include <vector>
+#include <deque>
+#include <optional>
+#include <functional>
+
+#include "util/vk_types.hpp"
+
+namespace aq {
+
+    // Batches buffer and image uploads into as few queue submissions as possible
+    // Data is copied into a persistently mapped staging ring buffer and the copies are recorded
+    // into a command buffer that is only submitted on `flush` (usually once per frame).
+    // Every submission signals a timeline semaphore so completion can be checked with the
+    // returned `Ticket` instead of blocking on a fence.
+    // Not thread safe.
+    class UploadScheduler {
+    public:
+        // The value the timeline semaphore will have reached once the upload is finished
+        using Ticket = uint64_t;
+
+        UploadScheduler();
+
+        bool init(
+            vk::Device device,
+            vma::Allocator* allocator,
+            vk::Queue queue,
+            uint32_t queue_family,
+            uint32_t graphics_queue_family, // Queue family that will read the uploaded resources
+            vk::DeviceSize staging_capacity // Size of the staging ring buffer in bytes
+        );
+        // Waits for all uploads to finish
+        void destroy();
+
+        // Copies `size` bytes of `data` into `dst` at `dst_offset`
+        // `data` only needs to be valid until this function returns
+        Ticket upload_buffer(vk::Buffer dst, vk::DeviceSize dst_offset, const void* data, vk::DeviceSize size);
+        // Copies tightly packed texels into mip level 0 of `dst` and transitions it to `eShaderReadOnlyOptimal`
+        // `dst` should be in `eUndefined` layout
+        Ticket upload_image(vk::Image dst, vk::Extent3D extent, const void* data, vk::DeviceSize size);
+        // Copies `size` bytes of `data` into the first `mip_levels` levels of `dst` with `copies`
+        // (buffer offsets are relative to `data`) and transitions them to `eShaderReadOnlyOptimal`
+        Ticket upload_image(vk::Image dst, uint32_t mip_levels, const void* data, vk::DeviceSize size, std::vector<vk::BufferImageCopy> copies);
+        // Records arbitrary transfer commands into the current batch (eg. buffer to buffer copies)
+        // Previous transfer writes in the batch are made visible to the recorded commands
+        Ticket record(std::function<void(vk::CommandBuffer)>&& function);
+
+        // Destroys `buffer` once `ticket` has completed
+        void destroy_after(AllocatedBuffer buffer, Ticket ticket);
+
+        // Submits the current batch (if anything was recorded) and frees the staging memory of finished batches
+        // Returns the ticket of the last submitted batch (0 if nothing has ever been submitted)
+        Ticket flush();
+
+        bool is_complete(Ticket ticket);
+        // Flushes first if `ticket` has not been submitted yet
+        bool wait(Ticket ticket, uint64_t timeout=UINT64_MAX);
+
+        // The graphics queue should wait on this semaphore (with `get_last_submitted()`) before reading uploaded resources
+        vk::Semaphore get_timeline_semaphore() { return timeline_semaphore; }
+        Ticket get_last_submitted() { return current.ticket - 1; }
+
+        // Resources written by the scheduler and read by the graphics queue must be shared between these
+        // queue families (with `vk::SharingMode::eConcurrent` when there is more than one)
+        const std::vector<uint32_t>& get_queue_families() { return queue_families; }
+
+        vma::Allocator* get_allocator() { return allocator; }
+        vk::Device get_device() { return device; }
+
+    private:
+        struct Batch {
+            Ticket ticket = 0;
+            vk::CommandPool command_pool;
+            vk::CommandBuffer command_buffer;
+            bool recording = false;
+            bool uses_staging = false;
+            vk::DeviceSize staging_end = 0; // Staging memory before this offset is released once the batch finishes
+        };
+
+        vk::CommandBuffer get_command_buffer(); // Begins the current batch if needed
+        void submit_current();
+        void collect(); // Releases resources of finished batches
+
+        // Returns an offset into the staging buffer or nothing if `size` is bigger than the staging buffer
+        // May submit the current batch and wait for old batches to make room
+        std::optional<vk::DeviceSize> allocate_staging(vk::DeviceSize size);
+        // Staging memory for uploads that don't fit in the ring buffer
+        std::pair<vk::Buffer, vk::DeviceSize> get_staging(const void* data, vk::DeviceSize size);
+
+        vk::Device device;
+        vma::Allocator* allocator = nullptr;
+        vk::Queue queue;
+        uint32_t queue_family;
+        std::vector<uint32_t> queue_families;
+
+        vk::Semaphore timeline_semaphore;
+
+        Batch current;
+        std::deque<Batch> in_flight;
+        std::vector<vk::CommandPool> free_command_pools;
+        std::deque<std::pair<Ticket, AllocatedBuffer>> retired_buffers;
+
+        AllocatedBuffer staging_buffer;
+        std::byte* staging_memory = nullptr;
+        vk::DeviceSize staging_capacity = 0;
+        vk::DeviceSize staging_head = 0; // Where the next staging allocation will go
+        vk::DeviceSize staging_tail = 0; // Start of the oldest staging memory still in use
+    };
+
+}
+
+#endif
@@ -1,5 +1,6 @@
 #version 450
 #extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout (location = 0) out vec4 o_color;
 
@@ -7,9 +8,7 @@ layout (location = 0) in vec4 v_position;
 layout (location = 1) in vec4 v_normal;
 layout (location = 2) in vec2 v_tex_coord;
 
-layout (constant_id = 0) const int MAX_NR_TEXTURES = 100;
-
-layout(set=0, binding=0) uniform CameraBuffer {
+layout(set=3, binding=0) uniform CameraBuffer {
 	mat4 view_projection;
 	vec4 position;
 } camera;
@@ -33,12 +32,13 @@ struct MaterialProperties{
 	int idata1;
 };
 
-layout (std140, set=1, binding=0) readonly buffer MaterialPropertiesBuffer {
+layout (std140, set=2, binding=0) readonly buffer MaterialPropertiesBuffer {
 	MaterialProperties material_properties[];
 } material_properties_buffer;
 
-layout (set=1, binding=1) uniform sampler samp;
-layout (set=1, binding=2) uniform texture2D tex[MAX_NR_TEXTURES];
+layout (set=0, binding=0) uniform sampler samp;
+// Bindless texture table; texture indices are uniform per draw (from the material push constant)
+layout (set=1, binding=0) uniform texture2D tex[];
 
 struct LightProperties{
 	vec4 color;
@@ -49,7 +49,7 @@ struct LightProperties{
 	vec4 misc;
 };
 
-layout (std140, set=1, binding=3) readonly buffer LightPropertiesBuffer {
+layout (std140, set=2, binding=1) readonly buffer LightPropertiesBuffer {
 	LightProperties light_properties[];
 } light_properties_buffer;
 
@@ -8,7 +8,7 @@ layout (location = 0) out vec4 v_position;
 layout (location = 1) out vec4 v_normal;
 layout (location = 2) out vec2 v_tex_coord;
 
-layout(set=0, binding=0) uniform CameraBuffer {
+layout(set=3, binding=0) uniform CameraBuffer {
 	mat4 view_projection;
 	vec4 position;
 } camera;
@@ -0,0 +1,28 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "vertex_decoding.glsl"
+
+layout (location = 0) in vec3 a_position;
+layout (location = 1) in vec2 a_normal; // Octahedral encoded
+layout (location = 2) in vec2 a_tex_coord;
+
+layout (location = 0) out vec4 v_position;
+layout (location = 1) out vec4 v_normal;
+layout (location = 2) out vec2 v_tex_coord;
+
+layout(set=3, binding=0) uniform CameraBuffer {
+	mat4 view_projection;
+	vec4 position;
+} camera;
+
+layout (push_constant) uniform FragConstants {
+	mat4 model;
+} push_constants;
+
+void main() {
+	v_position = push_constants.model * vec4(a_position, 1.0f);
+	v_normal = vec4(transpose(inverse(mat3(push_constants.model))) * decode_octahedral(a_normal), 1.0f);
+	v_tex_coord = a_tex_coord;
+    gl_Position = camera.view_projection * v_position;
+}
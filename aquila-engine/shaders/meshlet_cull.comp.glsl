@@ -0,0 +1,114 @@
+#version 450
+
+// Culls meshlets against the view frustum and their normal cone (see `MeshletCuller`)
+// One workgroup per meshlet (x) and draw (y); the visible meshlets' indices are appended to the draw's
+// range of `output_indices` and counted in its indirect command
+
+layout (local_size_x = 64) in;
+
+struct Meshlet {
+	vec4 sphere; // xyz: center, w: radius
+	vec4 cone; // xyz: axis, w: cutoff
+	uint first_index;
+	uint index_count;
+	uint padding0;
+	uint padding1;
+};
+
+struct MeshletDraw {
+	mat4 model;
+	uint first_meshlet;
+	uint meshlet_count;
+	uint output_first_index;
+	uint index_size;
+	float scale;
+	uint cone_culling;
+	uint padding0;
+	uint padding1;
+};
+
+struct DrawIndexedIndirectCommand {
+	uint index_count;
+	uint instance_count;
+	uint first_index;
+	int vertex_offset;
+	uint first_instance;
+};
+
+layout(set=0, binding=0) readonly buffer MeshletBuffer {
+	Meshlet meshlets[];
+};
+
+// The geometry arena's index buffer; 16 bit indices are packed two per element
+layout(set=0, binding=1) readonly buffer IndexBuffer {
+	uint indices[];
+};
+
+layout(set=0, binding=2) readonly buffer DrawBuffer {
+	MeshletDraw draws[];
+};
+
+layout(set=0, binding=3) buffer CommandBuffer {
+	DrawIndexedIndirectCommand commands[];
+};
+
+layout(set=0, binding=4) writeonly buffer OutputIndexBuffer {
+	uint output_indices[];
+};
+
+layout (push_constant) uniform CullConstants {
+	vec4 frustum_planes[6];
+	vec4 camera_position;
+} cull_constants;
+
+shared bool visible;
+shared uint output_offset;
+
+bool is_visible(Meshlet meshlet, MeshletDraw draw) {
+	vec3 center = (draw.model * vec4(meshlet.sphere.xyz, 1.0f)).xyz;
+	float radius = meshlet.sphere.w * draw.scale;
+
+	for (int i=0; i<6; ++i) {
+		if (dot(cull_constants.frustum_planes[i].xyz, center) + cull_constants.frustum_planes[i].w < -radius)
+			return false;
+	}
+
+	// Every triangle faces away from the camera
+	if (draw.cone_culling != 0u && meshlet.cone.w < 1.0f) {
+		vec3 axis = normalize(transpose(inverse(mat3(draw.model))) * meshlet.cone.xyz);
+		vec3 to_center = center - cull_constants.camera_position.xyz;
+		if (dot(to_center, axis) >= meshlet.cone.w * length(to_center) + radius)
+			return false;
+	}
+
+	return true;
+}
+
+void main() {
+	uint draw_index = gl_WorkGroupID.y;
+	uint meshlet_index = gl_WorkGroupID.x;
+
+	MeshletDraw draw = draws[draw_index];
+	if (meshlet_index >= draw.meshlet_count) return; // Uniform for the whole workgroup
+	Meshlet meshlet = meshlets[draw.first_meshlet + meshlet_index];
+
+	if (gl_LocalInvocationIndex == 0) {
+		visible = is_visible(meshlet, draw);
+		if (visible)
+			output_offset = atomicAdd(commands[draw_index].index_count, meshlet.index_count);
+	}
+	barrier();
+
+	if (!visible) return;
+
+	uint output_first_index = draw.output_first_index + output_offset;
+	for (uint i=gl_LocalInvocationIndex; i<meshlet.index_count; i+=gl_WorkGroupSize.x) {
+		uint source_index = meshlet.first_index + i;
+		uint index;
+		if (draw.index_size == 2u)
+			index = (indices[source_index >> 1] >> ((source_index & 1u) * 16u)) & 0xFFFFu;
+		else
+			index = indices[source_index];
+		output_indices[output_first_index + i] = index;
+	}
+}
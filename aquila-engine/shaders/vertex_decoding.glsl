@@ -0,0 +1,10 @@
+// Decoding of the compact vertex attributes (see `aq_vertex.hpp`)
+
+// Inverse of `encode_octahedral`; `e` is the snorm attribute already converted to [-1, 1]
+vec3 decode_octahedral(vec2 e) {
+	vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return normalize(n);
+}
@@ -13,11 +13,14 @@
 
 namespace aq {
 
-    AquilaEngine::AquilaEngine() : render_engine(100), root_node(std::make_shared<Node>("Aquila Root")) {
+    AquilaEngine::AquilaEngine() :
+        render_engine(100), root_node(std::make_shared<Node>("Aquila Root")),
+        model_loader(render_engine.get_geometry_arena(), &render_engine.material_manager, render_engine.get_upload_scheduler())
+    {
         if (render_engine.init() != aq::RenderEngine::InitializationState::Initialized)
 		    std::cerr << "Failed to initialize render engine." << std::endl;
 
-        nhe = new NodeHierarchyEditor(&render_engine.material_manager, &render_engine.light_memory_manager, &render_engine);
+        nhe = new NodeHierarchyEditor(&render_engine.material_manager, &render_engine.light_memory_manager, &render_engine, &model_loader);
     }
 
     AquilaEngine::~AquilaEngine() {
@@ -25,6 +28,7 @@ namespace aq {
 
         render_engine.wait_idle();
 
+        model_loader.destroy();
         for (auto& node : root_node) {
             for (auto& mesh : node->get_child_meshes()) {
                 mesh->free();
@@ -35,6 +39,7 @@ namespace aq {
 
     void AquilaEngine::update() {
         render_engine.update();
+        model_loader.update();
 
         ImGui::Begin("Hierarchy", nullptr, {});
 
@@ -51,7 +56,7 @@ namespace aq {
         for (auto& node : root_node) {
             for (auto& mesh : node->get_child_meshes()) {
                 if (!mesh->is_uploaded()) // A Mesh might appear several times in a node tree so make sure it's only uploaded once
-                    mesh->upload(&render_engine.allocator, render_engine.get_default_upload_context());
+                    mesh->upload(render_engine.get_geometry_arena());
             }
         }
     }
@@ -62,6 +67,14 @@ namespace aq {
         }
     }
 
+    std::shared_future<std::shared_ptr<Node>> AquilaEngine::load_model_async(
+        const std::string& path,
+        const mesh_util::OptimizationOptions& optimization_options,
+        const std::optional<mesh_util::LodOptions>& lod_options
+    ) {
+        return model_loader.load(path, root_node, optimization_options, lod_options);
+    }
+
     bool AquilaEngine::process_sdl_event(const SDL_Event& sdl_event) {
         ImGui_ImplSDL2_ProcessEvent(&sdl_event);
 
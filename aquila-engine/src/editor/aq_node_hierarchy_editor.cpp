@@ -1,14 +1,18 @@
 #include "editor/aq_node_hierarchy_editor.hpp"
 
 #include <cfloat>
+#include <chrono>
+#include <future>
 #include <variant>
 
 #include <glm/gtc/type_ptr.hpp>
 
 #include <misc/cpp/imgui_stdlib.h>
 
-#include "init_engine.hpp"
+#include "render_engine.hpp"
+#include "scene/aq_async_model_loader.hpp"
 #include "scene/aq_model_loader.hpp"
+#include "scene/aq_cooked_model.hpp"
 #include "editor/aq_mesh_creator.hpp"
 #include "editor/file_browser.hpp"
 
@@ -35,6 +39,8 @@ namespace aq {
         int chosen_mesh_type = 0;
         int sphere_creation_res[2] = {32, 16};
         FileBrowser* file_browser = nullptr;
+        // Models being loaded by `AsyncModelLoader`, to report the ones that fail
+        std::vector<std::pair<std::string, std::shared_future<std::shared_ptr<Node>>>> loading_models;
 
         // Variables for Euler Angle Rotation Editor
         glm::quat original_rotation;
@@ -57,7 +63,7 @@ namespace aq {
         std::variant<std::shared_ptr<Node>, std::shared_ptr<Mesh>> data;
     };
 
-    NodeHierarchyEditor::NodeHierarchyEditor(MaterialManager* material_manager, LightMemoryManager* light_memory_manager, InitializationEngine* init_engine) : material_manager(material_manager), light_memory_manager(light_memory_manager), init_engine(init_engine) {
+    NodeHierarchyEditor::NodeHierarchyEditor(MaterialManager* material_manager, LightMemoryManager* light_memory_manager, RenderEngine* render_engine, AsyncModelLoader* model_loader) : material_manager(material_manager), light_memory_manager(light_memory_manager), render_engine(render_engine), model_loader(model_loader) {
         data = new NodeHierarchyEditorData();
     };
 
@@ -78,8 +84,8 @@ namespace aq {
         ImGui::Separator();
         if (ImGui::CollapsingHeader("Create New...")) {
             if (ImGui::Button("Create New Mesh")) {
-                if (init_engine) ImGui::OpenPopup("Mesh Creator");
-                else data->error_text = "NHE cannot create meshes with null `InitEngine`";
+                if (render_engine) ImGui::OpenPopup("Mesh Creator");
+                else data->error_text = "NHE cannot create meshes with null `RenderEngine`";
             }
             if (ImGui::BeginPopup("Mesh Creator")) {
                 ImGui::Combo("Type", &data->chosen_mesh_type, "Cube\0Sphere\0");
@@ -100,7 +106,7 @@ namespace aq {
                         default: data->error_text = "Mesh shape unimplemented"; break;
                     }
                     if (mesh) {
-                        mesh->upload(init_engine->get_allocator(), init_engine->get_default_upload_context());
+                        mesh->upload(render_engine->get_geometry_arena());
                         root_node->add_mesh(mesh);
                     }
                     ImGui::CloseCurrentPopup();
@@ -145,8 +151,21 @@ namespace aq {
             }
 
             if (ImGui::Button("Load Model") && !data->file_browser) {
-                if (init_engine) data->file_browser = new FileBrowser();
-                else data->error_text = "NHE cannot load models with null `InitEngine`";
+                if (render_engine || model_loader) data->file_browser = new FileBrowser();
+                else data->error_text = "NHE cannot load models with null `RenderEngine`";
+            }
+            for (size_t i=0; i<data->loading_models.size();) {
+                auto&[name, loading] = data->loading_models[i];
+                if (loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                    ++i;
+                    continue;
+                }
+                if (!loading.get()) data->error_text = "Failed to load model " + name;
+                data->loading_models.erase(data->loading_models.begin() + i);
+            }
+            if (!data->loading_models.empty()) {
+                ImGui::SameLine();
+                ImGui::TextDisabled("Loading %zu model(s)...", data->loading_models.size());
             }
             if (data->file_browser) {
                 switch (data->file_browser->get_status()) {
@@ -154,17 +173,41 @@ namespace aq {
                     data->file_browser->draw();
                     break;
                 case FileBrowser::Status::Confirmed: {
-                    ModelLoader loader(data->file_browser->current_directory(), data->file_browser->current_selection());
-                    // Upload Meshes
-                    for (auto& node : loader.get_root_node())
-                        for (auto& mesh : node->get_child_meshes())
-                            if (!mesh->is_uploaded()) // A Mesh might appear several times in a node tree so make sure it's only uploaded once
-                                mesh->upload(init_engine->get_allocator(), init_engine->get_default_upload_context());
-                    // Upload Materials
-                    for (auto& material : loader.get_materials())
-                        material_manager->add_material(material);
-                    // Add root model node to hierarchy
-                    root_node->add_node(loader.get_root_node());
+                    std::filesystem::path selection = data->file_browser->current_selection();
+                    // Loads in the background; the model shows up in the hierarchy once it's uploaded
+                    if (model_loader) {
+                        data->loading_models.push_back({
+                            selection.string(),
+                            model_loader->load(data->file_browser->current_directory() / selection, root_node)
+                        });
+                    } else {
+                        std::shared_ptr<Node> model_root_node;
+                        std::vector<std::shared_ptr<Material>> model_materials;
+                        if (selection.extension() == cooked_model::extension) {
+                            CookedModelLoader loader(data->file_browser->current_directory() / selection);
+                            model_root_node = loader.get_root_node();
+                            model_materials = loader.get_materials();
+                        } else {
+                            ModelLoader loader(data->file_browser->current_directory(), selection);
+                            model_root_node = loader.get_root_node();
+                            model_materials = loader.get_materials();
+                        }
+
+                        if (model_root_node) {
+                            // Upload Meshes
+                            for (auto& node : model_root_node)
+                                for (auto& mesh : node->get_child_meshes())
+                                    if (!mesh->is_uploaded()) // A Mesh might appear several times in a node tree so make sure it's only uploaded once
+                                        mesh->upload(render_engine->get_geometry_arena());
+                            // Upload Materials
+                            for (auto& material : model_materials)
+                                material_manager->add_material(material);
+                            // Add root model node to hierarchy
+                            root_node->add_node(model_root_node);
+                        } else {
+                            data->error_text = "Failed to load model " + selection.string();
+                        }
+                    }
 
                 } // Intentional fallthrough to `FileBrowser::Status::Canceled`
                 case FileBrowser::Status::Canceled:
@@ -6,6 +6,8 @@
 
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "scene/aq_texture_compressor.hpp"
+
 namespace aq {
 
     InitializationEngine::InitializationEngine() {}
@@ -88,6 +90,7 @@ namespace aq {
         }
 
         device_extensions[VK_KHR_SWAPCHAIN_EXTENSION_NAME] = true;
+        device_extensions[VK_EXT_MEMORY_BUDGET_EXTENSION_NAME] = false; // Optional; lets VMA report real heap budgets
 
         // Begin to actually initalize vulkan
 
@@ -107,19 +110,45 @@ namespace aq {
         vk::PhysicalDeviceFeatures requested_features;
         requested_features.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
         requested_features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+        // Cooked textures are BC compressed (see `texture_util::compress`); without support they're kept uncompressed
+        requested_features.textureCompressionBC = texture_util::query_block_compression_support(chosen_gpu);
         gpu_features = requested_features;
 
-        if (!vulkan_initializer.create_device(device_extensions, requested_features)) return false;
+        vk::PhysicalDeviceVulkan12Features requested_vulkan12_features;
+        requested_vulkan12_features.timelineSemaphore = VK_TRUE; // Used by `UploadScheduler`
+        // Used by the bindless texture table (see `MaterialManager`); `choose_gpu` only picks GPUs that support these
+        requested_vulkan12_features.descriptorIndexing = VK_TRUE;
+        requested_vulkan12_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        requested_vulkan12_features.runtimeDescriptorArray = VK_TRUE;
+        requested_vulkan12_features.descriptorBindingPartiallyBound = VK_TRUE;
+        requested_vulkan12_features.descriptorBindingVariableDescriptorCount = VK_TRUE;
+        requested_vulkan12_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        requested_vulkan12_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        gpu_vulkan12_features = requested_vulkan12_features;
+
+        if (!vulkan_initializer.create_device(device_extensions, requested_features, &requested_vulkan12_features)) return false;
         graphics_queue = device.getQueue(gpu_support.graphics_present_queue_family, 0);
+        transfer_queue = device.getQueue(gpu_support.transfer_queue_family, 0);
+
+        // `create_device` sets supported extensions to true
+        bool memory_budget_supported = device_extensions[VK_EXT_MEMORY_BUDGET_EXTENSION_NAME];
 
         vma::AllocatorCreateInfo allocator_create_info({}, chosen_gpu, device);
         allocator_create_info.instance = instance;
         allocator_create_info.vulkanApiVersion = VK_API_VERSION_1_2;
+        if (memory_budget_supported)
+            allocator_create_info.flags |= vma::AllocatorCreateFlagBits::eExtMemoryBudget;
         vk::Result ca_result;
         std::tie(ca_result, allocator) = vma::createAllocator(allocator_create_info);
         CHECK_VK_RESULT_R(ca_result, false, "Failed to create vma allocator");
         deletion_queue.push_function([this]() { allocator.destroy(); });
 
+        memory_budget.init(&allocator, memory_budget_supported);
+
+        // 64 MiB of staging memory; bigger uploads get their own staging buffer
+        if (!upload_scheduler.init(device, &allocator, transfer_queue, transfer_queue_family, graphics_queue_family, 64 << 20)) return false;
+        deletion_queue.push_function([this]() { upload_scheduler.destroy(); });
+
         vk::FenceCreateInfo upload_fence_create_info{};
         vk::Result cuf_result;
         std::tie(cuf_result, upload_fence) = device.createFence(upload_fence_create_info);
@@ -142,6 +171,7 @@ namespace aq {
             return;
         }
 
+        retirement_queue.flush();
         deletion_queue.flush();
 
         if (device) device.destroy();
@@ -404,7 +434,12 @@ namespace aq {
         auto [cdi_result, img_alloc] = allocator.createImage(depth_img_info, depth_img_alloc_info);
         depth_image.set(img_alloc);
         CHECK_VK_RESULT_R(cdi_result, false, "Failed to create depth image");
-        swap_chain_deletion_queue.push_function([this]() { allocator.destroyImage(depth_image.image, depth_image.allocation); });
+        vk::DeviceSize depth_image_size = allocator.getAllocationInfo(depth_image.allocation).size;
+        MemoryBudget::track(MemoryOwner::Swapchain, depth_image_size);
+        swap_chain_deletion_queue.push_function([this, depth_image_size]() {
+            allocator.destroyImage(depth_image.image, depth_image.allocation);
+            MemoryBudget::untrack(MemoryOwner::Swapchain, depth_image_size);
+        });
 
         vk::ImageViewCreateInfo depth_img_view_info = vk::ImageViewCreateInfo()
             .setImage(depth_image.image)
@@ -1,6 +1,7 @@
 #include "render_engine.hpp"
 
 #include <iostream>
+#include <algorithm>
 #include <fstream>
 
 #include <SDL2/SDL.h>
@@ -18,7 +19,7 @@
 
 namespace aq {
 
-    RenderEngine::RenderEngine(uint max_nr_textures) : max_nr_textures(max_nr_textures) {}
+    RenderEngine::RenderEngine(uint initial_nr_textures) : initial_nr_textures(initial_nr_textures) {}
 
     RenderEngine::~RenderEngine() {}
 
@@ -46,7 +47,6 @@ namespace aq {
         uint64_t timeout{ 1'000'000'000 };
         uint frame_index = frame_number % FRAME_OVERLAP;
         FrameObjects& fo = get_frame_objects(frame_number);
-        FrameData& fd = get_frame_data(frame_number);
 
         // Wait until the GPU has finished rendering the last frame
         CHECK_VK_RESULT( device.waitForFences(1, &fo.render_fence, VK_TRUE, timeout), "Failed to wait for render fence");
@@ -54,6 +54,15 @@ namespace aq {
 
         // Rendering is finished so the shared pointers can be let go
         meshes_in_render[frame_index].clear();
+        // Destroy resources that were replaced `FRAME_OVERLAP` frames ago
+        retirement_queue.next_frame(frame_number);
+        // Lets VMA refresh the heap budgets
+        allocator.setCurrentFrameIndex((uint32_t) frame_number);
+        // Free the per frame descriptor sets of the frame that just finished
+        descriptor_set_allocator.next_frame(frame_number);
+        // The transient data of the frame that just finished can be overwritten
+        frame_allocator.next_frame(frame_number);
+        meshlet_culler.next_frame(frame_number);
 
         // Get next swap chain image
         auto [ani_result, sw_ch_image_index] = device.acquireNextImageKHR(swap_chain, timeout, fo.present_semaphore, {});
@@ -72,6 +81,12 @@ namespace aq {
         vk::CommandBufferBeginInfo cmd_begin_info(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
         CHECK_VK_RESULT(fo.main_command_buffer.begin(cmd_begin_info), "Failed to begin cmd buffer");
 
+        // Move a bounded number of resources to compact device memory; finishes passes started `FRAME_OVERLAP` frames ago
+        defragmentation_service.update(frame_number, fo.main_command_buffer);
+
+        // Compute work has to be recorded outside of the render pass
+        cull_meshlets(camera, flattened_hierarchy);
+
         // Set the dynamic state
         fo.main_command_buffer.setViewport(0, {{0.0f, 0.0f, float(window_extent.width), float(window_extent.height), 0.0f, 1.0f}});
         fo.main_command_buffer.setScissor(0, {{{0, 0}, window_extent}});
@@ -102,9 +117,20 @@ namespace aq {
         // End command buffer
         CHECK_VK_RESULT(fo.main_command_buffer.end(), "Failed to end command buffer");
 
-        vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+        // Submit the uploads scheduled since the last frame; rendering waits on them (and nothing else) on the GPU
+        UploadScheduler::Ticket upload_ticket = upload_scheduler.flush();
+
+        std::array<vk::Semaphore, 2> wait_semaphores{fo.present_semaphore, upload_scheduler.get_timeline_semaphore()};
+        std::array<vk::PipelineStageFlags, 2> wait_stages{
+            vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eTransfer
+        };
+        std::array<uint64_t, 2> wait_values{0, upload_ticket}; // The binary semaphore's value is ignored
+        uint32_t wait_count = upload_ticket > 0 ? 2 : 1;
 
-        vk::SubmitInfo submit_info(1, &fo.present_semaphore, &wait_stage, 1, &fo.main_command_buffer, 1, &fo.render_semaphore);
+        vk::TimelineSemaphoreSubmitInfo timeline_submit_info(wait_count, wait_values.data(), 0, nullptr);
+        vk::SubmitInfo submit_info(wait_count, wait_semaphores.data(), wait_stages.data(), 1, &fo.main_command_buffer, 1, &fo.render_semaphore);
+        submit_info.pNext = &timeline_submit_info;
         CHECK_VK_RESULT(graphics_queue.submit(1, &submit_info, fo.render_fence), "Failed to submit graphics_queue");
 
         vk::PresentInfoKHR present_info(1, &fo.render_semaphore, 1, &swap_chain, &sw_ch_image_index);
@@ -120,10 +146,29 @@ namespace aq {
     }
 
     bool RenderEngine::init_render_resources() {
-        descriptor_set_allocator.init(device);
+        // 32 MiB of vertices, 8 MiB of indices and 1 MiB of meshlets to start; the arena grows as needed
+        if (!geometry_arena.init(&allocator, 32 << 20, 8 << 20, 1 << 20, &upload_scheduler, &retirement_queue)) return false;
+        deletion_queue.push_function([this]() { geometry_arena.destroy(); });
+
+        // Up to 16 MiB or 64 resources are moved per pass; a run is started every 1024 frames
+        defragmentation_service.init(&allocator, device, &upload_scheduler, FRAME_OVERLAP, 16 << 20, 64, 1024);
+        geometry_arena.enable_defragmentation(&defragmentation_service);
+
+        descriptor_set_allocator.init(device, FRAME_OVERLAP);
         DescriptorSetBuilder per_frame_descriptor_set_builder(&descriptor_set_allocator, device, FRAME_OVERLAP);
-        material_manager.init(FRAME_OVERLAP, max_nr_textures, 50, per_frame_descriptor_set_builder, &allocator, get_default_upload_context());
-        light_memory_manager.init(FRAME_OVERLAP, 25, per_frame_descriptor_set_builder, &allocator, get_default_upload_context());
+        auto descriptor_indexing_properties = chosen_gpu.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceDescriptorIndexingProperties>()
+            .get<vk::PhysicalDeviceDescriptorIndexingProperties>();
+        uint32_t max_nr_textures = std::min({
+            descriptor_indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages,
+            descriptor_indexing_properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+            65536u
+        });
+
+        material_manager.init(FRAME_OVERLAP, initial_nr_textures, max_nr_textures, 50, per_frame_descriptor_set_builder, &allocator, get_default_upload_context(), &upload_scheduler, &retirement_queue, trilinear_filtering);
+        material_manager.set_defragmentation_service(&defragmentation_service);
+        material_manager.set_memory_budget(&memory_budget);
+        material_manager.set_texture_streaming(texture_streaming);
+        light_memory_manager.init(FRAME_OVERLAP, 25, per_frame_descriptor_set_builder, &allocator, get_default_upload_context(), &retirement_queue);
         
         per_frame_descriptor_sets = per_frame_descriptor_set_builder.build();
         per_frame_descriptor_set_layout = per_frame_descriptor_set_builder.get_layout();
@@ -146,6 +191,7 @@ namespace aq {
 
     void RenderEngine::cleanup_render_resources() {
         meshes_in_render.fill({}); // All frames have finished rendering
+        defragmentation_service.destroy(); // Finish any pass while the moved resources still exist
         light_memory_manager.destroy();
         material_manager.destroy();
         deletion_queue.flush();
@@ -154,14 +200,6 @@ namespace aq {
     bool RenderEngine::init_pipelines() {
         std::string proj_path(AQUILA_ENGINE_PATH);
 
-        vk::UniqueShaderModule triangle_vert_shader = load_shader_module_unique(
-            (proj_path + "/shaders/color.vert.spv").c_str(), device
-        );
-        if (!triangle_vert_shader) {
-            std::cerr << "Failed to load triangle_vert_shader; Aborting." << std::endl;
-            return false;
-        }
-
         vk::UniqueShaderModule triangle_frag_shader = load_shader_module_unique(
             (proj_path + "/shaders/color.frag.spv").c_str(), device
         );
@@ -170,20 +208,12 @@ namespace aq {
             return false;
         }
 
-        std::array<vk::SpecializationMapEntry, 1> triangle_frag_specialization_map{{
-            {0, 0, sizeof(int32_t)}
-        }};
-
-        vk::SpecializationInfo triangle_frag_specialization = vk::SpecializationInfo()
-            .setMapEntries(triangle_frag_specialization_map)
-            .setDataSize(sizeof(max_nr_textures))
-            .setPData(&max_nr_textures);
+        std::array<vk::DescriptorSetLayout, 4> set_layouts = {{global_set_layout, material_manager.get_texture_table_layout(), per_frame_descriptor_set_layout, per_pass_set_layout}};
 
-        std::array<vk::DescriptorSetLayout, 2> set_layouts = {{global_set_layout, per_frame_descriptor_set_layout}};
-
-        std::array<vk::PushConstantRange, 2> push_constant_ranges = {
+        std::array<vk::PushConstantRange, 3> push_constant_ranges = {
             vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4)),
-            vk::PushConstantRange(vk::ShaderStageFlagBits::eFragment, offsetof(PushConstants, material_index), 2*sizeof(uint))
+            vk::PushConstantRange(vk::ShaderStageFlagBits::eFragment, offsetof(PushConstants, material_index), 2*sizeof(uint)),
+            vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, offsetof(PushConstants, position_offset), 2*sizeof(glm::vec4))
         };
         
         vk::PipelineLayoutCreateInfo pipeline_layout_create_info({}, set_layouts, push_constant_ranges);
@@ -195,12 +225,7 @@ namespace aq {
 
         std::array<vk::DynamicState, 2> dynamic_states({vk::DynamicState::eViewport, vk::DynamicState::eScissor});
 
-        Vertex::InputDescription vertex_input_description = Vertex::get_vertex_description();
-
         PipelineBuilder pipeline_builder = PipelineBuilder()
-            .add_shader_stage({{}, vk::ShaderStageFlagBits::eVertex, *triangle_vert_shader, "main"})
-            .add_shader_stage({{}, vk::ShaderStageFlagBits::eFragment, *triangle_frag_shader, "main", &triangle_frag_specialization})
-            .set_vertex_input({{}, vertex_input_description.bindings, vertex_input_description.attributes})
             .set_input_assembly({{}, vk::PrimitiveTopology::eTriangleList, VK_FALSE})
             .set_viewport_count(1)
             .set_scissor_count(1)
@@ -223,12 +248,38 @@ namespace aq {
             .set_dynamic_state({{}, dynamic_states})
             .set_pipeline_layout(triangle_pipeline_layout);
 
-        triangle_pipeline = pipeline_builder.build_pipeline(device, render_pass);
-        
-        if (!triangle_pipeline)
-            return false;
+        // One pipeline per vertex format; only the vertex shader and vertex input differ
+        for (uint32_t i=0; i<(uint32_t) VertexFormat::Count; ++i) {
+            VertexFormat vertex_format = (VertexFormat) i;
+
+            vk::UniqueShaderModule triangle_vert_shader = load_shader_module_unique(
+                (proj_path + "/shaders/" + get_vertex_shader(vertex_format)).c_str(), device
+            );
+            if (!triangle_vert_shader) {
+                std::cerr << "Failed to load triangle_vert_shader (" << get_vertex_shader(vertex_format) << "); Aborting." << std::endl;
+                return false;
+            }
+
+            Vertex::InputDescription vertex_input_description = get_vertex_description(vertex_format);
 
-        deletion_queue.push_function([this]() { device.destroyPipeline(triangle_pipeline); });
+            pipeline_builder
+                .set_shader_stages({
+                    {{}, vk::ShaderStageFlagBits::eVertex, *triangle_vert_shader, "main"},
+                    {{}, vk::ShaderStageFlagBits::eFragment, *triangle_frag_shader, "main"}
+                })
+                .set_vertex_input({{}, vertex_input_description.bindings, vertex_input_description.attributes});
+
+            triangle_pipelines[i] = pipeline_builder.build_pipeline(device, render_pass);
+
+            if (!triangle_pipelines[i])
+                return false;
+
+            deletion_queue.push_function([this, i]() { device.destroyPipeline(triangle_pipelines[i]); });
+        }
+
+        if (!meshlet_culler.init(device, &allocator, FRAME_OVERLAP, (proj_path + "/shaders/meshlet_cull.comp.spv").c_str(), &descriptor_set_allocator, &frame_allocator))
+            return false;
+        deletion_queue.push_function([this]() { meshlet_culler.destroy(); });
         
         return true;
     }
@@ -239,73 +290,59 @@ namespace aq {
     }
 
     bool RenderEngine::init_data() {
-        // Camera Buffer
+        // Transient per frame data (camera, per pass constants, ...)
 
-        size_t camera_data_gpu_size = vk_util::pad_uniform_buffer_size(sizeof(GPUCameraData), gpu_properties.limits.minUniformBufferOffsetAlignment);
-        if (!camera_buffer.allocate(&allocator, camera_data_gpu_size * FRAME_OVERLAP, vk::BufferUsageFlagBits::eUniformBuffer, vma::MemoryUsage::eCpuToGpu, vk::MemoryPropertyFlagBits::eHostCoherent)) return false;
-        deletion_queue.push_function([this]() { camera_buffer.destroy(); });
-
-        auto[mm_result, buff_mem] = allocator.mapMemory(camera_buffer.allocation);
-        CHECK_VK_RESULT_R(mm_result, false, "Failed to map camera buffer memory");
-        p_cam_buff_mem = (unsigned char*) buff_mem;
-        deletion_queue.push_function([this]() { allocator.unmapMemory(camera_buffer.allocation); });
+        if (!frame_allocator.init(&allocator, FRAME_OVERLAP, 256 << 10, gpu_properties.limits)) return false;
+        deletion_queue.push_function([this]() { frame_allocator.destroy(); });
 
         return true;
     }
 
     bool RenderEngine::init_descriptors() {
 
-        // Descriptor Pool
-
-        std::vector<vk::DescriptorPoolSize> descriptor_pool_sizes{{
-            {vk::DescriptorType::eUniformBuffer, 10},
-            {vk::DescriptorType::eSampler, 1},
-            {vk::DescriptorType::eSampledImage, 1},
-            {vk::DescriptorType::eCombinedImageSampler, 10}
-        }};
-        vk::DescriptorPoolCreateInfo desc_pool_create_info({}, 10, descriptor_pool_sizes);
-
-        vk::Result cdp_result;
-        std::tie(cdp_result, descriptor_pool) = device.createDescriptorPool(desc_pool_create_info);
-        CHECK_VK_RESULT_R(cdp_result, false, "Failed to create descriptor pool");
-        deletion_queue.push_function([this]() { device.destroyDescriptorPool(descriptor_pool); });
-
         // Descriptor Set Layouts
 
         // Global desc. set layout
-        std::array<vk::DescriptorSetLayoutBinding, 1> buffer_bindings{{
-            // Camera buffer binding
-            { 0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment }
+        vk::Sampler default_sampler = material_manager.get_default_sampler();
+        std::array<vk::DescriptorSetLayoutBinding, 1> global_bindings{{
+            { (uint32_t) GlobalBindings::DefaultSampler, vk::DescriptorType::eSampler, 1, vk::ShaderStageFlagBits::eFragment, &default_sampler }
         }};
-        vk::DescriptorSetLayoutCreateInfo desc_set_create_info({}, buffer_bindings);
+        vk::DescriptorSetLayoutCreateInfo global_set_create_info({}, global_bindings);
 
         vk::Result cds_result;
-        std::tie(cds_result, global_set_layout) = device.createDescriptorSetLayout(desc_set_create_info);
+        std::tie(cds_result, global_set_layout) = device.createDescriptorSetLayout(global_set_create_info);
         CHECK_VK_RESULT_R(cds_result, false, "Failed to create global set layout");
         deletion_queue.push_function([this]() { device.destroyDescriptorSetLayout(global_set_layout); });
 
-        // Descriptor Sets
+        // Per pass desc. set layout
+        std::array<vk::DescriptorSetLayoutBinding, 1> per_pass_bindings{{
+            { (uint32_t) PerPassBindings::CameraBuffer, vk::DescriptorType::eUniformBufferDynamic, 1, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment }
+        }};
+        vk::DescriptorSetLayoutCreateInfo per_pass_set_create_info({}, per_pass_bindings);
 
-        for (uint i=0; i<FRAME_OVERLAP; ++i) {
+        std::tie(cds_result, per_pass_set_layout) = device.createDescriptorSetLayout(per_pass_set_create_info);
+        CHECK_VK_RESULT_R(cds_result, false, "Failed to create per pass set layout");
+        deletion_queue.push_function([this]() { device.destroyDescriptorSetLayout(per_pass_set_layout); });
 
-            vk::DescriptorSetAllocateInfo desc_set_alloc_info(descriptor_pool, 1, &global_set_layout);
+        // Descriptor Sets
 
-            auto[ads_result, desc_sets] = device.allocateDescriptorSets(desc_set_alloc_info);
-            CHECK_VK_RESULT_R(ads_result, false, "Failed to allocate descriptor set");
-            frame_data[i].global_descriptor = desc_sets[0];
+        global_descriptor = descriptor_set_allocator.allocate(global_set_layout);
+        if (!global_descriptor) return false;
 
-            size_t camera_data_gpu_size = vk_util::pad_uniform_buffer_size(sizeof(GPUCameraData), gpu_properties.limits.minUniformBufferOffsetAlignment);
-            std::array<vk::DescriptorBufferInfo, 1> buffer_infos{{
-                {camera_buffer.buffer, camera_data_gpu_size * i, camera_data_gpu_size}
-            }};
-            vk::WriteDescriptorSet write_desc_set = vk::WriteDescriptorSet()
-                .setDstSet(frame_data[i].global_descriptor)
-                .setDstBinding(0)
-                .setDescriptorType(vk::DescriptorType::eUniformBuffer)
-                .setBufferInfo(buffer_infos);
+        // The camera data's location is given by a dynamic offset when binding
+        per_pass_descriptor = descriptor_set_allocator.allocate(per_pass_set_layout);
+        if (!per_pass_descriptor) return false;
 
-            device.updateDescriptorSets({write_desc_set}, {});
-        }
+        std::array<vk::DescriptorBufferInfo, 1> buffer_infos{{
+            frame_allocator.get_descriptor_info(sizeof(GPUCameraData))
+        }};
+        vk::WriteDescriptorSet write_desc_set = vk::WriteDescriptorSet()
+            .setDstSet(per_pass_descriptor)
+            .setDstBinding((uint32_t) PerPassBindings::CameraBuffer)
+            .setDescriptorType(vk::DescriptorType::eUniformBufferDynamic)
+            .setBufferInfo(buffer_infos);
+
+        device.updateDescriptorSets({write_desc_set}, {});
 
         return true;
     }
@@ -374,23 +411,47 @@ namespace aq {
     void RenderEngine::draw_objects(AbstractCamera* camera, const std::vector<std::pair<std::shared_ptr<Node>, glm::mat4>>& flattened_hierarchy) {
         uint frame_index = frame_number % FRAME_OVERLAP;
         FrameObjects& fo = get_frame_objects(frame_number);
-        FrameData& fd = get_frame_data(frame_number);
 
         // Update the managers now that the frame has finished rendering
         material_manager.update(frame_index);
         uint nr_lights = (uint) light_memory_manager.update(frame_index);
 
-        fo.main_command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, triangle_pipeline);
+        // The pipelines share a layout so switching between vertex formats keeps the bound sets and push constants
+        VertexFormat bound_vertex_format = VertexFormat::Compact;
+        fo.main_command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, triangle_pipelines[(size_t) bound_vertex_format]);
+
+        glm::vec3 camera_position = camera->get_position();
+        float projection_scale = camera->get_projection_matrix()[1][1] * float(window_extent.height) * 0.5f;
 
-        size_t camera_data_gpu_size = vk_util::pad_uniform_buffer_size(sizeof(GPUCameraData), gpu_properties.limits.minUniformBufferOffsetAlignment);
         GPUCameraData camera_data{
             camera->get_projection_matrix() * camera->get_view_matrix(),
             glm::vec4(camera->get_position(), 1.0f)
         };
-        memcpy(p_cam_buff_mem + camera_data_gpu_size*frame_index, &camera_data, sizeof(GPUCameraData));
-
-        fo.main_command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, triangle_pipeline_layout, 0, {fd.global_descriptor}, {});
-        fo.main_command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, triangle_pipeline_layout, 1, {per_frame_descriptor_sets[frame_index]}, {});
+        FrameAllocator::Allocation camera_allocation = frame_allocator.push(camera_data);
+        if (!camera_allocation.is_valid()) return;
+
+        // Bound in a single call since the sets are consecutive (see `DescriptorSetIndices`)
+        fo.main_command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, triangle_pipeline_layout, (uint32_t) DescriptorSetIndices::Global, {
+            global_descriptor,
+            material_manager.get_texture_table(),
+            per_frame_descriptor_sets[frame_index],
+            per_pass_descriptor
+        }, {camera_allocation.offset});
+
+        // Every mesh lives in the geometry arena so the buffers only need to be bound once
+        fo.main_command_buffer.bindVertexBuffers(0, {geometry_arena.get_vertex_buffer()}, {0});
+        // Meshes have either 16 or 32 bit indices; `first_index` is in units of the mesh's index type
+        // Meshes culled per meshlet are drawn from the culler's 32 bit index buffer instead
+        vk::Buffer bound_index_buffer = geometry_arena.get_index_buffer();
+        vk::IndexType bound_index_type = vk::IndexType::eUint16;
+        fo.main_command_buffer.bindIndexBuffer(bound_index_buffer, 0, bound_index_type);
+        auto bind_index_buffer = [&](vk::Buffer index_buffer, vk::IndexType index_type) {
+            if (index_buffer == bound_index_buffer && index_type == bound_index_type) return;
+            bound_index_buffer = index_buffer;
+            bound_index_type = index_type;
+            fo.main_command_buffer.bindIndexBuffer(bound_index_buffer, 0, bound_index_type);
+        };
+        size_t mesh_draw = 0; // Index into `meshlet_draw_indices`
 
         PushConstants constants;
         constants.nr_lights = nr_lights;
@@ -402,13 +463,32 @@ namespace aq {
                 fo.main_command_buffer.pushConstants(triangle_pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4), &constants);
 
                 for (auto& mesh : node->get_child_meshes()) {
+                    uint32_t meshlet_draw_index = meshlet_draw_indices[mesh_draw];
+                    uint32_t lod = draw_lods[mesh_draw++];
+                    if (!mesh->is_uploaded()) continue;
+
+                    if (mesh->vertex_format != bound_vertex_format) {
+                        bound_vertex_format = mesh->vertex_format;
+                        fo.main_command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, triangle_pipelines[(size_t) bound_vertex_format]);
+                    }
+                    if (mesh->vertex_format == VertexFormat::Quantized) {
+                        constants.position_offset = glm::vec4(mesh->bounds.min, 0.0f);
+                        constants.position_scale = glm::vec4(mesh->bounds.extent, 0.0f);
+                        fo.main_command_buffer.pushConstants(triangle_pipeline_layout, vk::ShaderStageFlagBits::eVertex, offsetof(PushConstants, position_offset), 2*sizeof(glm::vec4), &constants.position_offset);
+                    }
+
                     constants.material_index = material_manager.get_material_index(mesh->material);
+                    material_manager.request_texture_detail(mesh->material, mesh->get_screen_size(transformation_matrix, camera_position, projection_scale));
                     fo.main_command_buffer.pushConstants(triangle_pipeline_layout, vk::ShaderStageFlagBits::eFragment, offsetof(PushConstants, material_index), sizeof(uint), (std::byte*)&constants + offsetof(PushConstants, material_index));
 
-                    fo.main_command_buffer.bindVertexBuffers(0, {mesh->combined_iv_buffer.buffer}, {mesh->vertex_data_offset});
-                    fo.main_command_buffer.bindIndexBuffer(mesh->combined_iv_buffer.buffer, 0, index_vk_type);
-
-                    fo.main_command_buffer.drawIndexed(mesh->indices.size(), 1, 0, 0, 0);
+                    if (meshlet_draw_index != UINT32_MAX) {
+                        bind_index_buffer(meshlet_culler.get_index_buffer(), vk::IndexType::eUint32);
+                        meshlet_culler.draw(fo.main_command_buffer, meshlet_draw_index);
+                    } else {
+                        bind_index_buffer(geometry_arena.get_index_buffer(), mesh->index_type);
+                        const Mesh::LodRange& lod_range = mesh->lod_ranges[lod];
+                        fo.main_command_buffer.drawIndexed(lod_range.index_count, 1, lod_range.first_index, mesh->vertex_offset, 0);
+                    }
 
                     // Make sure mesh stays alive while this frame is being rendered
                     meshes_in_render[frame_index].push_back(mesh);
@@ -417,6 +497,38 @@ namespace aq {
         }
     }
 
+    void RenderEngine::cull_meshlets(AbstractCamera* camera, const std::vector<std::pair<std::shared_ptr<Node>, glm::mat4>>& flattened_hierarchy) {
+        FrameObjects& fo = get_frame_objects(frame_number);
+
+        glm::vec3 camera_position = camera->get_position();
+        float projection_scale = camera->get_projection_matrix()[1][1] * float(window_extent.height) * 0.5f;
+
+        meshlet_draw_indices.clear();
+        size_t mesh_draw = 0;
+        for (auto&[node, transformation_matrix] : flattened_hierarchy) {
+            for (auto& mesh : node->get_child_meshes()) {
+                // Draws keep their LOD across frames unless the hierarchy before them changes; then they only
+                // start from another draw's LOD
+                if (mesh_draw >= draw_lods.size()) draw_lods.push_back(0);
+                uint32_t& lod = draw_lods[mesh_draw++];
+
+                uint32_t meshlet_draw_index = UINT32_MAX;
+                if (mesh->is_uploaded()) {
+                    mesh->select_lod(transformation_matrix, camera_position, projection_scale, lod_pixel_threshold, lod);
+                    // Only the full detail LOD has meshlets; the coarser LODs are cheap enough to draw whole
+                    if (lod == 0 && mesh->meshlet_count > 0)
+                        meshlet_draw_index = meshlet_culler.add_draw(*mesh, transformation_matrix, meshlet_cone_culling);
+                }
+                meshlet_draw_indices.push_back(meshlet_draw_index);
+            }
+        }
+        draw_lods.resize(mesh_draw);
+
+        glm::mat4 view_projection = camera->get_projection_matrix() * camera->get_view_matrix();
+        if (!meshlet_culler.cull(fo.main_command_buffer, view_projection, camera_position, &geometry_arena))
+            std::fill(meshlet_draw_indices.begin(), meshlet_draw_indices.end(), UINT32_MAX);
+    }
+
     void RenderEngine::traverse_node_hierarchy(std::shared_ptr<Node> node, NodeHierarchyTraceback traceback, std::vector<std::pair<std::shared_ptr<Node>, glm::mat4>>& flattened_hierarchy, glm::mat4 parent_transform) {
         node->hierarchical_update(frame_number, parent_transform);
         glm::mat4 hierarchical_transform = parent_transform * node->get_model_matrix();
@@ -0,0 +1,144 @@
+#include "scene/aq_async_model_loader.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "util/thread_pool.hpp"
+#include "scene/aq_model_loader.hpp"
+#include "scene/aq_cooked_model.hpp"
+
+namespace aq {
+
+    AsyncModelLoader::AsyncModelLoader(GeometryArena* geometry_arena, MaterialManager* material_manager, UploadScheduler* upload_scheduler) :
+        geometry_arena(geometry_arena), material_manager(material_manager), upload_scheduler(upload_scheduler) {}
+
+    AsyncModelLoader::~AsyncModelLoader() {
+        if (!pending_models.empty())
+            std::cerr << "AsyncModelLoader destroyed while loading models; `destroy` should be called first" << std::endl;
+    }
+
+    std::shared_future<std::shared_ptr<Node>> AsyncModelLoader::load(
+        const std::filesystem::path& path,
+        std::shared_ptr<Node> parent,
+        const mesh_util::OptimizationOptions& optimization_options,
+        const std::optional<mesh_util::LodOptions>& lod_options
+    ) {
+        auto pending_model = std::make_unique<PendingModel>();
+        pending_model->path = path;
+        pending_model->parent = parent;
+        std::shared_future<std::shared_ptr<Node>> attached = pending_model->attached.get_future().share();
+
+        // The texture decoding this starts runs on the thread pool too; it's waited for by `update`, never here
+        pending_model->loading = ThreadPool::get_shared().submit([path, optimization_options, lod_options]() {
+            LoadedModel model;
+            if (path.extension() == cooked_model::extension) {
+                CookedModelLoader loader(path.string());
+                model.root_node = loader.get_root_node();
+                model.materials = loader.get_materials();
+            } else {
+                std::string directory = path.has_parent_path() ? (path.parent_path() / "").string() : std::string();
+                ModelLoader loader(directory, path.filename().string(), optimization_options, lod_options);
+                model.root_node = loader.get_root_node();
+                model.materials = loader.get_materials();
+            }
+            return model;
+        });
+
+        pending_models.push_back(std::move(pending_model));
+        return attached;
+    }
+
+    void AsyncModelLoader::update() {
+        for (size_t i=0; i<pending_models.size();) {
+            PendingModel& pending_model = *pending_models[i];
+
+            if (!pending_model.uploaded) {
+                if (!is_loaded(pending_model)) {
+                    ++i;
+                    continue;
+                }
+                if (pending_model.model->root_node) {
+                    upload(*pending_model.model);
+                    pending_model.uploaded = true;
+                } else {
+                    std::cerr << "Failed to load model " << pending_model.path << std::endl;
+                    pending_model.attached.set_value(nullptr);
+                    pending_models.erase(pending_models.begin() + i);
+                    continue;
+                }
+            }
+
+            if (!is_resident(*pending_model.model)) {
+                ++i;
+                continue;
+            }
+            if (pending_model.parent) pending_model.parent->add_node(pending_model.model->root_node);
+            pending_model.attached.set_value(pending_model.model->root_node);
+            pending_models.erase(pending_models.begin() + i);
+        }
+    }
+
+    void AsyncModelLoader::destroy() {
+        for (auto& pending_model : pending_models) {
+            if (!pending_model->model) pending_model->model = pending_model->loading.get();
+            if (pending_model->uploaded) {
+                for (auto& node : pending_model->model->root_node) {
+                    for (auto& mesh : node->get_child_meshes()) {
+                        mesh->free();
+                    }
+                }
+            }
+            pending_model->attached.set_value(nullptr);
+        }
+        pending_models.clear();
+    }
+
+    bool AsyncModelLoader::is_loaded(PendingModel& pending_model) {
+        if (!pending_model.model) {
+            if (pending_model.loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+            pending_model.model = pending_model.loading.get();
+        }
+
+        // `MaterialManager::add_material` would otherwise wait for the textures
+        for (auto& material : pending_model.model->materials) {
+            if (!material) continue;
+            for (auto& texture : material->textures) {
+                if (texture && texture->is_decoding()) return false;
+            }
+        }
+        return true;
+    }
+
+    void AsyncModelLoader::upload(LoadedModel& model) {
+        for (auto& node : model.root_node) {
+            for (auto& mesh : node->get_child_meshes()) {
+                if (!mesh->is_uploaded()) // A Mesh might appear several times in a node tree so make sure it's only uploaded once
+                    mesh->upload(geometry_arena);
+            }
+        }
+        for (auto& material : model.materials) {
+            material_manager->add_material(material);
+        }
+    }
+
+    bool AsyncModelLoader::is_resident(LoadedModel& model) {
+        // Tickets complete in order so only the last one has to be checked
+        UploadScheduler::Ticket last_ticket = 0;
+        for (auto& node : model.root_node) {
+            for (auto& mesh : node->get_child_meshes()) {
+                last_ticket = std::max(last_ticket, mesh->upload_ticket);
+            }
+        }
+        // Textures that weren't uploaded (eg. duplicates of another texture or over the memory budget) show
+        // another texture or the placeholder and don't hold the model back
+        for (auto& material : model.materials) {
+            if (!material) continue;
+            for (auto& texture : material->textures) {
+                if (texture && texture->is_uploaded()) last_ticket = std::max(last_ticket, texture->image.upload_ticket);
+            }
+        }
+        return upload_scheduler->is_complete(last_ticket);
+    }
+
+}
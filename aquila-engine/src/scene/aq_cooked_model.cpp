@@ -0,0 +1,665 @@
+#include "scene/aq_cooked_model.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+#include <unordered_map>
+
+#include "util/hash.hpp"
+#include "util/thread_pool.hpp"
+#include "scene/aq_ktx2.hpp"
+#include "scene/aq_texture_compressor.hpp"
+
+namespace aq {
+
+    namespace {
+        // File layout
+        // Every record only holds plain data. Strings are offsets into the string table, bulk data (vertices,
+        // indices, meshlets, embedded textures) are offsets into the blob section; both relative to the section.
+        // Nodes are stored in pre-order so parents always come before their children.
+
+        constexpr char magic[4] = {'A', 'Q', 'M', 'S'};
+        constexpr uint64_t section_alignment = 16;
+
+        struct StringRef {
+            uint32_t offset;
+            uint32_t size;
+        };
+
+        struct BlobRef {
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        struct Header {
+            char magic[4];
+            uint32_t version;
+
+            uint32_t node_count;
+            uint32_t mesh_reference_count;
+            uint32_t mesh_count;
+            uint32_t lod_range_count;
+            uint32_t material_count;
+            uint32_t padding;
+
+            BlobRef strings;
+            uint64_t nodes_offset;
+            uint64_t mesh_references_offset; // `uint32_t` mesh indices of every node's meshes
+            uint64_t meshes_offset;
+            uint64_t lod_ranges_offset;
+            uint64_t materials_offset;
+            BlobRef blobs;
+        };
+
+        struct NodeRecord {
+            float org_transform[16];
+            float position[3];
+            float rotation[4]; // w, x, y, z
+            float scale[3];
+            StringRef name;
+            uint32_t parent; // `UINT32_MAX` for the root
+            uint32_t first_mesh_reference;
+            uint32_t mesh_reference_count;
+        };
+
+        struct MeshRecord {
+            StringRef name;
+            uint32_t material; // `UINT32_MAX` if the mesh has none
+            uint32_t vertex_format;
+            uint32_t index_size; // 2 or 4 bytes
+            uint32_t vertex_count;
+            float bounds_min[3];
+            float bounds_extent[3];
+            uint32_t first_lod_range;
+            uint32_t lod_range_count;
+            uint32_t meshlet_count;
+            uint32_t padding;
+            BlobRef vertex_data;
+            BlobRef index_data;
+            BlobRef meshlets;
+        };
+
+        struct LodRangeRecord {
+            uint32_t first_index;
+            uint32_t index_count;
+            float error;
+        };
+
+        struct TextureRecord {
+            // Empty if the material has no texture of this type
+            // Relative to the cooked model's directory unless the texture is embedded (then it's only an identifier)
+            StringRef path;
+            BlobRef embedded_data; // Empty unless the texture was embedded in the model
+            int32_t width;
+            int32_t height;
+            StringRef format_hint;
+        };
+
+        struct MaterialRecord {
+            StringRef name;
+            Material::Properties properties;
+            TextureRecord textures[std::tuple_size<decltype(Material::textures)>::value];
+        };
+
+        static_assert(std::is_trivially_copyable<Material::Properties>::value, "`Material::Properties` is written as is");
+        static_assert(std::is_trivially_copyable<mesh_util::GPUMeshlet>::value, "`GPUMeshlet` is written as is");
+
+        uint64_t align_up(uint64_t offset) {
+            return (offset + section_alignment - 1) / section_alignment * section_alignment;
+        }
+
+        // Appends data to growing sections
+        class SectionWriter {
+        public:
+            template <typename T>
+            void push(const T& value) { push_bytes(&value, sizeof(T)); }
+
+            uint64_t push_bytes(const void* data, uint64_t size) {
+                uint64_t offset = bytes.size();
+                bytes.insert(bytes.end(), (const unsigned char*) data, (const unsigned char*) data + size);
+                return offset;
+            }
+
+            BlobRef push_blob(const void* data, uint64_t size) {
+                bytes.resize(align_up(bytes.size()), 0);
+                return {push_bytes(data, size), size};
+            }
+
+            StringRef push_string(const std::string& string) {
+                StringRef ref{(uint32_t) bytes.size(), (uint32_t) string.size()};
+                push_bytes(string.data(), string.size());
+                return ref;
+            }
+
+            std::vector<unsigned char> bytes;
+        };
+
+        struct Writer {
+            std::filesystem::path directory; // Of the file being written; texture paths are stored relative to it
+
+            SectionWriter strings;
+            SectionWriter blobs;
+            std::vector<NodeRecord> nodes;
+            std::vector<uint32_t> mesh_references;
+            std::vector<MeshRecord> meshes;
+            std::vector<LodRangeRecord> lod_ranges;
+            std::vector<MaterialRecord> materials;
+
+            std::unordered_map<const Mesh*, uint32_t> mesh_indices;
+            std::unordered_map<const Material*, uint32_t> material_indices;
+            std::unordered_map<const Texture*, std::string> texture_paths; // Cooked replacements of textures
+
+            uint32_t add_material(const std::shared_ptr<Material>& material) {
+                auto it = material_indices.find(material.get());
+                if (it != material_indices.end()) return it->second;
+
+                MaterialRecord record{};
+                record.name = strings.push_string(material->name);
+                record.properties = material->properties;
+                for (size_t i=0; i<material->textures.size(); ++i) {
+                    const std::shared_ptr<Texture>& texture = material->textures[i];
+                    if (!texture) continue;
+                    TextureRecord& texture_record = record.textures[i];
+                    auto cooked_path = texture_paths.find(texture.get());
+                    if (cooked_path != texture_paths.end()) {
+                        texture_record.path = strings.push_string(get_relative_path(cooked_path->second));
+                        continue;
+                    }
+                    const std::vector<unsigned char>& embedded_data = texture->get_embedded_data();
+                    if (embedded_data.empty()) {
+                        texture_record.path = strings.push_string(get_relative_path(texture->get_path()));
+                    } else {
+                        texture_record.path = strings.push_string(texture->get_path());
+                        texture_record.embedded_data = blobs.push_blob(embedded_data.data(), embedded_data.size());
+                        texture_record.width = (int32_t) texture->size.width;
+                        texture_record.height = (int32_t) texture->size.height;
+                        texture_record.format_hint = strings.push_string(texture->get_format_hint());
+                    }
+                }
+
+                materials.push_back(record);
+                material_indices[material.get()] = uint32_t(materials.size() - 1);
+                return uint32_t(materials.size() - 1);
+            }
+
+            // Texture paths are relative to the working directory; the cooked model should still find them when
+            // it's loaded from another one
+            std::string get_relative_path(const std::string& path) {
+                std::error_code error;
+                std::filesystem::path absolute_path = std::filesystem::absolute(path, error);
+                if (error) return path;
+                return absolute_path.lexically_proximate(directory).generic_string();
+            }
+
+            // Returns `UINT32_MAX` if the mesh has no data to write
+            uint32_t add_mesh(const std::shared_ptr<Mesh>& mesh) {
+                auto it = mesh_indices.find(mesh.get());
+                if (it != mesh_indices.end()) return it->second;
+
+                if (!mesh->packed_data && (mesh->vertices.empty() || mesh->indices.empty())) {
+                    std::cerr << "Mesh " << mesh->name << " has no CPU data and can't be cooked." << std::endl;
+                    return UINT32_MAX;
+                }
+                Mesh::PackedData packed = mesh->packed_data ? *mesh->packed_data : mesh->pack();
+
+                MeshRecord record{};
+                record.name = strings.push_string(mesh->name);
+                record.material = mesh->material ? add_material(mesh->material) : UINT32_MAX;
+                record.vertex_format = (uint32_t) packed.vertex_format;
+                record.index_size = (uint32_t) get_index_size(packed.index_type);
+                record.vertex_count = packed.vertex_count;
+                memcpy(record.bounds_min, &packed.bounds.min, sizeof(record.bounds_min));
+                memcpy(record.bounds_extent, &packed.bounds.extent, sizeof(record.bounds_extent));
+
+                record.first_lod_range = uint32_t(lod_ranges.size());
+                record.lod_range_count = uint32_t(packed.lod_ranges.size());
+                for (const auto& lod_range : packed.lod_ranges)
+                    lod_ranges.push_back({lod_range.first_index, lod_range.index_count, lod_range.error});
+
+                record.meshlet_count = packed.meshlet_count;
+                record.vertex_data = blobs.push_blob(packed.vertex_data, packed.vertex_data_size);
+                record.index_data = blobs.push_blob(packed.index_data, packed.index_data_size);
+                record.meshlets = blobs.push_blob(packed.meshlets, packed.meshlet_count * sizeof(mesh_util::GPUMeshlet));
+
+                meshes.push_back(record);
+                mesh_indices[mesh.get()] = uint32_t(meshes.size() - 1);
+                return uint32_t(meshes.size() - 1);
+            }
+
+            void add_node(const std::shared_ptr<Node>& node, uint32_t parent) {
+                NodeRecord record{};
+                memcpy(record.org_transform, &node->org_transform[0][0], sizeof(record.org_transform));
+                memcpy(record.position, &node->position, sizeof(record.position));
+                record.rotation[0] = node->rotation.w;
+                record.rotation[1] = node->rotation.x;
+                record.rotation[2] = node->rotation.y;
+                record.rotation[3] = node->rotation.z;
+                memcpy(record.scale, &node->scale, sizeof(record.scale));
+                record.name = strings.push_string(node->name);
+                record.parent = parent;
+
+                record.first_mesh_reference = uint32_t(mesh_references.size());
+                for (auto& mesh : node->get_child_meshes()) {
+                    uint32_t mesh_index = add_mesh(mesh);
+                    if (mesh_index != UINT32_MAX) mesh_references.push_back(mesh_index);
+                }
+                record.mesh_reference_count = uint32_t(mesh_references.size()) - record.first_mesh_reference;
+
+                nodes.push_back(record);
+                uint32_t node_index = uint32_t(nodes.size() - 1);
+                for (auto& child_node : node->get_child_nodes())
+                    add_node(child_node, node_index);
+            }
+        };
+
+        // Bump whenever the block encoders change so cached textures are compressed again
+        constexpr uint64_t compressed_texture_cache_version = 1;
+
+        // Compresses `texture` for its role into a KTX2 file at `output_path`
+        // With `cache`, the file is stored in the cache under the hash of the texture's source instead, so it's
+        // only compressed again when the source changes.
+        // Returns the file's path or nothing if the texture is kept as it is
+        std::optional<std::string> cook_texture(Texture& texture, Material::TextureType type, const std::string& output_path, AssetCache* cache) {
+            const std::vector<unsigned char>& embedded_data = texture.get_embedded_data();
+            if (!embedded_data.empty() && texture.size.height != 0) return std::nullopt; // Raw embedded texels are kept
+            if (!texture_util::is_block_compression_supported()) return std::nullopt; // The GPU couldn't sample it
+
+            uint64_t key = 0;
+            if (cache) {
+                uint64_t source_hash = embedded_data.empty() ? AssetCache::hash_file(texture.get_path()) : xxhash64(embedded_data.data(), embedded_data.size());
+                if (source_hash == 0) return std::nullopt;
+                key = AssetCache::combine(AssetCache::combine(source_hash, uint64_t(type)), compressed_texture_cache_version);
+                if (cache->contains(key, ".ktx2")) return cache->get_path(key, ".ktx2");
+            }
+
+            std::optional<texture_util::ImageData> image;
+            if (embedded_data.empty()) image = texture_util::load_image(texture.get_path());
+            else image = texture_util::load_image_from_memory(embedded_data.data(), embedded_data.size(), texture.get_path());
+            // Textures that are already compressed are kept
+            if (!image || image->format != vk::Format::eR8G8B8A8Unorm) return std::nullopt;
+
+            vk::Format format = texture_util::choose_compressed_format(type, texture_util::has_alpha(*image));
+            std::optional<texture_util::ImageData> compressed = texture_util::compress(*image, format);
+            if (!compressed) return std::nullopt;
+
+            if (!cache) {
+                if (!texture_util::write_ktx2(output_path, *compressed)) return std::nullopt;
+                return output_path;
+            }
+            std::string temporary_path = cache->get_temporary_path(key, ".ktx2");
+            if (!texture_util::write_ktx2(temporary_path, *compressed) || !cache->commit(temporary_path, key, ".ktx2")) return std::nullopt;
+            return cache->get_path(key, ".ktx2");
+        }
+
+        // Cooks every texture of `materials` in parallel (see `cook_texture`); the textures are written to `output_path + ".<n>.ktx2"`
+        // Returns the path to write for every texture that was compressed
+        std::unordered_map<const Texture*, std::string> cook_textures(
+            const std::vector<std::shared_ptr<Material>>& materials,
+            const std::string& output_path,
+            AssetCache* cache
+        ) {
+            struct Job {
+                Texture* texture;
+                Material::TextureType type;
+                std::optional<std::string> path;
+            };
+            std::vector<Job> jobs;
+            std::unordered_map<std::string, size_t> job_indices; // Source path and role to job
+            std::vector<std::pair<const Texture*, size_t>> texture_jobs;
+            for (auto& material : materials) {
+                if (!material) continue;
+                for (size_t i=0; i<material->textures.size(); ++i) {
+                    const std::shared_ptr<Texture>& texture = material->textures[i];
+                    if (!texture) continue;
+                    auto[it, inserted] = job_indices.insert({texture->get_path() + "|" + std::to_string(i), jobs.size()});
+                    if (inserted) jobs.push_back({texture.get(), Material::TextureType(i), std::nullopt});
+                    texture_jobs.push_back({texture.get(), it->second});
+                }
+            }
+
+            ThreadPool::get_shared().parallel_for(jobs.size(), [&](size_t i) {
+                jobs[i].path = cook_texture(*jobs[i].texture, jobs[i].type, output_path + "." + std::to_string(i) + ".ktx2", cache);
+            });
+
+            // A texture used in several roles keeps the first one's file
+            std::unordered_map<const Texture*, std::string> texture_paths;
+            for (auto&[texture, job] : texture_jobs) {
+                if (jobs[job].path) texture_paths.insert({texture, *jobs[job].path});
+            }
+            return texture_paths;
+        }
+
+        template <typename T>
+        uint64_t write_section(std::vector<unsigned char>& file, const T* data, uint64_t size) {
+            file.resize(align_up(file.size()), 0);
+            uint64_t offset = file.size();
+            file.insert(file.end(), (const unsigned char*) data, (const unsigned char*) data + size);
+            return offset;
+        }
+
+        bool write_model(
+            const std::string& path,
+            std::shared_ptr<Node> root_node,
+            const std::vector<std::shared_ptr<Material>>& materials,
+            std::unordered_map<const Texture*, std::string> texture_paths
+        ) {
+            if (!root_node) {
+                std::cerr << "Can't cook an empty model to " << path << "." << std::endl;
+                return false;
+            }
+
+            Writer writer;
+            std::error_code error;
+            writer.directory = std::filesystem::absolute(std::filesystem::path(path), error).parent_path();
+            writer.texture_paths = std::move(texture_paths);
+            for (auto& material : materials)
+                if (material) writer.add_material(material);
+            writer.add_node(root_node, UINT32_MAX);
+
+            Header header{};
+            memcpy(header.magic, magic, sizeof(magic));
+            header.version = cooked_model::version;
+            header.node_count = uint32_t(writer.nodes.size());
+            header.mesh_reference_count = uint32_t(writer.mesh_references.size());
+            header.mesh_count = uint32_t(writer.meshes.size());
+            header.lod_range_count = uint32_t(writer.lod_ranges.size());
+            header.material_count = uint32_t(writer.materials.size());
+
+            std::vector<unsigned char> file(sizeof(Header), 0);
+            header.strings = {write_section(file, writer.strings.bytes.data(), writer.strings.bytes.size()), writer.strings.bytes.size()};
+            header.nodes_offset = write_section(file, writer.nodes.data(), writer.nodes.size() * sizeof(NodeRecord));
+            header.mesh_references_offset = write_section(file, writer.mesh_references.data(), writer.mesh_references.size() * sizeof(uint32_t));
+            header.meshes_offset = write_section(file, writer.meshes.data(), writer.meshes.size() * sizeof(MeshRecord));
+            header.lod_ranges_offset = write_section(file, writer.lod_ranges.data(), writer.lod_ranges.size() * sizeof(LodRangeRecord));
+            header.materials_offset = write_section(file, writer.materials.data(), writer.materials.size() * sizeof(MaterialRecord));
+            header.blobs = {write_section(file, writer.blobs.bytes.data(), writer.blobs.bytes.size()), writer.blobs.bytes.size()};
+            memcpy(file.data(), &header, sizeof(Header));
+
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                std::cerr << "Failed to open " << path << " for writing." << std::endl;
+                return false;
+            }
+            out.write((const char*) file.data(), file.size());
+            if (!out) {
+                std::cerr << "Failed to write " << path << "." << std::endl;
+                return false;
+            }
+
+            return true;
+        }
+    }
+
+    namespace cooked_model {
+
+        bool write(const std::string& path, std::shared_ptr<Node> root_node, const std::vector<std::shared_ptr<Material>>& materials) {
+            return write_model(path, root_node, materials, {});
+        }
+
+        bool cook(
+            const std::string& directory,
+            const std::string& file,
+            const std::string& output_path,
+            const mesh_util::OptimizationOptions& optimization_options,
+            const std::optional<mesh_util::LodOptions>& lod_options,
+            bool compress_textures
+        ) {
+            ModelLoader loader(directory, file, optimization_options, lod_options);
+            if (!loader.get_root_node()) return false;
+
+            std::unordered_map<const Texture*, std::string> texture_paths;
+            if (compress_textures) texture_paths = cook_textures(loader.get_materials(), output_path, nullptr);
+
+            return write_model(output_path, loader.get_root_node(), loader.get_materials(), std::move(texture_paths));
+        }
+
+        bool write_to_cache(
+            AssetCache& cache,
+            uint64_t key,
+            std::shared_ptr<Node> root_node,
+            const std::vector<std::shared_ptr<Material>>& materials
+        ) {
+            std::unordered_map<const Texture*, std::string> texture_paths = cook_textures(materials, {}, &cache);
+
+            std::string temporary_path = cache.get_temporary_path(key, extension);
+            if (!write_model(temporary_path, root_node, materials, std::move(texture_paths))) return false;
+            return cache.commit(temporary_path, key, extension);
+        }
+
+    } // namespace cooked_model
+
+    CookedModelLoader::CookedModelLoader(const std::string& path) {
+        if (!load(path)) {
+            std::cerr << "Failed to load cooked model " << path << std::endl;
+            root_node = nullptr;
+            materials.clear();
+        }
+    }
+
+    bool CookedModelLoader::load(const std::string& path) {
+        std::shared_ptr<MappedFile> file = MappedFile::open(path);
+        if (!file) return false;
+
+        const unsigned char* data = file->data();
+        uint64_t file_size = file->size();
+        auto in_bounds = [file_size](uint64_t offset, uint64_t size) {
+            return offset <= file_size && size <= file_size - offset;
+        };
+
+        if (!in_bounds(0, sizeof(Header))) return false;
+        Header header;
+        memcpy(&header, data, sizeof(Header));
+        if (memcmp(header.magic, magic, sizeof(magic)) != 0) {
+            std::cerr << path << " is not a cooked model." << std::endl;
+            return false;
+        }
+        if (header.version != cooked_model::version) {
+            std::cerr << path << " was cooked with version " << header.version << " but version " << cooked_model::version << " is needed; cook it again." << std::endl;
+            return false;
+        }
+
+        if (
+            !in_bounds(header.strings.offset, header.strings.size) ||
+            !in_bounds(header.nodes_offset, uint64_t(header.node_count) * sizeof(NodeRecord)) ||
+            !in_bounds(header.mesh_references_offset, uint64_t(header.mesh_reference_count) * sizeof(uint32_t)) ||
+            !in_bounds(header.meshes_offset, uint64_t(header.mesh_count) * sizeof(MeshRecord)) ||
+            !in_bounds(header.lod_ranges_offset, uint64_t(header.lod_range_count) * sizeof(LodRangeRecord)) ||
+            !in_bounds(header.materials_offset, uint64_t(header.material_count) * sizeof(MaterialRecord)) ||
+            !in_bounds(header.blobs.offset, header.blobs.size) ||
+            header.node_count == 0
+        ) {
+            std::cerr << path << " is truncated or corrupt." << std::endl;
+            return false;
+        }
+
+        // Records are copied out since the sections are only aligned to `section_alignment`
+        auto read_record = [data](uint64_t section_offset, uint64_t index, auto& record) {
+            memcpy(&record, data + section_offset + index * sizeof(record), sizeof(record));
+        };
+        auto read_string = [&](StringRef ref, std::string& string) {
+            if (uint64_t(ref.offset) + ref.size > header.strings.size) return false;
+            string.assign((const char*) data + header.strings.offset + ref.offset, ref.size);
+            return true;
+        };
+        auto blob_in_bounds = [&](BlobRef ref) {
+            return ref.offset <= header.blobs.size && ref.size <= header.blobs.size - ref.offset;
+        };
+
+        // Materials
+
+        materials.reserve(header.material_count);
+        for (uint32_t i=0; i<header.material_count; ++i) {
+            MaterialRecord record;
+            read_record(header.materials_offset, i, record);
+
+            std::shared_ptr<Material> material = std::make_shared<Material>();
+            if (!read_string(record.name, material->name)) return false;
+            material->properties = record.properties;
+
+            for (size_t t=0; t<material->textures.size(); ++t) {
+                const TextureRecord& texture_record = record.textures[t];
+                if (texture_record.path.size == 0) continue;
+
+                std::string texture_path;
+                if (!read_string(texture_record.path, texture_path)) return false;
+                material->textures[t] = std::make_shared<Texture>();
+                if (texture_record.embedded_data.size > 0) {
+                    // `upload_later` copies `width` bytes of compressed images (`height` 0) or `width * height` of raw ones
+                    int64_t copy_size = texture_record.height == 0 ? int64_t(texture_record.width) : int64_t(texture_record.width) * texture_record.height;
+                    std::string format_hint;
+                    if (
+                        texture_record.width < 0 || texture_record.height < 0 || uint64_t(copy_size) > texture_record.embedded_data.size ||
+                        !blob_in_bounds(texture_record.embedded_data) || !read_string(texture_record.format_hint, format_hint)
+                    ) {
+                        std::cerr << path << " has a corrupt embedded texture." << std::endl;
+                        return false;
+                    }
+                    unsigned char* embedded_data = (unsigned char*) data + header.blobs.offset + texture_record.embedded_data.offset;
+                    material->textures[t]->upload_later(texture_path, embedded_data, texture_record.width, texture_record.height, format_hint);
+                } else {
+                    material->textures[t]->upload_later((std::filesystem::path(path).parent_path() / texture_path).string());
+                }
+            }
+
+            materials.push_back(material);
+        }
+
+        // Meshes; their packed data points into the mapping
+
+        std::vector<std::shared_ptr<Mesh>> meshes;
+        meshes.reserve(header.mesh_count);
+        for (uint32_t i=0; i<header.mesh_count; ++i) {
+            MeshRecord record;
+            read_record(header.meshes_offset, i, record);
+
+            if (
+                record.vertex_format >= (uint32_t) VertexFormat::Count ||
+                (record.index_size != 2 && record.index_size != 4) ||
+                (record.material != UINT32_MAX && record.material >= header.material_count) ||
+                uint64_t(record.first_lod_range) + record.lod_range_count > header.lod_range_count ||
+                record.lod_range_count == 0 ||
+                record.vertex_data.size != uint64_t(record.vertex_count) * get_vertex_size((VertexFormat) record.vertex_format) ||
+                record.index_data.size % record.index_size != 0 ||
+                record.meshlets.size != uint64_t(record.meshlet_count) * sizeof(mesh_util::GPUMeshlet) ||
+                !blob_in_bounds(record.vertex_data) || !blob_in_bounds(record.index_data) || !blob_in_bounds(record.meshlets)
+            ) {
+                std::cerr << path << " has a corrupt mesh." << std::endl;
+                return false;
+            }
+
+            std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+            if (!read_string(record.name, mesh->name)) return false;
+            if (record.material != UINT32_MAX) mesh->material = materials[record.material];
+
+            const unsigned char* blobs = data + header.blobs.offset;
+            Mesh::PackedData packed{};
+            packed.vertex_format = (VertexFormat) record.vertex_format;
+            packed.index_type = record.index_size == 2 ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+            memcpy(&packed.bounds.min, record.bounds_min, sizeof(record.bounds_min));
+            memcpy(&packed.bounds.extent, record.bounds_extent, sizeof(record.bounds_extent));
+            packed.vertex_count = record.vertex_count;
+            packed.vertex_data = blobs + record.vertex_data.offset;
+            packed.vertex_data_size = record.vertex_data.size;
+            packed.index_data = blobs + record.index_data.offset;
+            packed.index_data_size = record.index_data.size;
+            // Blobs are 16 byte aligned in the (page aligned) mapping
+            packed.meshlets = (const mesh_util::GPUMeshlet*) (blobs + record.meshlets.offset);
+            packed.meshlet_count = record.meshlet_count;
+
+            // Indices outside the mesh's vertices would make the GPU read another mesh's vertices (or past the buffer)
+            uint64_t index_count = record.index_data.size / record.index_size;
+            for (uint64_t n=0; n<index_count; ++n) {
+                uint32_t index;
+                if (record.index_size == 2) {
+                    uint16_t index16;
+                    memcpy(&index16, packed.index_data + n * 2, 2);
+                    index = index16;
+                } else {
+                    memcpy(&index, packed.index_data + n * 4, 4);
+                }
+                if (index >= record.vertex_count) {
+                    std::cerr << path << " has a mesh index out of range." << std::endl;
+                    return false;
+                }
+            }
+
+            for (uint32_t l=0; l<record.lod_range_count; ++l) {
+                LodRangeRecord lod_record;
+                read_record(header.lod_ranges_offset, record.first_lod_range + l, lod_record);
+                if (uint64_t(lod_record.first_index) + lod_record.index_count > index_count) {
+                    std::cerr << path << " has a corrupt mesh LOD." << std::endl;
+                    return false;
+                }
+                packed.lod_ranges.push_back({lod_record.first_index, lod_record.index_count, lod_record.error});
+            }
+
+            // `MeshletCuller` only makes room for the full detail LOD's indices (`meshlet_cull.comp` writes
+            // every visible meshlet's indices), so the meshlets have to lie within it and not add up to more
+            const Mesh::LodRange& full_detail = packed.lod_ranges[0];
+            uint64_t meshlet_index_count = 0;
+            for (uint32_t m=0; m<record.meshlet_count; ++m) {
+                mesh_util::GPUMeshlet meshlet;
+                memcpy(&meshlet, blobs + record.meshlets.offset + m * sizeof(mesh_util::GPUMeshlet), sizeof(meshlet));
+                meshlet_index_count += meshlet.index_count;
+                if (
+                    meshlet.first_index < full_detail.first_index ||
+                    uint64_t(meshlet.first_index) + meshlet.index_count > uint64_t(full_detail.first_index) + full_detail.index_count ||
+                    meshlet_index_count > full_detail.index_count
+                ) {
+                    std::cerr << path << " has a corrupt meshlet." << std::endl;
+                    return false;
+                }
+            }
+
+            packed.storage = file;
+            mesh->vertex_format = packed.vertex_format;
+            mesh->bounds = packed.bounds;
+            mesh->packed_data = std::move(packed);
+            meshes.push_back(mesh);
+        }
+
+        // Nodes
+
+        std::vector<std::shared_ptr<Node>> nodes;
+        nodes.reserve(header.node_count);
+        for (uint32_t i=0; i<header.node_count; ++i) {
+            NodeRecord record;
+            read_record(header.nodes_offset, i, record);
+
+            if (
+                (i == 0) != (record.parent == UINT32_MAX) ||
+                (record.parent != UINT32_MAX && record.parent >= i) ||
+                uint64_t(record.first_mesh_reference) + record.mesh_reference_count > header.mesh_reference_count
+            ) {
+                std::cerr << path << " has a corrupt node hierarchy." << std::endl;
+                return false;
+            }
+
+            std::shared_ptr<Node> node = std::make_shared<Node>();
+            if (!read_string(record.name, node->name)) return false;
+            memcpy(&node->org_transform[0][0], record.org_transform, sizeof(record.org_transform));
+            memcpy(&node->position, record.position, sizeof(record.position));
+            node->rotation = glm::quat(record.rotation[0], record.rotation[1], record.rotation[2], record.rotation[3]);
+            memcpy(&node->scale, record.scale, sizeof(record.scale));
+
+            for (uint32_t m=0; m<record.mesh_reference_count; ++m) {
+                uint32_t mesh_index;
+                read_record(header.mesh_references_offset, record.first_mesh_reference + m, mesh_index);
+                if (mesh_index >= meshes.size()) {
+                    std::cerr << path << " references a mesh that doesn't exist." << std::endl;
+                    return false;
+                }
+                node->add_mesh(meshes[mesh_index]);
+            }
+
+            if (record.parent != UINT32_MAX) nodes[record.parent]->add_node(node);
+            nodes.push_back(node);
+        }
+
+        root_node = nodes[0];
+        return true;
+    }
+
+}
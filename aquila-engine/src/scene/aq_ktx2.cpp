@@ -0,0 +1,189 @@
+#include "scene/aq_ktx2.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "util/mapped_file.hpp"
+#include "scene/aq_texture_compressor.hpp"
+
+namespace aq {
+namespace texture_util {
+
+    namespace {
+        constexpr uint8_t identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+        struct Header {
+            uint8_t identifier[12];
+            uint32_t vk_format;
+            uint32_t type_size;
+            uint32_t pixel_width;
+            uint32_t pixel_height;
+            uint32_t pixel_depth;
+            uint32_t layer_count;
+            uint32_t face_count;
+            uint32_t level_count;
+            uint32_t supercompression_scheme;
+
+            uint32_t dfd_byte_offset;
+            uint32_t dfd_byte_length;
+            uint32_t kvd_byte_offset;
+            uint32_t kvd_byte_length;
+            uint64_t sgd_byte_offset;
+            uint64_t sgd_byte_length;
+        };
+        static_assert(sizeof(Header) == 80, "Unexpected padding in the KTX2 header");
+
+        struct LevelIndex {
+            uint64_t byte_offset;
+            uint64_t byte_length;
+            uint64_t uncompressed_byte_length;
+        };
+
+        // Khronos Data Format basic descriptor block for `format`
+        std::vector<uint32_t> create_data_format_descriptor(vk::Format format) {
+            struct Sample {
+                uint32_t bit_offset;
+                uint32_t bit_length;
+                uint32_t channel;
+                uint32_t upper;
+            };
+
+            uint32_t color_model;
+            std::vector<Sample> samples;
+            switch (format) {
+            case vk::Format::eBc1RgbUnormBlock: color_model = 128; samples = {{0, 64, 0, UINT32_MAX}}; break;
+            case vk::Format::eBc3UnormBlock: color_model = 130; samples = {{0, 64, 15, UINT32_MAX}, {64, 64, 0, UINT32_MAX}}; break;
+            case vk::Format::eBc4UnormBlock: color_model = 131; samples = {{0, 64, 0, UINT32_MAX}}; break;
+            case vk::Format::eBc5UnormBlock: color_model = 132; samples = {{0, 64, 0, UINT32_MAX}, {64, 64, 1, UINT32_MAX}}; break;
+            case vk::Format::eBc7UnormBlock: color_model = 134; samples = {{0, 128, 0, UINT32_MAX}}; break;
+            default: color_model = 1; samples = {{0, 8, 0, 255}, {8, 8, 1, 255}, {16, 8, 2, 255}, {24, 8, 15, 255}}; break; // RGBA8
+            }
+            uint32_t block_dimension = is_block_compressed(format) ? 3 : 0; // Stored minus one
+
+            std::vector<uint32_t> dfd;
+            dfd.push_back(0); // Total size; filled in below
+            dfd.push_back(0); // Vendor (Khronos) and descriptor type (basic)
+            dfd.push_back(2 | ((24 + 16 * uint32_t(samples.size())) << 16)); // Version and block size
+            dfd.push_back(color_model | (1 << 8) | (1 << 16)); // BT.709 primaries, linear transfer, straight alpha
+            dfd.push_back(block_dimension | (block_dimension << 8));
+            dfd.push_back(uint32_t(get_block_size(format))); // Bytes in plane 0
+            dfd.push_back(0);
+            for (const Sample& sample : samples) {
+                dfd.push_back(sample.bit_offset | ((sample.bit_length - 1) << 16) | (sample.channel << 24));
+                dfd.push_back(0); // Sample position
+                dfd.push_back(0); // Lower
+                dfd.push_back(sample.upper);
+            }
+            dfd[0] = uint32_t(dfd.size() * sizeof(uint32_t));
+            return dfd;
+        }
+    }
+
+    std::optional<ImageData> read_ktx2(const std::string& path) {
+        std::shared_ptr<MappedFile> file = MappedFile::open(path);
+        if (!file) return std::nullopt;
+
+        Header header;
+        if (file->size() < sizeof(Header)) {
+            std::cerr << path << " is not a KTX2 file." << std::endl;
+            return std::nullopt;
+        }
+        memcpy(&header, file->data(), sizeof(Header));
+        if (memcmp(header.identifier, identifier, sizeof(identifier)) != 0) {
+            std::cerr << path << " is not a KTX2 file." << std::endl;
+            return std::nullopt;
+        }
+
+        vk::Format format = vk::Format(header.vk_format);
+        if (
+            get_block_size(format) == 0 || header.supercompression_scheme != 0 ||
+            header.pixel_width == 0 || header.pixel_height == 0 || header.pixel_depth != 0 ||
+            header.layer_count > 1 || header.face_count != 1
+        ) {
+            std::cerr << path << " is not a supported KTX2 texture (format " << vk::to_string(format) << ")." << std::endl;
+            return std::nullopt;
+        }
+
+        ImageData image;
+        image.format = format;
+        image.extent = vk::Extent2D(header.pixel_width, header.pixel_height);
+
+        uint32_t level_count = std::max(header.level_count, 1u); // 0 asks for the mip levels to be generated
+        if (file->size() < sizeof(Header) + uint64_t(level_count) * sizeof(LevelIndex)) {
+            std::cerr << path << " is truncated." << std::endl;
+            return std::nullopt;
+        }
+        for (uint32_t level=0; level<level_count; ++level) {
+            LevelIndex level_index;
+            memcpy(&level_index, file->data() + sizeof(Header) + level * sizeof(LevelIndex), sizeof(LevelIndex));
+
+            vk::Extent2D level_extent(std::max(image.extent.width >> level, 1u), std::max(image.extent.height >> level, 1u));
+            if (
+                level_index.byte_length != get_level_size(format, level_extent) ||
+                level_index.byte_offset > file->size() || level_index.byte_length > file->size() - level_index.byte_offset
+            ) {
+                std::cerr << path << " has a corrupt mip level " << level << "." << std::endl;
+                return std::nullopt;
+            }
+            image.levels.push_back({level_index.byte_offset, level_index.byte_length});
+        }
+
+        image.data = file->data();
+        image.storage = file;
+        image.mapped = true;
+        return image;
+    }
+
+    bool write_ktx2(const std::string& path, const ImageData& image) {
+        vk::DeviceSize block_size = get_block_size(image.format);
+        if (block_size == 0 || image.levels.empty()) {
+            std::cerr << "Can't write " << vk::to_string(image.format) << " image to " << path << "." << std::endl;
+            return false;
+        }
+
+        std::vector<uint32_t> dfd = create_data_format_descriptor(image.format);
+
+        Header header{};
+        memcpy(header.identifier, identifier, sizeof(identifier));
+        header.vk_format = uint32_t(static_cast<VkFormat>(image.format));
+        header.type_size = 1;
+        header.pixel_width = image.extent.width;
+        header.pixel_height = image.extent.height;
+        header.face_count = 1;
+        header.level_count = uint32_t(image.levels.size());
+        header.dfd_byte_offset = uint32_t(sizeof(Header) + image.levels.size() * sizeof(LevelIndex));
+        header.dfd_byte_length = uint32_t(dfd.size() * sizeof(uint32_t));
+
+        std::vector<unsigned char> file(header.dfd_byte_offset + header.dfd_byte_length, 0);
+        memcpy(file.data(), &header, sizeof(Header));
+        memcpy(file.data() + header.dfd_byte_offset, dfd.data(), header.dfd_byte_length);
+
+        // Levels are stored from the smallest to the largest, each aligned to lcm(block size, 4)
+        vk::DeviceSize alignment = block_size % 4 == 0 ? block_size : block_size * 4;
+        for (size_t level=image.levels.size(); level-- > 0;) {
+            file.resize((file.size() + alignment - 1) / alignment * alignment, 0);
+            LevelIndex level_index{file.size(), image.levels[level].size, image.levels[level].size};
+            memcpy(file.data() + sizeof(Header) + level * sizeof(LevelIndex), &level_index, sizeof(LevelIndex));
+
+            const unsigned char* level_data = image.data + image.levels[level].offset;
+            file.insert(file.end(), level_data, level_data + image.levels[level].size);
+        }
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "Failed to open " << path << " for writing." << std::endl;
+            return false;
+        }
+        out.write((const char*) file.data(), file.size());
+        if (!out) {
+            std::cerr << "Failed to write " << path << "." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+} // namespace texture_util
+} // namespace aq
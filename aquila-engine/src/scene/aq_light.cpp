@@ -36,12 +36,14 @@ namespace aq {
         size_t initial_capacity,
         DescriptorSetBuilder& per_frame_descriptor_set_builder, // should have multiplicity of `frame_overlap`
         vma::Allocator* allocator,
-        vk_util::UploadContext upload_context
+        vk_util::UploadContext upload_context,
+        RetirementQueue* retirement_queue
     ) {
         this->frame_overlap = frame_overlap;
         this->initial_capacity = initial_capacity;
         this->allocator = allocator;
         ctx = upload_context;
+        this->retirement_queue = retirement_queue;
 
         per_frame_descriptor_set_builder.add_binding({(int) PerFrameBufferBindings::LightPropertiesBuffer, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eFragment});
     }
@@ -65,7 +67,9 @@ namespace aq {
             initial_capacity,
             write_buff_desc_sets.data(),
             allocator,
-            ctx
+            ctx,
+            retirement_queue,
+            MemoryOwner::LightTable
         );
     }
 
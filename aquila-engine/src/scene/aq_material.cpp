@@ -1,7 +1,9 @@
 #include "scene/aq_material.hpp"
 
-#include <list>
+#include <array>
 #include <algorithm>
+#include <climits>
+#include <cmath>
 #include <iostream>
 
 #include "util/vk_utility.hpp"
@@ -9,6 +11,9 @@
 
 namespace aq {
 
+    // Device local memory that is kept free when deciding whether to upload a texture
+    static constexpr vk::DeviceSize TEXTURE_BUDGET_HEADROOM = 64 << 20;
+
     Material::Material() {}
     Material::Material(const std::string& name) : name(name) {}
 
@@ -24,33 +29,39 @@ namespace aq {
 
     void MaterialManager::init(
         uint frame_overlap,
-        size_t texture_capacity,
+        uint32_t initial_texture_capacity,
+        uint32_t max_texture_capacity,
         size_t initial_material_capacity,
         DescriptorSetBuilder& per_frame_descriptor_set_builder,
         vma::Allocator* allocator,
-        vk_util::UploadContext upload_context
+        vk_util::UploadContext upload_context,
+        UploadScheduler* upload_scheduler,
+        RetirementQueue* retirement_queue,
+        bool trilinear_filtering
     ) {
         this->frame_overlap = frame_overlap;
-        this->texture_capacity = texture_capacity;
+        this->max_texture_capacity = max_texture_capacity;
         this->initial_material_capacity = initial_material_capacity;
         this->allocator = allocator;
         this->ctx = upload_context;
+        this->upload_scheduler = upload_scheduler;
+        this->retirement_queue = retirement_queue;
 
         per_frame_descriptor_set_builder
-            .add_binding({(int) PerFrameBufferBindings::MaterialPropertiesBuffer, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eFragment})
-            .add_binding({(int) PerFrameBufferBindings::DefaultSampler, vk::DescriptorType::eSampler, 1, vk::ShaderStageFlagBits::eFragment})
-            .add_binding({(int) PerFrameBufferBindings::Textures, vk::DescriptorType::eSampledImage, (uint32_t) texture_capacity, vk::ShaderStageFlagBits::eFragment});
+            .add_binding({(int) PerFrameBufferBindings::MaterialPropertiesBuffer, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eFragment});
 
         // Create Sampler for textures
         vk::SamplerCreateInfo sampler_create_info = vk::SamplerCreateInfo()
             .setMagFilter(vk::Filter::eLinear)
             .setMinFilter(vk::Filter::eLinear)
-            .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+            .setMipmapMode(trilinear_filtering ? vk::SamplerMipmapMode::eLinear : vk::SamplerMipmapMode::eNearest)
             .setAddressModeU(vk::SamplerAddressMode::eRepeat)
             .setAddressModeV(vk::SamplerAddressMode::eRepeat)
             .setAddressModeW(vk::SamplerAddressMode::eRepeat)
             .setMipLodBias(0.0f)
-            .setAnisotropyEnable(VK_FALSE);
+            .setAnisotropyEnable(VK_FALSE)
+            .setMinLod(0.0f)
+            .setMaxLod(VK_LOD_CLAMP_NONE); // Every mip level of every texture
 
         vk::Result cs_result;
         std::tie(cs_result, default_sampler) = ctx.device.createSampler(sampler_create_info);
@@ -60,14 +71,36 @@ namespace aq {
         std::string placeholder_texture_path = std::string(AQUILA_ENGINE_PATH) + "/resources/missing_texture.png";
         textures.push_back(std::make_shared<Texture>());
         assert(textures.size() == 1); // Error texture must be the first texture
-        assert(textures[0]->upload_from_file(placeholder_texture_path, allocator, ctx));
+        assert(textures[0]->upload_from_file(placeholder_texture_path, upload_scheduler));
+
+        // Texture table layout
+        // Only the slots that are used have to be written (partially bound) and new slots can be written while
+        // the table is used by frames in flight (update after bind)
+
+        std::array<vk::DescriptorSetLayoutBinding, 1> texture_table_bindings{{
+            {(uint32_t) LongLivedBindings::Textures, vk::DescriptorType::eSampledImage, max_texture_capacity, vk::ShaderStageFlagBits::eFragment}
+        }};
+        std::array<vk::DescriptorBindingFlags, 1> texture_table_binding_flags{
+            vk::DescriptorBindingFlagBits::ePartiallyBound |
+            vk::DescriptorBindingFlagBits::eVariableDescriptorCount |
+            vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+            vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending
+        };
+        vk::DescriptorSetLayoutBindingFlagsCreateInfo binding_flags_create_info(texture_table_binding_flags);
+
+        vk::DescriptorSetLayoutCreateInfo ds_layout_create_info(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool, texture_table_bindings);
+        ds_layout_create_info.pNext = &binding_flags_create_info;
+
+        vk::Result cdsl_result;
+        std::tie(cdsl_result, texture_table_layout) = ctx.device.createDescriptorSetLayout(ds_layout_create_info);
+        CHECK_VK_RESULT(cdsl_result, "Failed to create texture table layout");
+
+        create_texture_table(std::min(std::max(initial_texture_capacity, 1u), max_texture_capacity));
     }
 
     void MaterialManager::descriptor_sets_created(const std::vector<vk::DescriptorSet>& descriptor_sets) {
         this->descriptor_sets = descriptor_sets;
 
-        create_descriptor_writes();
-
         // Init material buffers
 
         std::vector<vk::WriteDescriptorSet> write_buff_desc_sets;
@@ -84,7 +117,9 @@ namespace aq {
             initial_material_capacity,
             write_buff_desc_sets.data(),
             allocator,
-            ctx
+            ctx,
+            retirement_queue,
+            MemoryOwner::MaterialTable
         );
 
         add_material(default_material);
@@ -134,6 +169,10 @@ namespace aq {
 
         material_memory.remove_object(material_index);
 
+        // Keep the material buffers bounded when many materials are created and removed (eg. in long editor sessions)
+        if (material_memory.get_nr_free_slots() >= 64 && material_memory.get_nr_free_slots() > material_memory.get_nr_objects())
+            compact();
+
         return true;
     }
 
@@ -145,60 +184,194 @@ namespace aq {
         }
 
         if (!texture->is_uploaded()) {
-            if (!texture->upload(allocator, ctx)) {
+            // Still decoding; the slot shows the placeholder until `update` uploads it
+            bool decoding = texture->is_decoding();
+            if (!decoding) {
+                if (!texture->decode()) return 0;
+                // The same image under another path shares its slot
+                auto content_it = texture_content_paths.find(texture->get_content_hash());
+                if (content_it != texture_content_paths.end()) {
+                    uint texture_index = texture_indices[content_it->second];
+                    texture_indices.insert({texture->get_path(), texture_index});
+                    texture->clear_cpu_data();
+                    return texture_index;
+                }
+            }
+            // Degrade to the placeholder texture (index 0) instead of running out of memory; the texture can be added again later
+            if (memory_budget && memory_budget->get_remaining_budget() < TEXTURE_BUDGET_HEADROOM) {
+                std::cerr << "GPU memory budget exhausted. Using placeholder for texture " << texture->get_path() << std::endl;
+                return 0;
+            }
+            if (!decoding && !texture->upload(upload_scheduler, texture_streaming ? texture_streaming->initial_extent : 0)) {
                 return 0;
             }
         }
 
-        uint texture_index = (uint)textures.size();
+        uint texture_index = allocate_texture_slot();
+        if (texture_index == UINT_MAX) {
+            std::cerr << "Texture table is full. Using placeholder for texture " << texture->get_path() << std::endl;
+            return 0;
+        }
 
-        textures.push_back(texture);
+        textures[texture_index] = texture;
         texture_indices.insert({texture->get_path(), texture_index});
-        added_textures.push_back({texture_index, {}});
+        write_texture(texture_index); // Written once; the table is shared by every frame
+
+        if (texture->is_uploaded()) texture_uploaded(texture.get());
+        else decoding_textures.push_back(texture);
 
         return texture_index;
     }
 
     void MaterialManager::update(uint safe_frame) {
+        upload_decoded_textures();
+        stream_textures();
         material_memory.update(safe_frame);
+    }
+
+    void MaterialManager::upload_decoded_textures() {
+        for (size_t i=0; i<decoding_textures.size();) {
+            std::shared_ptr<Texture> texture = decoding_textures[i];
+            if (texture->is_decoding()) {
+                ++i;
+                continue;
+            }
+            decoding_textures[i] = decoding_textures.back();
+            decoding_textures.pop_back();
+
+            // The same image under another path was uploaded meanwhile; its slot is shared instead
+            if (texture->decode()) {
+                auto content_it = texture_content_paths.find(texture->get_content_hash());
+                if (content_it != texture_content_paths.end()) {
+                    auto it = texture_indices.find(texture->get_path());
+                    if (it != texture_indices.end()) retarget_texture_slot(it->second, texture_indices[content_it->second]);
+                    texture->clear_cpu_data();
+                    continue;
+                }
+            }
+
+            // Failed textures keep showing the placeholder
+            if (memory_budget && memory_budget->get_remaining_budget() < TEXTURE_BUDGET_HEADROOM) {
+                std::cerr << "GPU memory budget exhausted. Using placeholder for texture " << texture->get_path() << std::endl;
+                continue;
+            }
+            if (!texture->upload(upload_scheduler, texture_streaming ? texture_streaming->initial_extent : 0)) continue;
 
-        std::vector<vk::WriteDescriptorSet> descriptor_writes;
-        // Needed to store the memory for `descriptor_writes` because `vk::WriteDescriptorSet` only keeps a pointer
-        // to `vk::DescriptorImageInfo`. A list is necessary so pointers aren't invalidated
-        std::list<vk::DescriptorImageInfo> image_infos;
+            // Frames in flight read the placeholder from the texture's slot so it moves to a new slot,
+            // the same way it would after defragmentation
+            texture_uploaded(texture.get());
+            texture_moved(texture.get());
+        }
+    }
 
-        auto it2 = added_textures.begin();
-        while (it2 != added_textures.end()) {
-            if (std::find(std::begin(it2->second), std::end(it2->second), safe_frame) == std::end(it2->second)) {
-                it2->second.push_back(safe_frame);
+    void MaterialManager::texture_uploaded(Texture* texture) {
+        register_texture_image(texture);
+        if (texture->get_content_hash() != 0) texture_content_paths.insert({texture->get_content_hash(), texture->get_path()});
+        if (texture->is_streamed()) streamed_textures[texture] = {texture->get_first_resident_level()};
+    }
 
-                image_infos.push_back(textures[it2->first]->get_image_info());
+    void MaterialManager::register_texture_image(Texture* texture) {
+        if (!defragmentation_service) return;
+        defragmentation_service->register_image(&texture->image, [this, texture](DeletionQueue& stale_resources) {
+            texture->image_moved(stale_resources);
+            texture_moved(texture);
+        });
+    }
 
-                vk::WriteDescriptorSet write_tex_desc_set = vk::WriteDescriptorSet()
-                    .setDstSet(descriptor_sets[safe_frame])
-                    .setDstBinding((int) PerFrameBufferBindings::Textures)
-                    .setDstArrayElement(it2->first)
-                    .setDescriptorType(vk::DescriptorType::eSampledImage)
-                    .setDescriptorCount(1)
-                    .setPImageInfo(&image_infos.back());
+    void MaterialManager::request_texture_detail(const std::shared_ptr<Material>& material, float screen_size) {
+        if (streamed_textures.empty() || !material) return;
+
+        const Material::Properties& properties = material->properties;
+        for (uint texture_index : {properties.albedo_ti, properties.roughness_ti, properties.metalness_ti, properties.ambient_occlusion_ti, properties.normal_ti}) {
+            if (texture_index == 0 || texture_index >= textures.size() || !textures[texture_index]) continue;
+            Texture* texture = textures[texture_index].get();
+            auto it = streamed_textures.find(texture);
+            if (it == streamed_textures.end()) continue;
+            StreamedTexture& streamed = it->second;
+
+            // Assumes the texture is stretched over the mesh once
+            float texels = float(std::max(texture->size.width, texture->size.height));
+            uint32_t level = 0;
+            if (screen_size < texels) level = std::min(uint32_t(std::log2(texels / std::max(screen_size, 1.0f))), streamed.initial_level);
+
+            if (streamed.last_requested != streaming_update) streamed.requested_level = level;
+            else streamed.requested_level = std::min(streamed.requested_level, level);
+            streamed.last_requested = streaming_update;
+        }
+    }
 
-                descriptor_writes.push_back(write_tex_desc_set);
+    void MaterialManager::stream_textures() {
+        if (!texture_streaming || streamed_textures.empty()) return;
+        const TextureStreamingOptions& options = *texture_streaming;
+
+        vk::DeviceSize resident_size = 0;
+        std::vector<std::pair<Texture*, StreamedTexture*>> upgrades; // Requested since the last update and need finer levels
+        std::vector<std::pair<Texture*, StreamedTexture*>> evictable; // Unseen for `eviction_delay` updates and have finer levels than their initial ones
+        for (auto& [texture, streamed] : streamed_textures) {
+            uint32_t resident_level = texture->get_first_resident_level();
+            resident_size += texture->get_streamed_size(resident_level);
+            if (streamed.last_requested == streaming_update && streamed.requested_level < resident_level)
+                upgrades.push_back({texture, &streamed});
+            else if (streamed.last_requested + options.eviction_delay < streaming_update && resident_level < streamed.initial_level)
+                evictable.push_back({texture, &streamed});
+        }
+        ++streaming_update;
+        if (upgrades.empty()) return;
+
+        // The blurriest textures first, evicting the least recently seen ones first
+        std::sort(upgrades.begin(), upgrades.end(), [](auto& a, auto& b) {
+            return a.first->get_first_resident_level() - a.second->requested_level > b.first->get_first_resident_level() - b.second->requested_level;
+        });
+        std::sort(evictable.begin(), evictable.end(), [](auto& a, auto& b) { return a.second->last_requested < b.second->last_requested; });
+        size_t next_eviction = 0;
+
+        // Evicted images are only destroyed once frames in flight are done with them so the budget can be exceeded for a few frames
+        vk::DeviceSize streamed_bytes = 0;
+        for (auto& [texture, streamed] : upgrades) {
+            uint32_t resident_level = texture->get_first_resident_level();
+            auto growth = [&](uint32_t level) { return texture->get_streamed_size(level) - texture->get_streamed_size(resident_level); };
+
+            // Finer levels that don't fit in this update are streamed in by later ones
+            uint32_t level = streamed->requested_level;
+            while (level + 1 < resident_level && streamed_bytes + texture->get_streamed_size(level) > options.max_bytes_per_update) ++level;
+            if (streamed_bytes > 0 && streamed_bytes + texture->get_streamed_size(level) > options.max_bytes_per_update) continue;
+
+            while (resident_size + growth(level) > options.budget && next_eviction < evictable.size()) {
+                auto& [evicted, evicted_streamed] = evictable[next_eviction++];
+                vk::DeviceSize evicted_size = evicted->get_streamed_size(evicted->get_first_resident_level());
+                if (!stream_texture(evicted, evicted_streamed->initial_level)) continue;
+                resident_size -= evicted_size - evicted->get_streamed_size(evicted_streamed->initial_level);
+                streamed_bytes += evicted->get_streamed_size(evicted_streamed->initial_level);
             }
+            while (level < resident_level && resident_size + growth(level) > options.budget) ++level;
+            if (level == resident_level) continue;
 
-            if (it2->second.size() >= frame_overlap) {
-                it2 = added_textures.erase(it2);
-            } else {
-                ++it2;
-            }
+            if (memory_budget && memory_budget->get_remaining_budget() < TEXTURE_BUDGET_HEADROOM + growth(level)) break;
+            if (!stream_texture(texture, level)) continue;
+            resident_size += growth(level);
+            streamed_bytes += texture->get_streamed_size(level);
         }
+    }
 
-        ctx.device.updateDescriptorSets(descriptor_writes, {});
+    bool MaterialManager::stream_texture(Texture* texture, uint32_t first_level) {
+        // The old image is retired so defragmentation must not move it in the meantime
+        if (defragmentation_service) defragmentation_service->release(texture->image.allocation);
+        bool streamed = texture->stream_levels(first_level, upload_scheduler, retirement_queue);
+        register_texture_image(texture);
+
+        // Frames in flight keep reading the old image from the texture's old slot
+        if (streamed) texture_moved(texture);
+        return streamed;
     }
 
     ManagedMemoryIndex MaterialManager::get_material_index(std::shared_ptr<Material> material) {
         auto it = material_indices.find(material);
         if (it == material_indices.end()) return 0; // Material not found so return default material
-        return it->second;
+        return material_memory.get_slot(it->second);
+    }
+
+    size_t MaterialManager::compact() {
+        return material_memory.compact();
     }
 
     std::shared_ptr<Texture> MaterialManager::get_texture(std::string path) {
@@ -208,30 +381,117 @@ namespace aq {
         return {};
     }
 
-    void MaterialManager::create_descriptor_writes() {
-        for (uint i=0; i<frame_overlap; ++i) {
-            std::array<vk::DescriptorImageInfo, 1> sampler_infos{{
-                {default_sampler, nullptr, vk::ImageLayout::eShaderReadOnlyOptimal}
-            }};
-            vk::WriteDescriptorSet write_samp_desc_set = vk::WriteDescriptorSet()
-                .setDstSet(descriptor_sets[i])
-                .setDstBinding((int) PerFrameBufferBindings::DefaultSampler)
-                .setDescriptorType(vk::DescriptorType::eSampler)
-                .setImageInfo(sampler_infos);
+    bool MaterialManager::create_texture_table(uint32_t capacity) {
+        std::array<vk::DescriptorPoolSize, 1> pool_sizes{{
+            {vk::DescriptorType::eSampledImage, capacity}
+        }};
+        vk::DescriptorPoolCreateInfo desc_pool_create_info(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind, 1, pool_sizes);
 
-            std::vector<vk::DescriptorImageInfo> image_infos;
-            image_infos.reserve(texture_capacity);
-            for (size_t i=0; i<texture_capacity; ++i)
-                image_infos.push_back(textures[0]->get_image_info());
+        auto[cdp_result, new_pool] = ctx.device.createDescriptorPool(desc_pool_create_info);
+        CHECK_VK_RESULT_R(cdp_result, false, "Failed to create texture table descriptor pool");
 
-            vk::WriteDescriptorSet write_tex_desc_set = vk::WriteDescriptorSet()
-                .setDstSet(descriptor_sets[i])
-                .setDstBinding((int) PerFrameBufferBindings::Textures)
-                .setDescriptorType(vk::DescriptorType::eSampledImage)
-                .setImageInfo(image_infos);
+        vk::DescriptorSetVariableDescriptorCountAllocateInfo variable_count_allocate_info(1, &capacity);
+        vk::DescriptorSetAllocateInfo ds_allocate_info(new_pool, 1, &texture_table_layout);
+        ds_allocate_info.pNext = &variable_count_allocate_info;
 
-            ctx.device.updateDescriptorSets({write_samp_desc_set, write_tex_desc_set}, {});
+        vk::DescriptorSet new_table;
+        vk::Result ads_result = ctx.device.allocateDescriptorSets(&ds_allocate_info, &new_table);
+        if (ads_result != vk::Result::eSuccess) {
+            CHECK_VK_RESULT(ads_result, "Failed to allocate texture table");
+            ctx.device.destroyDescriptorPool(new_pool);
+            return false;
         }
+
+        // Frames in flight might still be using the old table
+        if (texture_table_pool) {
+            vk::Device device = ctx.device;
+            vk::DescriptorPool old_pool = texture_table_pool;
+            retirement_queue->retire([device, old_pool]() { device.destroyDescriptorPool(old_pool); });
+        }
+
+        texture_table_pool = new_pool;
+        texture_table = new_table;
+        texture_table_capacity = capacity;
+
+        for (uint i=0; i<textures.size(); ++i) {
+            if (textures[i]) write_texture(i);
+        }
+
+        return true;
+    }
+
+    void MaterialManager::write_texture(uint texture_index) {
+        // Textures that are still decoding show the placeholder texture
+        Texture* texture = textures[texture_index]->is_uploaded() ? textures[texture_index].get() : textures[0].get();
+        vk::DescriptorImageInfo image_info = texture->get_image_info();
+        vk::WriteDescriptorSet write_tex_desc_set = vk::WriteDescriptorSet()
+            .setDstSet(texture_table)
+            .setDstBinding((uint32_t) LongLivedBindings::Textures)
+            .setDstArrayElement(texture_index)
+            .setDescriptorType(vk::DescriptorType::eSampledImage)
+            .setDescriptorCount(1)
+            .setPImageInfo(&image_info);
+        ctx.device.updateDescriptorSets({write_tex_desc_set}, {});
+    }
+
+    uint MaterialManager::allocate_texture_slot() {
+        if (!free_texture_slots.empty()) {
+            uint texture_index = free_texture_slots.back();
+            free_texture_slots.pop_back();
+            return texture_index;
+        }
+
+        if (textures.size() >= texture_table_capacity) {
+            // Grow the table; the layout's upper bound stays the same so pipelines don't need to be rebuilt
+            if (texture_table_capacity >= max_texture_capacity) return UINT_MAX;
+            uint32_t new_capacity = std::min(texture_table_capacity * 2, max_texture_capacity);
+            if (!create_texture_table(new_capacity)) return UINT_MAX;
+        }
+
+        textures.push_back(nullptr);
+        return (uint) textures.size() - 1;
+    }
+
+    void MaterialManager::texture_moved(Texture* texture) {
+        auto it = texture_indices.find(texture->get_path());
+        if (it == texture_indices.end()) return;
+        uint old_index = it->second;
+
+        // The old slot can't be rewritten while frames in flight read it so the texture gets a new slot
+        uint new_index = allocate_texture_slot();
+        if (new_index == UINT_MAX) {
+            std::cerr << "Texture table is full. Failed to move texture " << texture->get_path() << std::endl;
+            return;
+        }
+        textures[new_index] = textures[old_index];
+        write_texture(new_index);
+
+        retarget_texture_slot(old_index, new_index);
+    }
+
+    void MaterialManager::retarget_texture_slot(uint old_index, uint new_index) {
+        // Every path sharing the slot (see `texture_content_paths`) moves with it
+        for (auto& texture_index : texture_indices) {
+            if (texture_index.second == old_index) texture_index.second = new_index;
+        }
+
+        for (auto& material_index : material_indices) {
+            Material::Properties& properties = material_index.first->properties;
+            bool changed = false;
+            for (uint* texture_index : {&properties.albedo_ti, &properties.roughness_ti, &properties.metalness_ti, &properties.ambient_occlusion_ti, &properties.normal_ti}) {
+                if (*texture_index == old_index) {
+                    *texture_index = new_index;
+                    changed = true;
+                }
+            }
+            if (changed) material_memory.update_object(material_index.second, (void*) &properties);
+        }
+
+        retirement_queue->retire([this, old_index]() {
+            if (old_index >= textures.size()) return; // Already destroyed
+            textures[old_index] = nullptr;
+            free_texture_slots.push_back(old_index);
+        });
     }
 
     void MaterialManager::destroy() {
@@ -244,8 +504,17 @@ namespace aq {
         material_indices.clear();
 
         // Clearing textures vector will free unused textures
+        decoding_textures.clear();
+        streamed_textures.clear();
+        texture_content_paths.clear();
         textures.clear();
-        added_textures.clear();
+        free_texture_slots.clear();
+
+        ctx.device.destroyDescriptorPool(texture_table_pool);
+        texture_table_pool = nullptr;
+        texture_table = nullptr;
+        texture_table_capacity = 0;
+        ctx.device.destroyDescriptorSetLayout(texture_table_layout);
     }
 
 }
\ No newline at end of file
@@ -1,9 +1,26 @@
 #include "scene/aq_mesh.hpp"
 
+#include <limits>
+
+#include "util/hash.hpp"
 #include "util/vk_utility.hpp"
+#include "scene/aq_mesh_optimizer.hpp"
 
 namespace aq {
 
+    namespace {
+        // Covers everything `Mesh::upload` puts in the arena, so meshes with the same hash can share it
+        uint64_t hash_packed_data(const Mesh::PackedData& packed) {
+            uint32_t layout[3] = {uint32_t(packed.vertex_format), uint32_t(packed.index_type), packed.vertex_count};
+            uint64_t hash = xxhash64(layout, sizeof(layout));
+            hash = xxhash64(&packed.bounds, sizeof(VertexBounds), hash); // Dequantizes the positions
+            hash = xxhash64(packed.vertex_data, packed.vertex_data_size, hash);
+            hash = xxhash64(packed.index_data, packed.index_data_size, hash);
+            hash = xxhash64(packed.lod_ranges.data(), packed.lod_ranges.size() * sizeof(Mesh::LodRange), hash);
+            return xxhash64(packed.meshlets, packed.meshlet_count * sizeof(mesh_util::GPUMeshlet), hash);
+        }
+    }
+
     Mesh::Mesh() {}
     Mesh::Mesh(const std::string& name) : name(name) {}
     Mesh::Mesh(const std::vector<Vertex>& vertices, const std::vector<Index>& indices) : vertices(vertices), indices(indices) {}
@@ -13,70 +30,211 @@ namespace aq {
         free(); // Just in case
     }
 
-    void Mesh::upload(vma::Allocator* allocator) {
-        if (this->allocator) {
-            std::cerr << "Request to upload already uploaded mesh. Request ignored.";
+    Mesh::PackedData Mesh::pack() const {
+        // Owns the packed arrays; `PackedData` only points into them
+        struct Storage {
+            std::vector<unsigned char> vertex_data;
+            std::vector<Index> indices;
+            std::vector<uint16_t> indices16;
+            std::vector<mesh_util::GPUMeshlet> meshlets;
+        };
+        auto storage = std::make_shared<Storage>();
+
+        PackedData packed{};
+        packed.vertex_format = vertex_format;
+        packed.bounds = VertexBounds::from_vertices(vertices);
+        packed.vertex_count = uint32_t(vertices.size());
+
+        storage->vertex_data = pack_vertices(vertex_format, vertices, packed.bounds);
+        packed.vertex_data = storage->vertex_data.data();
+        packed.vertex_data_size = storage->vertex_data.size();
+
+        // The LODs follow the full detail indices in the same allocation
+        storage->indices = indices;
+        packed.lod_ranges.push_back({0, uint32_t(indices.size()), 0.0f});
+        for (auto& lod : lods) {
+            packed.lod_ranges.push_back({uint32_t(storage->indices.size()), uint32_t(lod.indices.size()), lod.error});
+            storage->indices.insert(storage->indices.end(), lod.indices.begin(), lod.indices.end());
+        }
+
+        // Indices are relative to `vertex_offset` so only the mesh's own vertex count matters
+        packed.index_type = vertices.size() <= max_vertices_for_uint16_indices ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+        if (packed.index_type == vk::IndexType::eUint16) {
+            storage->indices16.assign(storage->indices.begin(), storage->indices.end());
+            packed.index_data = storage->indices16.data();
+        } else {
+            packed.index_data = storage->indices.data();
+        }
+        packed.index_data_size = storage->indices.size() * get_index_size(packed.index_type);
+
+        storage->meshlets.reserve(meshlets.size());
+        for (const auto& meshlet : meshlets) {
+            storage->meshlets.push_back({
+                glm::vec4(meshlet.center, meshlet.radius),
+                glm::vec4(meshlet.cone_axis, meshlet.cone_cutoff),
+                meshlet.first_index,
+                meshlet.index_count
+            });
+        }
+        packed.meshlets = storage->meshlets.data();
+        packed.meshlet_count = uint32_t(storage->meshlets.size());
+
+        packed.storage = std::move(storage);
+        return packed;
+    }
+
+    void Mesh::upload(GeometryArena* arena) {
+        if (this->arena) {
+            std::cerr << "Request to upload already uploaded mesh " << name << ". Request ignored.\n";
             return;
         }
-        this->allocator = allocator;
 
-        combined_iv_buffer = create_buffer_with_iv_data(
-            vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer,
-            vma::MemoryUsage::eCpuToGpu
-        );
+        if (packed_data) {
+            upload(arena, *packed_data);
+            packed_data.reset(); // The data has been copied to staging memory
+            return;
+        }
+
+        if (vertices.empty() || indices.empty()) {
+            std::cerr << "Request to upload empty mesh " << name << ". Request ignored.\n";
+            return;
+        }
+        upload(arena, pack());
     }
 
-    void Mesh::upload(vma::Allocator* allocator, const vk_util::UploadContext& upload_context) {
-        if (this->allocator) {
-            std::cerr << "Request to upload already uploaded mesh. Request ignored.";
+    void Mesh::upload(GeometryArena* arena, const PackedData& packed) {
+        if (packed.vertex_data_size == 0 || packed.lod_ranges.empty() || packed.lod_ranges[0].index_count == 0) {
+            std::cerr << "Request to upload empty mesh " << name << ". Request ignored.\n";
             return;
         }
-        this->allocator = allocator;
 
-        vertex_data_offset = indices.size() * sizeof(Index);
-        vk::DeviceSize buffer_size = indices.size()*sizeof(Index) + vertices.size()*sizeof(Vertex);
+        vertex_format = packed.vertex_format;
+        index_type = packed.index_type;
+        bounds = packed.bounds;
+        vk::DeviceSize vertex_size = get_vertex_size(vertex_format);
+        vk::DeviceSize index_size = get_index_size(index_type);
+        vk::DeviceSize meshlet_data_size = packed.meshlet_count * sizeof(mesh_util::GPUMeshlet);
+
+        // Meshes with the same content (eg. several copies of a primitive) share their allocations and upload
+        uint64_t hash = hash_packed_data(packed);
+        const GeometryArena::SharedGeometry* shared_geometry = arena->acquire_shared_geometry(hash);
+        if (shared_geometry) {
+            vertex_allocation = shared_geometry->vertices;
+            index_allocation = shared_geometry->indices;
+            meshlet_allocation = shared_geometry->meshlets;
+            upload_ticket = shared_geometry->upload_ticket;
+        } else {
+            // Suballocate space in the arena
+            // Meshes with different vertex formats share the buffer; aligning to the vertex size keeps `vertex_offset` exact
+
+            vertex_allocation = arena->allocate_vertices(packed.vertex_data_size, vertex_size);
+            index_allocation = arena->allocate_indices(packed.index_data_size, index_size);
+            if (packed.meshlet_count > 0)
+                meshlet_allocation = arena->allocate_meshlets(meshlet_data_size, sizeof(mesh_util::GPUMeshlet));
+            if (!vertex_allocation.is_valid() || !index_allocation.is_valid() || (packed.meshlet_count > 0 && !meshlet_allocation.is_valid())) {
+                std::cerr << "Failed to allocate mesh " << name << " in the geometry arena." << std::endl;
+                arena->free_vertices(vertex_allocation);
+                arena->free_indices(index_allocation);
+                arena->free_meshlets(meshlet_allocation);
+                return;
+            }
+        }
+        this->arena = arena;
+        content_hash = hash;
+
+        vertex_offset = int32_t(vertex_allocation.offset / vertex_size);
+        first_index = uint32_t(index_allocation.offset / index_size);
+        lod_ranges = packed.lod_ranges;
+        for (auto& lod_range : lod_ranges) lod_range.first_index += first_index;
+        index_count = lod_ranges[0].index_count;
+        first_meshlet = uint32_t(meshlet_allocation.offset / sizeof(mesh_util::GPUMeshlet));
+        meshlet_count = packed.meshlet_count;
 
-        AllocatedBuffer staging_buffer = create_buffer_with_iv_data(
-            vk::BufferUsageFlagBits::eTransferSrc,
-            vma::MemoryUsage::eCpuOnly
-        );
+        if (shared_geometry) return;
 
-        // Create actual buffer
+        // The culling shader reads the indices straight from the arena so the meshlets point at their absolute location
+        std::vector<mesh_util::GPUMeshlet> gpu_meshlets(packed.meshlets, packed.meshlets + packed.meshlet_count);
+        for (auto& meshlet : gpu_meshlets) meshlet.first_index += first_index;
 
-        combined_iv_buffer.allocate(allocator, buffer_size, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst, vma::MemoryUsage::eGpuOnly);
+        // Schedule the transfers into the arena (they end up in the same batch unless the staging memory runs out)
 
-        // Transfer contents of staging buffer into actual buffer
+        UploadScheduler* upload_scheduler = arena->get_upload_scheduler();
+        upload_scheduler->upload_buffer(arena->get_index_buffer(), index_allocation.offset, packed.index_data, packed.index_data_size);
+        if (!gpu_meshlets.empty())
+            upload_scheduler->upload_buffer(arena->get_meshlet_buffer(), meshlet_allocation.offset, gpu_meshlets.data(), meshlet_data_size);
+        upload_ticket = upload_scheduler->upload_buffer(arena->get_vertex_buffer(), vertex_allocation.offset, packed.vertex_data, packed.vertex_data_size);
 
-        vk_util::immediate_submit([this, buffer_size, &staging_buffer](vk::CommandBuffer cmd) {
-            vk::BufferCopy buffer_copy(0, 0, buffer_size);
-            cmd.copyBuffer(staging_buffer.buffer, combined_iv_buffer.buffer, {buffer_copy});
-        }, upload_context);
+        arena->add_shared_geometry(hash, {vertex_allocation, index_allocation, meshlet_allocation, upload_ticket});
+    }
 
-        staging_buffer.destroy();
+    void Mesh::generate_lods(const mesh_util::LodOptions& options) {
+        lods = mesh_util::generate_lods(vertices, indices, options);
+        for (auto& lod : lods) mesh_util::optimize_vertex_cache(lod.indices, vertices.size());
     }
 
-    AllocatedBuffer Mesh::create_buffer_with_iv_data(vk::BufferUsageFlags buffer_usage, vma::MemoryUsage memory_usage) {
-        vertex_data_offset = indices.size() * sizeof(Index);
-        vk::DeviceSize iv_buffer_size = indices.size()*sizeof(Index) + vertices.size()*sizeof(Vertex);
+    void Mesh::build_meshlets() {
+        meshlets = mesh_util::build_meshlets(vertices, indices);
+    }
+
+    const Mesh::LodRange& Mesh::select_lod(const glm::mat4& model, const glm::vec3& camera_position, float projection_scale, float pixel_threshold, uint32_t& current_lod) const {
+        // A coarser LOD is only picked once its error is this much below the threshold
+        constexpr float lod_hysteresis = 0.25f;
+
+        if (lod_ranges.size() <= 1) {
+            current_lod = 0;
+            return lod_ranges[0];
+        }
 
-        AllocatedBuffer buffer_with_data{};
-        buffer_with_data.allocate(allocator, iv_buffer_size, buffer_usage, memory_usage, vk::MemoryPropertyFlagBits::eHostCoherent);
-        
-        // Copy data into buffer
+        // Bounding sphere in world space
+        float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+        glm::vec3 center = glm::vec3(model * glm::vec4(bounds.min + bounds.extent * 0.5f, 1.0f));
+        float radius = glm::length(bounds.extent) * 0.5f * scale;
 
-        auto[mm_result, b_memory] = allocator->mapMemory(buffer_with_data.allocation);
-        CHECK_VK_RESULT(mm_result, "Failed to map mesh buffer memory");
-        memcpy(b_memory, indices.data(), indices.size() * sizeof(Index));
-        memcpy((char*)b_memory + vertex_data_offset, vertices.data(), vertices.size() * sizeof(Vertex));
-        allocator->unmapMemory(buffer_with_data.allocation);
+        float distance = glm::length(center - camera_position) - radius;
+        if (distance <= 0.0f) {
+            current_lod = 0;
+            return lod_ranges[0];
+        }
+        float pixels_per_unit = projection_scale / distance;
 
-        return buffer_with_data;
+        uint32_t lod = 0;
+        for (uint32_t i=1; i<lod_ranges.size(); ++i) {
+            float threshold = i > current_lod ? pixel_threshold * (1.0f - lod_hysteresis) : pixel_threshold;
+            if (lod_ranges[i].error * scale * pixels_per_unit > threshold) break;
+            lod = i;
+        }
+        current_lod = lod;
+        return lod_ranges[lod];
+    }
+
+    float Mesh::get_screen_size(const glm::mat4& model, const glm::vec3& camera_position, float projection_scale) const {
+        float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+        glm::vec3 center = glm::vec3(model * glm::vec4(bounds.min + bounds.extent * 0.5f, 1.0f));
+        float radius = glm::length(bounds.extent) * 0.5f * scale;
+
+        float distance = glm::length(center - camera_position) - radius;
+        if (distance <= 0.0f) return std::numeric_limits<float>::infinity();
+        return 2.0f * radius * projection_scale / distance;
     }
 
     void Mesh::free() {
-        combined_iv_buffer.destroy();
-        vertex_data_offset = 0;
-        allocator = nullptr;
+        if (arena) {
+            // The allocations are freed with the last mesh sharing them
+            arena->release_shared_geometry(content_hash);
+            vertex_allocation = {};
+            index_allocation = {};
+            meshlet_allocation = {};
+        }
+        vertex_offset = 0;
+        first_index = 0;
+        index_count = 0;
+        index_type = vk::IndexType::eUint32;
+        lod_ranges.clear();
+        first_meshlet = 0;
+        meshlet_count = 0;
+        upload_ticket = 0;
+        content_hash = 0;
+        arena = nullptr;
         material = {};
     }
 
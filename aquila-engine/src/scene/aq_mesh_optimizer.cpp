@@ -0,0 +1,344 @@
+#include "scene/aq_mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+
+namespace aq {
+namespace mesh_util {
+
+    namespace {
+        // Number of vertices that miss a FIFO cache with `cache_size` entries
+        size_t count_cache_misses(const std::vector<Index>& indices, size_t vertex_count, uint32_t cache_size) {
+            // A vertex is in the cache if it was inserted less than `cache_size` insertions ago
+            std::vector<uint32_t> timestamps(vertex_count, 0);
+            uint32_t time = cache_size + 1;
+            size_t misses = 0;
+            for (Index index : indices) {
+                if (time - timestamps[index] > cache_size) {
+                    timestamps[index] = time++;
+                    ++misses;
+                }
+            }
+            return misses;
+        }
+
+        struct VertexHash {
+            size_t operator()(const Vertex& vertex) const {
+                // FNV-1a over the bytes of the vertex
+                const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&vertex);
+                uint64_t hash = 14695981039346656037ull;
+                for (size_t i=0; i<sizeof(Vertex); ++i) {
+                    hash ^= bytes[i];
+                    hash *= 1099511628211ull;
+                }
+                return size_t(hash);
+            }
+        };
+
+        struct VertexEqual {
+            bool operator()(const Vertex& lhs, const Vertex& rhs) const {
+                return memcmp(&lhs, &rhs, sizeof(Vertex)) == 0;
+            }
+        };
+
+        // Cache size assumed by the vertex cache optimization; larger than the measured cache so the
+        // result works well on a range of hardware
+        constexpr int forsyth_cache_size = 32;
+
+        float forsyth_vertex_score(int cache_position, uint32_t live_triangles) {
+            if (live_triangles == 0) return -1.0f; // Not used by any remaining triangle
+
+            float score = 0.0f;
+            if (cache_position >= 0) {
+                if (cache_position < 3) {
+                    score = 0.75f; // Used by the last triangle; fixed score so the strip direction doesn't matter
+                } else {
+                    score = std::pow(1.0f - float(cache_position - 3) / float(forsyth_cache_size - 3), 1.5f);
+                }
+            }
+            // Prefer vertices with few triangles left so they can leave the cache for good
+            score += 2.0f * std::pow(float(live_triangles), -0.5f);
+            return score;
+        }
+    }
+
+    float calculate_acmr(const std::vector<Index>& indices, size_t vertex_count, uint32_t cache_size) {
+        if (indices.size() < 3) return 0.0f; // No whole triangle
+        return float(count_cache_misses(indices, vertex_count, cache_size)) / float(indices.size() / 3);
+    }
+
+    float calculate_atvr(const std::vector<Index>& indices, size_t vertex_count, uint32_t cache_size) {
+        if (vertex_count == 0) return 0.0f;
+        return float(count_cache_misses(indices, vertex_count, cache_size)) / float(vertex_count);
+    }
+
+    size_t weld_vertices(std::vector<Vertex>& vertices, std::vector<Index>& indices) {
+        std::unordered_map<Vertex, Index, VertexHash, VertexEqual> unique_vertices;
+        unique_vertices.reserve(vertices.size());
+
+        std::vector<Index> remap(vertices.size());
+        std::vector<Vertex> welded_vertices;
+        welded_vertices.reserve(vertices.size());
+
+        for (size_t i=0; i<vertices.size(); ++i) {
+            auto[it, inserted] = unique_vertices.insert({vertices[i], Index(welded_vertices.size())});
+            if (inserted) welded_vertices.push_back(vertices[i]);
+            remap[i] = it->second;
+        }
+
+        for (Index& index : indices) index = remap[index];
+
+        size_t removed = vertices.size() - welded_vertices.size();
+        vertices.swap(welded_vertices);
+        return removed;
+    }
+
+    void optimize_vertex_cache(std::vector<Index>& indices, size_t vertex_count) {
+        size_t triangle_count = indices.size() / 3;
+        if (triangle_count == 0) return;
+
+        // Triangles using every vertex; the first `live_triangles[v]` entries of a vertex's range haven't been emitted yet
+
+        std::vector<uint32_t> live_triangles(vertex_count, 0);
+        for (Index index : indices) live_triangles[index]++;
+
+        std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+        for (size_t v=0; v<vertex_count; ++v) adjacency_offsets[v+1] = adjacency_offsets[v] + live_triangles[v];
+
+        std::vector<uint32_t> adjacency(indices.size());
+        std::vector<uint32_t> fill_offsets(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        for (size_t t=0; t<triangle_count; ++t) {
+            for (size_t k=0; k<3; ++k) adjacency[fill_offsets[indices[t*3+k]]++] = uint32_t(t);
+        }
+
+        // Initial scores
+
+        std::vector<int> cache_positions(vertex_count, -1);
+        std::vector<float> vertex_scores(vertex_count);
+        for (size_t v=0; v<vertex_count; ++v) vertex_scores[v] = forsyth_vertex_score(-1, live_triangles[v]);
+
+        std::vector<float> triangle_scores(triangle_count);
+        std::vector<bool> triangle_emitted(triangle_count, false);
+        int64_t best_triangle = 0;
+        for (size_t t=0; t<triangle_count; ++t) {
+            triangle_scores[t] = vertex_scores[indices[t*3]] + vertex_scores[indices[t*3+1]] + vertex_scores[indices[t*3+2]];
+            if (triangle_scores[t] > triangle_scores[best_triangle]) best_triangle = int64_t(t);
+        }
+
+        std::vector<Index> optimized_indices;
+        optimized_indices.reserve(indices.size());
+        std::vector<Index> cache;
+        std::vector<Index> new_cache;
+        size_t next_unemitted = 0;
+
+        while (optimized_indices.size() < triangle_count * 3) {
+            if (best_triangle < 0) {
+                // Nothing in the cache is connected to a remaining triangle; continue with the next one in order
+                while (triangle_emitted[next_unemitted]) ++next_unemitted;
+                best_triangle = int64_t(next_unemitted);
+            }
+
+            size_t t = size_t(best_triangle);
+            triangle_emitted[t] = true;
+
+            new_cache.clear();
+            for (size_t k=0; k<3; ++k) {
+                Index v = indices[t*3+k];
+                optimized_indices.push_back(v);
+
+                uint32_t begin = adjacency_offsets[v];
+                uint32_t end = begin + live_triangles[v];
+                for (uint32_t i=begin; i<end; ++i) {
+                    if (adjacency[i] == t) {
+                        std::swap(adjacency[i], adjacency[end-1]);
+                        break;
+                    }
+                }
+                live_triangles[v]--;
+
+                if (std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end()) new_cache.push_back(v);
+            }
+
+            // The triangle's vertices move to the front of the cache (LRU)
+            size_t triangle_vertex_count = new_cache.size();
+            for (Index v : cache) {
+                auto triangle_vertices_end = new_cache.begin() + triangle_vertex_count;
+                if (std::find(new_cache.begin(), triangle_vertices_end, v) == triangle_vertices_end) new_cache.push_back(v);
+            }
+
+            for (size_t i=0; i<new_cache.size(); ++i) {
+                Index v = new_cache[i];
+                cache_positions[v] = i < forsyth_cache_size ? int(i) : -1; // Vertices past the cache size are evicted
+                vertex_scores[v] = forsyth_vertex_score(cache_positions[v], live_triangles[v]);
+            }
+
+            // Only triangles using a vertex whose score changed need to be rescored
+            best_triangle = -1;
+            float best_score = -1.0f;
+            for (Index v : new_cache) {
+                uint32_t begin = adjacency_offsets[v];
+                uint32_t end = begin + live_triangles[v];
+                for (uint32_t i=begin; i<end; ++i) {
+                    uint32_t tt = adjacency[i];
+                    triangle_scores[tt] = vertex_scores[indices[tt*3]] + vertex_scores[indices[tt*3+1]] + vertex_scores[indices[tt*3+2]];
+                    if (triangle_scores[tt] > best_score) {
+                        best_score = triangle_scores[tt];
+                        best_triangle = int64_t(tt);
+                    }
+                }
+            }
+
+            if (new_cache.size() > forsyth_cache_size) new_cache.resize(forsyth_cache_size);
+            cache.swap(new_cache);
+        }
+
+        indices.swap(optimized_indices);
+    }
+
+    void optimize_overdraw(std::vector<Index>& indices, const std::vector<Vertex>& vertices, float threshold) {
+        size_t triangle_count = indices.size() / 3;
+        if (triangle_count == 0) return;
+
+        // Split into clusters where the cache restarts (every vertex of a triangle misses) so reordering
+        // the clusters doesn't cost many extra cache misses
+
+        float mesh_acmr = calculate_acmr(indices, vertices.size());
+
+        std::vector<size_t> cluster_starts{0};
+        std::vector<uint32_t> timestamps(vertices.size(), 0);
+        uint32_t time = default_cache_size + 1;
+        size_t cluster_misses = 0;
+        size_t cluster_triangles = 0;
+        for (size_t t=0; t<triangle_count; ++t) {
+            size_t triangle_misses = 0;
+            for (size_t k=0; k<3; ++k) {
+                Index index = indices[t*3+k];
+                if (time - timestamps[index] > default_cache_size) {
+                    timestamps[index] = time++;
+                    ++triangle_misses;
+                }
+            }
+
+            if (triangle_misses == 3 && cluster_triangles > 0 && float(cluster_misses) / float(cluster_triangles) <= mesh_acmr * threshold) {
+                cluster_starts.push_back(t);
+                cluster_misses = 0;
+                cluster_triangles = 0;
+            }
+            cluster_misses += triangle_misses;
+            cluster_triangles++;
+        }
+        if (cluster_starts.size() < 2) return;
+
+        // Sort the clusters so the ones facing away from the center of the mesh (likely in front) are drawn first
+
+        struct Cluster {
+            size_t start;
+            size_t end;
+            glm::vec3 centroid{0.0f};
+            glm::vec3 normal{0.0f}; // Area weighted
+            float area = 0.0f;
+            float sort_key = 0.0f;
+        };
+        std::vector<Cluster> clusters(cluster_starts.size());
+
+        glm::vec3 mesh_centroid(0.0f);
+        float mesh_area = 0.0f;
+        for (size_t c=0; c<clusters.size(); ++c) {
+            Cluster& cluster = clusters[c];
+            cluster.start = cluster_starts[c];
+            cluster.end = c+1 < cluster_starts.size() ? cluster_starts[c+1] : triangle_count;
+
+            for (size_t t=cluster.start; t<cluster.end; ++t) {
+                glm::vec3 p0(vertices[indices[t*3+0]].position);
+                glm::vec3 p1(vertices[indices[t*3+1]].position);
+                glm::vec3 p2(vertices[indices[t*3+2]].position);
+                glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+                float area = glm::length(cross);
+
+                cluster.centroid += (p0 + p1 + p2) / 3.0f * area;
+                cluster.normal += cross;
+                cluster.area += area;
+            }
+
+            mesh_centroid += cluster.centroid;
+            mesh_area += cluster.area;
+            if (cluster.area > 0.0f) cluster.centroid /= cluster.area;
+        }
+        if (mesh_area > 0.0f) mesh_centroid /= mesh_area;
+
+        for (auto& cluster : clusters) {
+            float normal_length = glm::length(cluster.normal);
+            glm::vec3 normal = normal_length > 0.0f ? cluster.normal / normal_length : glm::vec3(0.0f);
+            cluster.sort_key = glm::dot(cluster.centroid - mesh_centroid, normal);
+        }
+
+        std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& lhs, const Cluster& rhs) { return lhs.sort_key > rhs.sort_key; });
+
+        std::vector<Index> sorted_indices;
+        sorted_indices.reserve(indices.size());
+        for (auto& cluster : clusters) {
+            sorted_indices.insert(sorted_indices.end(), indices.begin() + cluster.start*3, indices.begin() + cluster.end*3);
+        }
+        indices.swap(sorted_indices);
+    }
+
+    void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<Index>& indices) {
+        std::vector<Index> remap(vertices.size(), UINT32_MAX);
+        std::vector<Vertex> fetch_ordered_vertices;
+        fetch_ordered_vertices.reserve(vertices.size());
+
+        for (Index& index : indices) {
+            if (remap[index] == UINT32_MAX) {
+                remap[index] = Index(fetch_ordered_vertices.size());
+                fetch_ordered_vertices.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+
+        vertices.swap(fetch_ordered_vertices);
+    }
+
+    std::string OptimizationReport::to_string() const {
+        std::stringstream report;
+        report << std::fixed << std::setprecision(3);
+        for (size_t i=0; i<steps.size(); ++i) {
+            const Step& step = steps[i];
+            report << (i > 0 ? " -> " : "") << step.name << " (" << step.vertex_count << " vertices, ACMR " << step.acmr << ", ATVR " << step.atvr << ")";
+        }
+        return report.str();
+    }
+
+    OptimizationReport optimize_mesh(std::vector<Vertex>& vertices, std::vector<Index>& indices, const OptimizationOptions& options) {
+        OptimizationReport report;
+        auto measure = [&](const char* name) {
+            report.steps.push_back({name, vertices.size(), calculate_acmr(indices, vertices.size()), calculate_atvr(indices, vertices.size())});
+        };
+
+        measure("original");
+
+        if (options.weld) {
+            weld_vertices(vertices, indices);
+            measure("weld");
+        }
+        if (options.vertex_cache) {
+            optimize_vertex_cache(indices, vertices.size());
+            measure("vertex cache");
+        }
+        if (options.overdraw) {
+            optimize_overdraw(indices, vertices, options.overdraw_threshold);
+            measure("overdraw");
+        }
+        if (options.vertex_fetch) {
+            optimize_vertex_fetch(vertices, indices);
+            measure("vertex fetch");
+        }
+
+        return report;
+    }
+
+} // namespace mesh_util
+} // namespace aq
@@ -0,0 +1,275 @@
+#include "scene/aq_mesh_simplifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace aq {
+namespace mesh_util {
+
+    namespace {
+        // Symmetric 4x4 matrix; the weight makes the error an average squared distance
+        struct Quadric {
+            double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+            double a11 = 0, a12 = 0, a13 = 0;
+            double a22 = 0, a23 = 0;
+            double a33 = 0;
+            double weight = 0;
+
+            static Quadric from_plane(double a, double b, double c, double d, double weight) {
+                Quadric q;
+                q.a00 = weight*a*a; q.a01 = weight*a*b; q.a02 = weight*a*c; q.a03 = weight*a*d;
+                q.a11 = weight*b*b; q.a12 = weight*b*c; q.a13 = weight*b*d;
+                q.a22 = weight*c*c; q.a23 = weight*c*d;
+                q.a33 = weight*d*d;
+                q.weight = weight;
+                return q;
+            }
+
+            void add(const Quadric& q) {
+                a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+                a11 += q.a11; a12 += q.a12; a13 += q.a13;
+                a22 += q.a22; a23 += q.a23;
+                a33 += q.a33;
+                weight += q.weight;
+            }
+
+            // Average squared distance of `p` to the planes in the quadric
+            double error(const glm::vec3& p) const {
+                double x = p.x, y = p.y, z = p.z;
+                double e =
+                    a00*x*x + 2.0*a01*x*y + 2.0*a02*x*z + 2.0*a03*x +
+                    a11*y*y + 2.0*a12*y*z + 2.0*a13*y +
+                    a22*z*z + 2.0*a23*z +
+                    a33;
+                return weight > 0.0 ? std::fabs(e) / weight : 0.0;
+            }
+        };
+
+        struct PositionHash {
+            size_t operator()(const glm::vec3& p) const {
+                std::hash<float> hasher;
+                return hasher(p.x) ^ (hasher(p.y) * 31) ^ (hasher(p.z) * 961);
+            }
+        };
+
+        struct Collapse {
+            Index src;
+            Index dst;
+            double cost;
+        };
+    }
+
+    std::vector<Index> simplify(
+        const std::vector<Vertex>& vertices,
+        const std::vector<Index>& indices,
+        size_t target_index_count,
+        float target_error,
+        float* result_error
+    ) {
+        std::vector<Index> result = indices;
+        double max_error_squared = double(target_error) * double(target_error);
+        double error_squared = 0.0;
+
+        size_t vertex_count = vertices.size();
+        auto position = [&](Index v) { return glm::vec3(vertices[v].position); };
+
+        // Vertices that share their position with another vertex are on a seam and are never moved
+
+        std::vector<bool> seam(vertex_count, false);
+        {
+            std::unordered_map<glm::vec3, Index, PositionHash> first_at_position;
+            first_at_position.reserve(vertex_count);
+            for (Index v=0; v<vertex_count; ++v) {
+                auto[it, inserted] = first_at_position.insert({position(v), v});
+                if (!inserted) {
+                    seam[v] = true;
+                    seam[it->second] = true;
+                }
+            }
+        }
+
+        // Plane quadrics of every triangle, plus perpendicular planes along boundary edges so borders keep their shape
+
+        std::vector<Quadric> quadrics(vertex_count);
+        {
+            std::unordered_map<uint64_t, uint32_t> edge_use; // (min,max) vertex pair to number of triangles using it
+            auto edge_key = [](Index a, Index b) { return (uint64_t(std::min(a, b)) << 32) | uint64_t(std::max(a, b)); };
+            for (size_t i=0; i<result.size(); i+=3) {
+                for (size_t k=0; k<3; ++k) edge_use[edge_key(result[i+k], result[i+(k+1)%3])]++;
+            }
+
+            for (size_t i=0; i<result.size(); i+=3) {
+                glm::vec3 p0 = position(result[i]), p1 = position(result[i+1]), p2 = position(result[i+2]);
+                glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+                float area = glm::length(cross);
+                if (area <= 0.0f) continue;
+                glm::vec3 normal = cross / area;
+
+                Quadric plane = Quadric::from_plane(normal.x, normal.y, normal.z, -glm::dot(normal, p0), area);
+                for (size_t k=0; k<3; ++k) quadrics[result[i+k]].add(plane);
+
+                for (size_t k=0; k<3; ++k) {
+                    Index a = result[i+k], b = result[i+(k+1)%3];
+                    if (edge_use[edge_key(a, b)] != 1) continue;
+
+                    glm::vec3 edge = position(b) - position(a);
+                    float edge_length = glm::length(edge);
+                    if (edge_length <= 0.0f) continue;
+                    glm::vec3 boundary_normal = glm::normalize(glm::cross(edge, normal));
+                    // Weighted heavily so boundary vertices only slide along the boundary
+                    Quadric boundary = Quadric::from_plane(boundary_normal.x, boundary_normal.y, boundary_normal.z, -glm::dot(boundary_normal, position(a)), 10.0 * edge_length * edge_length);
+                    quadrics[a].add(boundary);
+                    quadrics[b].add(boundary);
+                }
+            }
+        }
+
+        // Collapse edges in passes; every vertex can only take part in one collapse per pass so the
+        // adjacency (and the flip checks based on it) stay valid within a pass
+
+        std::vector<uint32_t> adjacency_offsets;
+        std::vector<uint32_t> adjacency;
+        std::vector<std::pair<Index, Index>> edges;
+        std::vector<Collapse> collapses;
+        std::vector<bool> touched(vertex_count);
+        std::vector<Index> remap(vertex_count);
+
+        while (result.size() > target_index_count) {
+            size_t triangle_count = result.size() / 3;
+
+            adjacency_offsets.assign(vertex_count + 1, 0);
+            for (Index v : result) adjacency_offsets[v+1]++;
+            for (size_t v=0; v<vertex_count; ++v) adjacency_offsets[v+1] += adjacency_offsets[v];
+            adjacency.resize(result.size());
+            std::vector<uint32_t> fill_offsets(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+            for (size_t t=0; t<triangle_count; ++t) {
+                for (size_t k=0; k<3; ++k) adjacency[fill_offsets[result[t*3+k]]++] = uint32_t(t);
+            }
+
+            // Cheapest direction of every edge
+
+            edges.clear();
+            for (size_t t=0; t<triangle_count; ++t) {
+                for (size_t k=0; k<3; ++k) {
+                    Index a = result[t*3+k], b = result[t*3+(k+1)%3];
+                    edges.push_back({std::min(a, b), std::max(a, b)});
+                }
+            }
+            std::sort(edges.begin(), edges.end());
+            edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+            collapses.clear();
+            for (auto[a, b] : edges) {
+                Quadric combined = quadrics[a];
+                combined.add(quadrics[b]);
+                double cost_ab = seam[a] ? HUGE_VAL : combined.error(position(b)); // Moving `a` onto `b`
+                double cost_ba = seam[b] ? HUGE_VAL : combined.error(position(a));
+                if (cost_ab == HUGE_VAL && cost_ba == HUGE_VAL) continue;
+                if (cost_ab <= cost_ba) collapses.push_back({a, b, cost_ab});
+                else collapses.push_back({b, a, cost_ba});
+            }
+            if (collapses.empty()) break;
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& lhs, const Collapse& rhs) { return lhs.cost < rhs.cost; });
+
+            std::fill(touched.begin(), touched.end(), false);
+            for (Index v=0; v<vertex_count; ++v) remap[v] = v;
+
+            size_t triangles_left = triangle_count;
+            size_t target_triangles = target_index_count / 3;
+            size_t collapsed = 0;
+
+            for (const Collapse& collapse : collapses) {
+                if (collapse.cost > max_error_squared) break;
+                if (triangles_left <= target_triangles) break;
+                if (touched[collapse.src] || touched[collapse.dst]) continue;
+
+                // Reject collapses that flip (or degenerate) any remaining triangle
+                glm::vec3 dst_position = position(collapse.dst);
+                bool flips = false;
+                size_t removed_triangles = 0;
+                for (uint32_t i=adjacency_offsets[collapse.src]; i<adjacency_offsets[collapse.src+1] && !flips; ++i) {
+                    uint32_t t = adjacency[i];
+                    Index t0 = result[t*3], t1 = result[t*3+1], t2 = result[t*3+2];
+                    if (t0 == collapse.dst || t1 == collapse.dst || t2 == collapse.dst) {
+                        removed_triangles++;
+                        continue;
+                    }
+
+                    glm::vec3 p0 = position(t0), p1 = position(t1), p2 = position(t2);
+                    glm::vec3 normal_before = glm::cross(p1 - p0, p2 - p0);
+                    if (t0 == collapse.src) p0 = dst_position;
+                    if (t1 == collapse.src) p1 = dst_position;
+                    if (t2 == collapse.src) p2 = dst_position;
+                    glm::vec3 normal_after = glm::cross(p1 - p0, p2 - p0);
+
+                    float after_length = glm::length(normal_after);
+                    if (after_length <= 0.0f || glm::dot(normal_before, normal_after) < 0.25f * glm::length(normal_before) * after_length)
+                        flips = true;
+                }
+                if (flips) continue;
+
+                remap[collapse.src] = collapse.dst;
+                quadrics[collapse.dst].add(quadrics[collapse.src]);
+                error_squared = std::max(error_squared, collapse.cost);
+                triangles_left -= std::min(triangles_left, removed_triangles);
+                collapsed++;
+
+                for (uint32_t i=adjacency_offsets[collapse.src]; i<adjacency_offsets[collapse.src+1]; ++i) {
+                    uint32_t t = adjacency[i];
+                    for (size_t k=0; k<3; ++k) touched[result[t*3+k]] = true;
+                }
+            }
+
+            if (collapsed == 0) break;
+
+            // Apply the collapses and drop the triangles that became degenerate
+
+            size_t write = 0;
+            for (size_t t=0; t<triangle_count; ++t) {
+                Index t0 = remap[result[t*3]], t1 = remap[result[t*3+1]], t2 = remap[result[t*3+2]];
+                if (t0 == t1 || t1 == t2 || t0 == t2) continue;
+                result[write++] = t0;
+                result[write++] = t1;
+                result[write++] = t2;
+            }
+            result.resize(write);
+        }
+
+        if (result_error) *result_error = float(std::sqrt(error_squared));
+        return result;
+    }
+
+    std::vector<Lod> generate_lods(const std::vector<Vertex>& vertices, const std::vector<Index>& indices, const LodOptions& options) {
+        std::vector<Lod> lods;
+        if (vertices.empty()) return lods;
+
+        VertexBounds bounds = VertexBounds::from_vertices(vertices);
+        float radius = glm::length(bounds.extent) * 0.5f;
+        float max_error = radius * options.max_relative_error;
+
+        const std::vector<Index>* previous_indices = &indices;
+        float previous_error = 0.0f;
+        for (uint32_t i=0; i<options.max_lods; ++i) {
+            size_t previous_triangles = previous_indices->size() / 3;
+            if (previous_triangles <= options.min_triangles) break;
+
+            size_t target_index_count = size_t(float(previous_triangles) * options.reduction) * 3;
+
+            // Every level is simplified from the previous one; the errors add up
+            float error = 0.0f;
+            std::vector<Index> lod_indices = simplify(vertices, *previous_indices, target_index_count, max_error - previous_error, &error);
+
+            // Not worth the memory if the simplifier got stuck (eg. on seams or at the error limit)
+            if (lod_indices.empty() || lod_indices.size() > previous_indices->size() * 9 / 10) break;
+
+            lods.push_back({std::move(lod_indices), previous_error + error});
+            previous_indices = &lods.back().indices;
+            previous_error = lods.back().error;
+        }
+
+        return lods;
+    }
+
+} // namespace mesh_util
+} // namespace aq
@@ -0,0 +1,103 @@
+#include "scene/aq_meshlet_builder.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace aq {
+namespace mesh_util {
+
+    namespace {
+        void compute_meshlet_bounds(Meshlet& meshlet, const std::vector<Vertex>& vertices, const std::vector<Index>& indices) {
+            // Sphere around the center of the meshlet's bounding box
+
+            glm::vec3 min_position(INFINITY);
+            glm::vec3 max_position(-INFINITY);
+            for (uint32_t i=meshlet.first_index; i<meshlet.first_index+meshlet.index_count; ++i) {
+                glm::vec3 position(vertices[indices[i]].position);
+                min_position = glm::min(min_position, position);
+                max_position = glm::max(max_position, position);
+            }
+            meshlet.center = (min_position + max_position) * 0.5f;
+
+            float radius_squared = 0.0f;
+            for (uint32_t i=meshlet.first_index; i<meshlet.first_index+meshlet.index_count; ++i) {
+                glm::vec3 offset = glm::vec3(vertices[indices[i]].position) - meshlet.center;
+                radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+            }
+            meshlet.radius = std::sqrt(radius_squared);
+
+            // Normal cone around the average triangle normal
+
+            std::vector<glm::vec3> normals;
+            normals.reserve(meshlet.index_count / 3);
+            glm::vec3 normal_sum(0.0f);
+            for (uint32_t i=meshlet.first_index; i<meshlet.first_index+meshlet.index_count; i+=3) {
+                glm::vec3 p0(vertices[indices[i]].position);
+                glm::vec3 p1(vertices[indices[i+1]].position);
+                glm::vec3 p2(vertices[indices[i+2]].position);
+                glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+                float length = glm::length(normal);
+                if (length <= 0.0f) continue; // Degenerate triangles are never visible
+                normals.push_back(normal / length);
+                normal_sum += normals.back();
+            }
+
+            meshlet.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+            meshlet.cone_cutoff = 1.0f;
+            float axis_length = glm::length(normal_sum);
+            if (normals.empty() || axis_length <= 0.0f) return;
+            meshlet.cone_axis = normal_sum / axis_length;
+
+            float min_dot = 1.0f;
+            for (const glm::vec3& normal : normals) min_dot = std::min(min_dot, glm::dot(normal, meshlet.cone_axis));
+
+            // Cones this wide (close to a hemisphere) would practically never be culled
+            if (min_dot <= 0.1f) return;
+            meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+        }
+    }
+
+    std::vector<Meshlet> build_meshlets(const std::vector<Vertex>& vertices, const std::vector<Index>& indices, uint32_t max_vertices, uint32_t max_triangles) {
+        std::vector<Meshlet> meshlets;
+        if (indices.empty()) return meshlets;
+
+        // `used_by[v]` is one more than the index of the last meshlet that used `v`
+        std::vector<uint32_t> used_by(vertices.size(), 0);
+
+        Meshlet meshlet{};
+        auto finish_meshlet = [&]() {
+            compute_meshlet_bounds(meshlet, vertices, indices);
+            meshlets.push_back(meshlet);
+
+            meshlet = Meshlet{};
+            meshlet.first_index = meshlets.back().first_index + meshlets.back().index_count;
+        };
+
+        for (size_t i=0; i<indices.size(); i+=3) {
+            uint32_t meshlet_id = uint32_t(meshlets.size()) + 1;
+            uint32_t new_vertices = 0;
+            for (size_t k=0; k<3; ++k) {
+                if (used_by[indices[i+k]] != meshlet_id) new_vertices++;
+            }
+            // Triangles with repeated vertices count a vertex twice; that only makes the meshlet slightly smaller
+
+            if (meshlet.vertex_count + new_vertices > max_vertices || meshlet.index_count / 3 + 1 > max_triangles) {
+                finish_meshlet();
+                meshlet_id++;
+            }
+
+            for (size_t k=0; k<3; ++k) {
+                if (used_by[indices[i+k]] != meshlet_id) {
+                    used_by[indices[i+k]] = meshlet_id;
+                    meshlet.vertex_count++;
+                }
+            }
+            meshlet.index_count += 3;
+        }
+        if (meshlet.index_count > 0) finish_meshlet();
+
+        return meshlets;
+    }
+
+} // namespace mesh_util
+} // namespace aq
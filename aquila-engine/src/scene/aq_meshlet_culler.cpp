@@ -0,0 +1,242 @@
+#include "scene/aq_meshlet_culler.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "util/vk_shaders.hpp"
+
+namespace aq {
+
+    MeshletCuller::MeshletCuller() {}
+
+    bool MeshletCuller::init(
+        vk::Device device,
+        vma::Allocator* allocator,
+        uint frame_overlap,
+        const char* shader_path,
+        DescriptorSetAllocator* descriptor_set_allocator,
+        FrameAllocator* frame_allocator
+    ) {
+        this->device = device;
+        this->allocator = allocator;
+        this->frame_overlap = frame_overlap;
+        this->descriptor_set_allocator = descriptor_set_allocator;
+        this->frame_allocator = frame_allocator;
+        frames.resize(frame_overlap);
+
+        // Meshlets, source indices, draws, commands and output indices
+        std::array<vk::DescriptorSetLayoutBinding, 5> bindings;
+        for (uint32_t i=0; i<bindings.size(); ++i)
+            bindings[i] = vk::DescriptorSetLayoutBinding(i, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute);
+
+        vk::Result cds_result;
+        std::tie(cds_result, set_layout) = device.createDescriptorSetLayout({{}, bindings});
+        CHECK_VK_RESULT_R(cds_result, false, "Failed to create meshlet culling set layout");
+
+        vk::PushConstantRange push_constant_range(vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullConstants));
+        vk::Result cpl_result;
+        std::tie(cpl_result, pipeline_layout) = device.createPipelineLayout({{}, set_layout, push_constant_range});
+        CHECK_VK_RESULT_R(cpl_result, false, "Failed to create meshlet culling pipeline layout");
+
+        vk::UniqueShaderModule cull_shader = load_shader_module_unique(shader_path, device);
+        if (!cull_shader) {
+            std::cerr << "Failed to load meshlet culling shader." << std::endl;
+            return false;
+        }
+
+        vk::ComputePipelineCreateInfo pipeline_create_info(
+            {},
+            {{}, vk::ShaderStageFlagBits::eCompute, *cull_shader, "main"},
+            pipeline_layout
+        );
+        auto[ccp_result, compute_pipeline] = device.createComputePipeline(nullptr, pipeline_create_info);
+        CHECK_VK_RESULT_R(ccp_result, false, "Failed to create meshlet culling pipeline");
+        pipeline = compute_pipeline;
+
+        return true;
+    }
+
+    void MeshletCuller::destroy() {
+        for (auto& frame : frames) {
+            frame.indices.destroy();
+            frame.commands.destroy();
+        }
+        frames.clear();
+
+        device.destroyPipeline(pipeline);
+        device.destroyPipelineLayout(pipeline_layout);
+        device.destroyDescriptorSetLayout(set_layout);
+    }
+
+    void MeshletCuller::next_frame(uint64_t frame_number) {
+        this->frame_number = frame_number;
+        frame_index = frame_number % frame_overlap;
+
+        draws.clear();
+        commands.clear();
+        max_meshlet_count = 0;
+        output_index_count = 0;
+    }
+
+    uint32_t MeshletCuller::add_draw(const Mesh& mesh, const glm::mat4& model, bool cone_culling) {
+        if (mesh.meshlet_count == 0 || mesh.meshlet_count > max_meshlets_per_draw) return UINT32_MAX;
+
+        float scale = std::max({glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))});
+
+        GPUMeshletDraw draw{};
+        draw.model = model;
+        draw.first_meshlet = mesh.first_meshlet;
+        draw.meshlet_count = mesh.meshlet_count;
+        draw.output_first_index = output_index_count;
+        draw.index_size = (uint32_t) get_index_size(mesh.index_type);
+        draw.scale = scale;
+        // Mirroring flips which side of a triangle is its front, so the normal cones don't hold
+        draw.cone_culling = cone_culling && glm::determinant(glm::mat3(model)) > 0.0f ? 1 : 0;
+        draws.push_back(draw);
+
+        // `indexCount` is counted up by the culling shader
+        commands.push_back(vk::DrawIndexedIndirectCommand(0, 1, output_index_count, mesh.vertex_offset, 0));
+
+        max_meshlet_count = std::max(max_meshlet_count, mesh.meshlet_count);
+        output_index_count += mesh.index_count; // Room for every meshlet being visible
+
+        return uint32_t(draws.size() - 1);
+    }
+
+    bool MeshletCuller::cull(vk::CommandBuffer cmd, const glm::mat4& view_projection, const glm::vec3& camera_position, GeometryArena* arena) {
+        if (draws.empty()) return true;
+
+        FrameBuffers& frame = frames[frame_index];
+        if (!reserve(frame, output_index_count, commands.size())) return false;
+
+        vk::DeviceSize draws_size = draws.size() * sizeof(GPUMeshletDraw);
+        vk::DeviceSize commands_size = commands.size() * sizeof(vk::DrawIndexedIndirectCommand);
+        FrameAllocator::Allocation draw_allocation = frame_allocator->allocate(draws_size);
+        FrameAllocator::Allocation command_allocation = frame_allocator->allocate(commands_size);
+        if (!draw_allocation.is_valid() || !command_allocation.is_valid()) return false;
+        memcpy(draw_allocation.data, draws.data(), draws_size);
+        memcpy(command_allocation.data, commands.data(), commands_size);
+
+        vk::DescriptorSet descriptor_set = descriptor_set_allocator->allocate_per_frame(frame_number, set_layout, {{vk::DescriptorType::eStorageBuffer, 5}});
+        if (!descriptor_set) return false;
+
+        // The arena's buffers may have been replaced since the last frame so the set is written every frame
+        std::array<vk::DescriptorBufferInfo, 5> buffer_infos{{
+            {arena->get_meshlet_buffer(), 0, VK_WHOLE_SIZE},
+            {arena->get_index_buffer(), 0, VK_WHOLE_SIZE},
+            {frame_allocator->get_buffer(), draw_allocation.offset, draws_size},
+            {frame.commands.buffer, 0, commands_size},
+            {frame.indices.buffer, 0, vk::DeviceSize(output_index_count) * sizeof(uint32_t)}
+        }};
+        std::array<vk::WriteDescriptorSet, 5> writes;
+        for (uint32_t i=0; i<writes.size(); ++i) {
+            writes[i] = vk::WriteDescriptorSet()
+                .setDstSet(descriptor_set)
+                .setDstBinding(i)
+                .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                .setBufferInfo(buffer_infos[i]);
+        }
+        device.updateDescriptorSets(writes, {});
+
+        // Reset the commands
+
+        cmd.copyBuffer(frame_allocator->get_buffer(), frame.commands.buffer, {vk::BufferCopy(command_allocation.offset, 0, commands_size)});
+
+        vk::MemoryBarrier reset_barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eComputeShader,
+            {}, // dependency flags
+            {reset_barrier}, {}, {}
+        );
+
+        // Cull; one workgroup per meshlet and one row of workgroups per draw
+
+        CullConstants cull_constants{extract_frustum_planes(view_projection), glm::vec4(camera_position, 1.0f)};
+
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline_layout, 0, {descriptor_set}, {});
+        cmd.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullConstants), &cull_constants);
+        cmd.dispatch(max_meshlet_count, uint32_t(draws.size()), 1);
+
+        vk::MemoryBarrier draw_barrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eIndexRead);
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexInput,
+            {}, // dependency flags
+            {draw_barrier}, {}, {}
+        );
+
+        return true;
+    }
+
+    void MeshletCuller::draw(vk::CommandBuffer cmd, uint32_t draw_index) {
+        cmd.drawIndexedIndirect(frames[frame_index].commands.buffer, draw_index * sizeof(vk::DrawIndexedIndirectCommand), 1, sizeof(vk::DrawIndexedIndirectCommand));
+    }
+
+    bool MeshletCuller::reserve(FrameBuffers& frame, vk::DeviceSize index_count, vk::DeviceSize command_count) {
+        // The frame's buffers were last used by the frame `frame_overlap` frames ago, which has finished,
+        // so they can be replaced right away
+
+        if (frame.index_capacity < index_count) {
+            frame.indices.destroy();
+            vk::DeviceSize capacity = std::max(index_count, frame.index_capacity * 2);
+
+            frame.indices.owner = MemoryOwner::Transient;
+            frame.index_capacity = 0;
+            if (!frame.indices.allocate(
+                allocator,
+                capacity * sizeof(uint32_t),
+                vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+                vma::MemoryUsage::eGpuOnly
+            )) {
+                std::cerr << "Failed to allocate meshlet culling index buffer." << std::endl;
+                return false;
+            }
+            frame.index_capacity = capacity;
+        }
+
+        if (frame.command_capacity < command_count) {
+            frame.commands.destroy();
+            vk::DeviceSize capacity = std::max(command_count, frame.command_capacity * 2);
+
+            frame.commands.owner = MemoryOwner::Transient;
+            frame.command_capacity = 0;
+            if (!frame.commands.allocate(
+                allocator,
+                capacity * sizeof(vk::DrawIndexedIndirectCommand),
+                vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                vma::MemoryUsage::eGpuOnly
+            )) {
+                std::cerr << "Failed to allocate meshlet culling command buffer." << std::endl;
+                return false;
+            }
+            frame.command_capacity = capacity;
+        }
+
+        return true;
+    }
+
+    std::array<glm::vec4, 6> MeshletCuller::extract_frustum_planes(const glm::mat4& view_projection) {
+        // "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix" by Gribb and Hartmann
+        // Clip space depth is [0, 1] so the near plane is just the third row
+        glm::vec4 row0(view_projection[0][0], view_projection[1][0], view_projection[2][0], view_projection[3][0]);
+        glm::vec4 row1(view_projection[0][1], view_projection[1][1], view_projection[2][1], view_projection[3][1]);
+        glm::vec4 row2(view_projection[0][2], view_projection[1][2], view_projection[2][2], view_projection[3][2]);
+        glm::vec4 row3(view_projection[0][3], view_projection[1][3], view_projection[2][3], view_projection[3][3]);
+
+        std::array<glm::vec4, 6> planes{{
+            row3 + row0, // Left
+            row3 - row0, // Right
+            row3 + row1, // Bottom (top with a flipped Y)
+            row3 - row1, // Top
+            row2, // Near
+            row3 - row2 // Far
+        }};
+        for (glm::vec4& plane : planes) plane /= glm::length(glm::vec3(plane));
+
+        return planes;
+    }
+
+}
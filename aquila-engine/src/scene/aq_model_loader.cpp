@@ -1,6 +1,15 @@
 #include "scene/aq_model_loader.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+
+#include "util/asset_cache.hpp"
+#include "util/thread_pool.hpp"
+#include "scene/aq_cooked_model.hpp"
+#include "scene/aq_texture_compressor.hpp"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -30,11 +39,137 @@ namespace aq {
         return glm::quat(from.w, from.x, from.y, from.z);
     }
 
-    ModelLoader::ModelLoader(std::string directory, std::string file) : directory(directory), file(file) {
+    namespace {
+        // Bump whenever importing, optimizing or LOD generation changes the result so cached models are processed again
+        constexpr uint64_t model_cache_version = 1;
+
+        template <typename T>
+        uint64_t combine_value(uint64_t key, const T& value) {
+            return AssetCache::combine(key, &value, sizeof(T));
+        }
+
+        // Hash of the model file and everything it is processed with, but not its textures (see `get_dependency_key`)
+        uint64_t get_model_key(
+            const std::string& path,
+            const mesh_util::OptimizationOptions& optimization_options,
+            const std::optional<mesh_util::LodOptions>& lod_options
+        ) {
+            uint64_t key = AssetCache::hash_file(path);
+            if (key == 0) return 0;
+
+            key = combine_value(key, optimization_options.weld);
+            key = combine_value(key, optimization_options.vertex_cache);
+            key = combine_value(key, optimization_options.overdraw);
+            key = combine_value(key, optimization_options.overdraw_threshold);
+            key = combine_value(key, optimization_options.vertex_fetch);
+            key = combine_value(key, lod_options.has_value());
+            if (lod_options) {
+                key = combine_value(key, lod_options->max_lods);
+                key = combine_value(key, lod_options->reduction);
+                key = combine_value(key, uint64_t(lod_options->min_triangles));
+                key = combine_value(key, lod_options->max_relative_error);
+            }
+            // Cached models reference BC textures only if the GPU could sample them when the model was cached
+            key = combine_value(key, texture_util::is_block_compression_supported());
+            key = AssetCache::combine(key, cooked_model::version);
+            return AssetCache::combine(key, model_cache_version);
+        }
+
+        // Mixes the contents of the texture files a model references into `model_key`
+        uint64_t get_dependency_key(uint64_t model_key, const std::vector<std::string>& dependencies) {
+            std::vector<uint64_t> hashes(dependencies.size());
+            ThreadPool::get_shared().parallel_for(dependencies.size(), [&](size_t i) {
+                hashes[i] = AssetCache::hash_file(dependencies[i]);
+            });
+
+            uint64_t key = model_key;
+            for (size_t i=0; i<dependencies.size(); ++i) {
+                key = AssetCache::combine(key, dependencies[i].data(), dependencies[i].size());
+                key = AssetCache::combine(key, hashes[i]);
+            }
+            return key;
+        }
+
+        // The manifest lists the texture files of a model, one path per line
+        constexpr const char* dependencies_extension = ".deps";
+
+        std::optional<std::vector<std::string>> read_dependencies(const AssetCache& cache, uint64_t model_key) {
+            std::ifstream file(cache.get_path(model_key, dependencies_extension));
+            if (!file) return std::nullopt;
+
+            std::vector<std::string> dependencies;
+            std::string line;
+            while (std::getline(file, line)) {
+                if (!line.empty()) dependencies.push_back(line);
+            }
+            return dependencies;
+        }
+
+        // Texture files referenced by `materials` (embedded textures are part of the model file), sorted
+        std::vector<std::string> get_dependencies(const std::vector<std::shared_ptr<Material>>& materials) {
+            std::vector<std::string> dependencies;
+            for (auto& material : materials) {
+                if (!material) continue;
+                for (auto& texture : material->textures) {
+                    if (texture && texture->get_embedded_data().empty()) dependencies.push_back(texture->get_path());
+                }
+            }
+            std::sort(dependencies.begin(), dependencies.end());
+            dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+            return dependencies;
+        }
+    }
+
+    ModelLoader::ModelLoader(
+        std::string directory,
+        std::string file,
+        const mesh_util::OptimizationOptions& optimization_options,
+        const std::optional<mesh_util::LodOptions>& lod_options
+    ) :
+        optimization_options(optimization_options), lod_options(lod_options), directory(directory), file(file)
+    {
         std::string path = directory + file;
 
+        std::shared_ptr<AssetCache> cache = AssetCache::get_shared();
+        uint64_t model_key = cache ? get_model_key(path, optimization_options, lod_options) : 0;
+        if (model_key != 0 && load_from_cache(*cache, model_key)) {
+            std::cout << "Loaded " << path << " from the asset cache" << std::endl;
+            return;
+        }
+
+        import_model(path);
+
+        if (model_key != 0 && root_node) {
+            std::vector<std::string> dependencies = get_dependencies(aq_materials);
+            uint64_t key = get_dependency_key(model_key, dependencies);
+            // The manifest goes last so it never points to a missing model
+            if (cooked_model::write_to_cache(*cache, key, root_node, aq_materials)) {
+                std::ostringstream manifest;
+                for (auto& dependency : dependencies) manifest << dependency << '\n';
+                std::string manifest_data = manifest.str();
+                cache->write(model_key, dependencies_extension, manifest_data.data(), manifest_data.size());
+            }
+        }
+    }
+
+    bool ModelLoader::load_from_cache(AssetCache& cache, uint64_t model_key) {
+        std::optional<std::vector<std::string>> dependencies = read_dependencies(cache, model_key);
+        if (!dependencies) return false;
+
+        uint64_t key = get_dependency_key(model_key, *dependencies);
+        if (!cache.contains(key, cooked_model::extension)) return false;
+
+        CookedModelLoader loader(cache.get_path(key, cooked_model::extension));
+        if (!loader.get_root_node()) return false;
+
+        root_node = loader.get_root_node();
+        aq_materials = loader.get_materials();
+        return true;
+    }
+
+    void ModelLoader::import_model(const std::string& path) {
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_RemoveRedundantMaterials);
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_RemoveRedundantMaterials);
 
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
             std::cerr << "Failed to load model: " << importer.GetErrorString() << std::endl;
@@ -43,6 +178,23 @@ namespace aq {
 
         aq_materials.resize(scene->mNumMaterials);
 
+        // Meshes are converted and optimized in parallel since that is where most of the time goes
+        // Everything touching shared state (materials, the hierarchy, the reports) happens afterwards on this
+        // thread in scene order so the result doesn't depend on the scheduling.
+        aq_meshes.resize(scene->mNumMeshes);
+        std::vector<mesh_util::OptimizationReport> reports(scene->mNumMeshes);
+        ThreadPool::get_shared().parallel_for(scene->mNumMeshes, [&](size_t i) {
+            aq_meshes[i] = process_mesh(scene->mMeshes[i], reports[i]);
+        });
+
+        optimization_reports.reserve(scene->mNumMeshes);
+        for (uint i=0; i<scene->mNumMeshes; ++i) {
+            std::shared_ptr<Mesh>& aq_mesh = aq_meshes[i];
+            optimization_reports.push_back({aq_mesh->name, std::move(reports[i])});
+
+            aq_mesh->material = process_material(scene->mMeshes[i]->mMaterialIndex, scene);
+        }
+
         root_node = process_node(scene->mRootNode, scene);
     }
 
@@ -51,9 +203,9 @@ namespace aq {
 
         aq_node->org_transform = ai_to_glm(ai_node->mTransformation);
 
+        // Nodes referencing the same `aiMesh` share the `Mesh`
         for (uint i=0; i<ai_node->mNumMeshes; ++i) {
-            aiMesh* ai_mesh = ai_scene->mMeshes[ai_node->mMeshes[i]];
-            aq_node->add_mesh(process_mesh(ai_mesh, ai_scene));
+            aq_node->add_mesh(aq_meshes[ai_node->mMeshes[i]]);
         }
 
         for (uint i=0; i<ai_node->mNumChildren; ++i) {
@@ -91,7 +243,7 @@ namespace aq {
         return false;
     }
 
-    std::shared_ptr<Mesh> ModelLoader::process_mesh(struct aiMesh* ai_mesh, const struct aiScene* ai_scene) {
+    std::shared_ptr<Mesh> ModelLoader::process_mesh(struct aiMesh* ai_mesh, mesh_util::OptimizationReport& report) {
         std::shared_ptr<Mesh> aq_mesh = std::make_shared<Mesh>(ai_mesh->mName.C_Str());
 
         // Load vertices
@@ -117,36 +269,48 @@ namespace aq {
             }
         }
 
-        // Load material
-        if (aq_materials[ai_mesh->mMaterialIndex]) {
-            aq_mesh->material = aq_materials[ai_mesh->mMaterialIndex];
-        } else {
-            aiMaterial* ai_material = ai_scene->mMaterials[ai_mesh->mMaterialIndex];
+        // Optimize for the vertex cache and vertex fetch
+        report = mesh_util::optimize_mesh(aq_mesh->vertices, aq_mesh->indices, optimization_options);
 
-            aq_mesh->material = std::make_shared<Material>(ai_material->GetName().C_Str());
-            aq_materials[ai_mesh->mMaterialIndex] = aq_mesh->material;
+        // Dense meshes are culled per meshlet
+        if (aq_mesh->indices.size() / 3 >= mesh_util::min_triangles_for_meshlets)
+            aq_mesh->build_meshlets();
 
-            aiColor3D color;
-            ai_material->Get(AI_MATKEY_COLOR_DIFFUSE, color);
-            aq_mesh->material->properties.albedo = glm::vec4(ai_to_glm(color), 0.0f);
+        if (lod_options)
+            aq_mesh->generate_lods(*lod_options);
 
-            if (!transfer_corresponding_texture(aiTextureType_BASE_COLOR, Material::Albedo, ai_material, aq_mesh->material, directory, file, ai_scene))
-                transfer_corresponding_texture(aiTextureType_DIFFUSE, Material::Albedo,     ai_material, aq_mesh->material, directory, file, ai_scene);
+        return aq_mesh;
+    }
 
-            if (!transfer_corresponding_texture(aiTextureType_DIFFUSE_ROUGHNESS, Material::Roughness, ai_material, aq_mesh->material, directory, file, ai_scene))
-                transfer_corresponding_texture(aiTextureType_SHININESS, Material::Roughness,          ai_material, aq_mesh->material, directory, file, ai_scene);
+    std::shared_ptr<Material> ModelLoader::process_material(uint material_index, const struct aiScene* ai_scene) {
+        if (aq_materials[material_index])
+            return aq_materials[material_index];
 
-            if (!transfer_corresponding_texture(aiTextureType_METALNESS, Material::Metalness, ai_material, aq_mesh->material, directory, file, ai_scene))
-                transfer_corresponding_texture(aiTextureType_SPECULAR, Material::Metalness,   ai_material, aq_mesh->material, directory, file, ai_scene);
+        aiMaterial* ai_material = ai_scene->mMaterials[material_index];
 
-            if (!transfer_corresponding_texture(aiTextureType_AMBIENT_OCCLUSION, Material::AmbientOcclusion, ai_material, aq_mesh->material, directory, file, ai_scene))
-                transfer_corresponding_texture(aiTextureType_AMBIENT, Material::AmbientOcclusion,            ai_material, aq_mesh->material, directory, file, ai_scene);
-            
-            if (!transfer_corresponding_texture(aiTextureType_NORMAL_CAMERA, Material::Normal, ai_material, aq_mesh->material, directory, file, ai_scene))
-                transfer_corresponding_texture(aiTextureType_NORMALS, Material::Normal,        ai_material, aq_mesh->material, directory, file, ai_scene);
-        }
+        std::shared_ptr<Material> aq_material = std::make_shared<Material>(ai_material->GetName().C_Str());
+        aq_materials[material_index] = aq_material;
 
-        return aq_mesh;
+        aiColor3D color;
+        ai_material->Get(AI_MATKEY_COLOR_DIFFUSE, color);
+        aq_material->properties.albedo = glm::vec4(ai_to_glm(color), 0.0f);
+
+        if (!transfer_corresponding_texture(aiTextureType_BASE_COLOR, Material::Albedo, ai_material, aq_material, directory, file, ai_scene))
+            transfer_corresponding_texture(aiTextureType_DIFFUSE, Material::Albedo,     ai_material, aq_material, directory, file, ai_scene);
+
+        if (!transfer_corresponding_texture(aiTextureType_DIFFUSE_ROUGHNESS, Material::Roughness, ai_material, aq_material, directory, file, ai_scene))
+            transfer_corresponding_texture(aiTextureType_SHININESS, Material::Roughness,          ai_material, aq_material, directory, file, ai_scene);
+
+        if (!transfer_corresponding_texture(aiTextureType_METALNESS, Material::Metalness, ai_material, aq_material, directory, file, ai_scene))
+            transfer_corresponding_texture(aiTextureType_SPECULAR, Material::Metalness,   ai_material, aq_material, directory, file, ai_scene);
+
+        if (!transfer_corresponding_texture(aiTextureType_AMBIENT_OCCLUSION, Material::AmbientOcclusion, ai_material, aq_material, directory, file, ai_scene))
+            transfer_corresponding_texture(aiTextureType_AMBIENT, Material::AmbientOcclusion,            ai_material, aq_material, directory, file, ai_scene);
+        
+        if (!transfer_corresponding_texture(aiTextureType_NORMAL_CAMERA, Material::Normal, ai_material, aq_material, directory, file, ai_scene))
+            transfer_corresponding_texture(aiTextureType_NORMALS, Material::Normal,        ai_material, aq_material, directory, file, ai_scene);
+
+        return aq_material;
     }
 
 }
\ No newline at end of file
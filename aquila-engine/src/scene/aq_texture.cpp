@@ -1,19 +1,37 @@
 #include "scene/aq_texture.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#include "util/asset_cache.hpp"
+#include "util/hash.hpp"
+#include "util/mapped_file.hpp"
+#include "util/thread_pool.hpp"
+#include "scene/aq_ktx2.hpp"
+#include "scene/aq_texture_compressor.hpp"
+
 namespace aq {
 
     Texture::Texture() {}
 
-    Texture::~Texture() { destroy(); }
+    Texture::~Texture() {
+        if (decoding.valid()) decoding.wait(); // Might still be reading `data`
+        destroy();
+    }
 
     void Texture::upload_later(std::string path) {
+        if (decoding.valid()) decoding.wait();
         this->path = path;
+        data.clear();
+        decoding = decode_async(path, nullptr);
     }
 
     void Texture::upload_later(std::string embedded_path, unsigned char* data, int width, int height, std::string format_hint) {
+        if (decoding.valid()) decoding.wait();
+        this->data.clear();
         this->path = embedded_path;
         size.width = width;
         size.height = height;
@@ -24,67 +42,183 @@ namespace aq {
 
         this->data.insert(std::end(this->data), &data[0], &data[data_size]);
         this->format_hint = format_hint;
+
+        // Raw embedded data is uploaded as is
+        if (height == 0) decoding = decode_async(embedded_path, &this->data);
     }
 
-    bool Texture::upload(vma::Allocator* allocator, const vk_util::UploadContext& upload_context) {
-        if (path.empty())
-            return false;
+    bool Texture::is_decoding() {
+        return decoding.valid() && decoding.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    }
 
-        if (data.empty()) {
-            return upload_from_file(path, allocator, upload_context);
-        } else { // Embedded Texture -- load from data
-            if (size.height == 0) { // Compressed (eg. png, jpg, etc.)
-                int texture_width, texture_height, nr_channels;
-                stbi_uc* pixels = stbi_load_from_memory(data.data(), size.width, &texture_width, &texture_height, &nr_channels, STBI_rgb_alpha);
-                if (!pixels) {
-                    std::cerr << "Failed to load image " << path << " from memory: " << stbi_failure_reason() << '\n';
-                    return false;
-                }
-                size.width = texture_width;
-                size.height = texture_height;
-                bool result = upload_from_data(pixels, size.width, size.height, allocator, upload_context);
-                stbi_image_free(pixels);
-                data.clear(); // the data is no longer needed
-                return result;
+    std::future<std::optional<texture_util::ImageData>> Texture::decode_async(std::string path, const std::vector<unsigned char>* source) {
+        return ThreadPool::get_shared().submit([path, source]() {
+            std::optional<texture_util::ImageData> image_data;
+            if (source) image_data = texture_util::load_image_from_memory(source->data(), source->size(), path);
+            else image_data = texture_util::load_image(path);
+            if (image_data) image_data->content_hash = texture_util::hash_image(*image_data); // Spares the main thread
+            return image_data;
+        });
+    }
+
+    bool Texture::decode() {
+        if (decoded_image) return true;
+        if (path.empty()) return false;
 
+        if (decoding.valid()) {
+            decoded_image = decoding.get();
+        } else if (data.empty()) {
+            decoded_image = texture_util::load_image(path);
+        } else { // Embedded Texture -- load from data
+            if (size.height == 0) { // Compressed (eg. png, jpg, etc.); only if it wasn't decoded already
+                decoded_image = texture_util::load_image_from_memory(data.data(), data.size(), path);
             } else {
                 // Hopefully RGBA8888 format
                 if (!format_hint.empty() && format_hint != "rgba8888")
                     std::cerr << "Unsupported format: " << format_hint << ". Loading as rgba8888. Expect malformed textures.\n";
-                return upload_from_data(data.data(), size.width, size.height, allocator, upload_context);
+                texture_util::ImageData raw_data;
+                raw_data.extent = size;
+                raw_data.levels.push_back({0, vk::DeviceSize(size.width) * size.height * 4});
+                raw_data.data = data.data();
+                decoded_image = texture_util::generate_mips(raw_data); // Copies `data`
             }
         }
+        data.clear(); // the data is no longer needed
+        if (!decoded_image) return false;
+
+        if (decoded_image->content_hash == 0) decoded_image->content_hash = texture_util::hash_image(*decoded_image);
+        content_hash = decoded_image->content_hash;
+        return true;
+    }
+
+    bool Texture::upload(UploadScheduler* upload_scheduler, uint32_t streamed_extent) {
+        if (!decode()) return false;
+        std::optional<texture_util::ImageData> image_data = std::move(decoded_image);
+        decoded_image.reset();
+
+        // Streaming decoded images would keep every level in memory for as long as the texture lives
+        if (streamed_extent == 0 || !image_data->mapped) return upload_from_image_data(*image_data, upload_scheduler);
+
+        streamed_image = std::move(image_data);
+        size = streamed_image->extent;
+        first_resident_level = get_level_for_extent(streamed_extent);
+        return upload_levels(*streamed_image, first_resident_level, upload_scheduler);
     }
 
-    bool Texture::upload_from_file(std::string path, vma::Allocator* allocator, const vk_util::UploadContext& upload_context) {
+    bool Texture::upload_from_file(std::string path, UploadScheduler* upload_scheduler) {
         this->path = path;
-        int texture_width, texture_height, nr_channels;
-        stbi_uc* pixels = stbi_load(path.c_str(), &texture_width, &texture_height, &nr_channels, STBI_rgb_alpha);
-        if (!pixels) {
-            std::cerr << "Failed to load texture file " << path << ": " << stbi_failure_reason() << '\n';
+        std::optional<texture_util::ImageData> image_data = texture_util::load_image(path);
+        if (!image_data) return false;
+        return upload_from_image_data(*image_data, upload_scheduler);
+    }
+
+    bool Texture::upload_from_data(void* data, int width, int height, UploadScheduler* upload_scheduler) {
+        texture_util::ImageData image_data;
+        image_data.extent = vk::Extent2D(width, height);
+        image_data.levels.push_back({0, vk::DeviceSize(width) * height * 4});
+        image_data.data = (const unsigned char*) data;
+
+        return upload_from_image_data(texture_util::generate_mips(image_data), upload_scheduler);
+    }
+
+    bool Texture::upload_from_image_data(const texture_util::ImageData& image_data, UploadScheduler* upload_scheduler) {
+        streamed_image.reset();
+        first_resident_level = 0;
+        return upload_levels(image_data, 0, upload_scheduler);
+    }
+
+    bool Texture::upload_levels(const texture_util::ImageData& image_data, uint32_t first_level, UploadScheduler* upload_scheduler) {
+        device = upload_scheduler->get_device();
+        size = image_data.extent;
+        vk::Extent2D level_extent(std::max(size.width >> first_level, 1u), std::max(size.height >> first_level, 1u));
+
+        // Levels aren't always stored from the largest to the smallest (eg. in KTX2 files)
+        vk::DeviceSize begin = VK_WHOLE_SIZE, end = 0;
+        for (size_t level=first_level; level<image_data.levels.size(); ++level) {
+            begin = std::min(begin, image_data.levels[level].offset);
+            end = std::max(end, image_data.levels[level].offset + image_data.levels[level].size);
+        }
+        std::vector<vk::DeviceSize> level_offsets;
+        for (size_t level=first_level; level<image_data.levels.size(); ++level)
+            level_offsets.push_back(image_data.levels[level].offset - begin);
+
+        // Creating an image in a format the GPU can't sample is invalid usage rather than an error
+        if (texture_util::is_block_compressed(image_data.format) && !texture_util::is_block_compression_supported()) {
+            std::cerr << "GPU doesn't support BC textures; can't upload " << path << " (" << vk::to_string(image_data.format) << ")" << std::endl;
             return false;
         }
-        bool result = upload_from_data(pixels, texture_width, texture_height, allocator, upload_context);
 
-        stbi_image_free(pixels);
+        image.owner = MemoryOwner::Texture;
+        if (!image.upload(
+            image_data.data + begin, end - begin,
+            image_data.format, level_extent, level_offsets,
+            upload_scheduler
+        )) return false;
 
-        return result;
+        return create_image_view();
     }
 
-    bool Texture::upload_from_data(void* data, int width, int height, vma::Allocator* allocator, const vk_util::UploadContext& upload_context) {
-        device = upload_context.device;
-        size.width = width;
-        size.height = height;
+    void Texture::clear_cpu_data() {
+        if (decoding.valid()) decoding.wait();
+        data.clear();
+        decoded_image.reset();
+    }
+
+    bool Texture::stream_levels(uint32_t first_level, UploadScheduler* upload_scheduler, RetirementQueue* retirement_queue) {
+        if (!streamed_image || first_level >= streamed_image->levels.size()) return false;
+        if (first_level == first_resident_level && is_uploaded()) return true;
+
+        AllocatedImage old_image = image;
+        vk::ImageView old_image_view = image_view;
+        image = AllocatedImage();
+        if (!upload_levels(*streamed_image, first_level, upload_scheduler)) {
+            image.destroy();
+            image = old_image;
+            image_view = old_image_view;
+            return false;
+        }
+        first_resident_level = first_level;
 
-        if (!image.upload(data, width, height, allocator, upload_context)) return false;
+        if (old_image.image) {
+            vk::Device device = this->device;
+            retirement_queue->retire([device, old_image, old_image_view]() mutable {
+                device.destroyImageView(old_image_view);
+                old_image.destroy();
+            });
+        }
+        return true;
+    }
+
+    uint32_t Texture::get_level_for_extent(uint32_t extent) {
+        uint32_t level = 0;
+        while (level + 1 < get_level_count() && std::max(size.width >> level, size.height >> level) > extent) ++level;
+        return level;
+    }
 
+    vk::DeviceSize Texture::get_streamed_size(uint32_t first_level) {
+        if (!streamed_image) return 0;
+        vk::DeviceSize streamed_size = 0;
+        for (size_t level=first_level; level<streamed_image->levels.size(); ++level)
+            streamed_size += streamed_image->levels[level].size;
+        return streamed_size;
+    }
+
+    bool Texture::image_moved(DeletionQueue& stale_resources) {
+        vk::Device device = this->device;
+        vk::ImageView old_image_view = image_view;
+        stale_resources.push_function([device, old_image_view]() { device.destroyImageView(old_image_view); });
+
+        return create_image_view();
+    }
+
+    bool Texture::create_image_view() {
         vk::ImageViewCreateInfo image_view_create_info(
             {},
             image.image,
             vk::ImageViewType::e2D,
-            vk::Format::eR8G8B8A8Unorm,
+            image.format,
             {vk::ComponentSwizzle::eIdentity, vk::ComponentSwizzle::eIdentity, vk::ComponentSwizzle::eIdentity, vk::ComponentSwizzle::eIdentity},
-            {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}
+            {vk::ImageAspectFlagBits::eColor, 0, image.mip_levels, 0, 1}
         );
 
         vk::Result civ_res;
@@ -94,10 +228,6 @@ namespace aq {
         return true;
     }
 
-    void Texture::clear_cpu_data() {
-        data.clear();
-    }
-
     void Texture::destroy() {
         image.destroy();
         if (device) {
@@ -114,4 +244,115 @@ namespace aq {
         );
     }
 
+
+    namespace texture_util {
+
+        namespace {
+            // Bump whenever decoding or `generate_mips` changes so cached images are decoded again
+            constexpr uint64_t decoded_image_cache_version = 1;
+
+            bool has_extension(const std::string& path, const std::string& extension) {
+                return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+            }
+
+            ImageData from_stbi(stbi_uc* pixels, int width, int height) {
+                ImageData image_data;
+                image_data.format = vk::Format::eR8G8B8A8Unorm;
+                image_data.extent = vk::Extent2D(width, height);
+                image_data.levels.push_back({0, vk::DeviceSize(width) * height * 4});
+                image_data.data = pixels;
+                image_data.storage = std::shared_ptr<const void>(pixels, stbi_image_free);
+                return generate_mips(image_data);
+            }
+        }
+
+        std::optional<ImageData> load_image(const std::string& path) {
+            if (has_extension(path, ".ktx2")) return read_ktx2(path);
+
+            std::shared_ptr<MappedFile> file = MappedFile::open(path);
+            if (!file) return std::nullopt;
+            return load_image_from_memory(file->data(), file->size(), path);
+        }
+
+        std::optional<ImageData> load_image_from_memory(const unsigned char* data, size_t size, const std::string& name) {
+            // Decoded images with their mip chains are cached by the hash of their encoded bytes
+            std::shared_ptr<AssetCache> cache = AssetCache::get_shared();
+            uint64_t key = 0;
+            if (cache) {
+                key = AssetCache::combine(xxhash64(data, size), decoded_image_cache_version);
+                if (cache->contains(key, ".ktx2")) {
+                    std::optional<ImageData> image_data = read_ktx2(cache->get_path(key, ".ktx2"));
+                    if (image_data) return image_data;
+                }
+            }
+
+            int width, height, nr_channels;
+            stbi_uc* pixels = stbi_load_from_memory(data, (int) size, &width, &height, &nr_channels, STBI_rgb_alpha);
+            if (!pixels) {
+                // `stbi_failure_reason` is thread local so it's reported here
+                std::cerr << "Failed to load image " << name << ": " << stbi_failure_reason() << '\n';
+                return std::nullopt;
+            }
+            ImageData image_data = from_stbi(pixels, width, height);
+
+            if (cache) {
+                std::string temporary_path = cache->get_temporary_path(key, ".ktx2");
+                if (write_ktx2(temporary_path, image_data)) cache->commit(temporary_path, key, ".ktx2");
+            }
+            return image_data;
+        }
+
+        uint64_t hash_image(const ImageData& image) {
+            if (image.levels.empty()) return 0;
+            uint32_t header[3] = {uint32_t(static_cast<VkFormat>(image.format)), image.extent.width, image.extent.height};
+            uint64_t hash = xxhash64(header, sizeof(header));
+            return xxhash64(image.data + image.levels[0].offset, image.levels[0].size, hash);
+        }
+
+        ImageData generate_mips(const ImageData& image) {
+            if (image.format != vk::Format::eR8G8B8A8Unorm || image.levels.size() != 1) return image;
+
+            ImageData mipmapped;
+            mipmapped.format = image.format;
+            mipmapped.extent = image.extent;
+
+            // Levels are 16 byte aligned to satisfy the buffer offset alignment of image copies
+            vk::DeviceSize size = 0;
+            for (uint32_t level=0; ; ++level) {
+                vk::Extent2D level_extent(std::max(image.extent.width >> level, 1u), std::max(image.extent.height >> level, 1u));
+                vk::DeviceSize level_size = vk::DeviceSize(level_extent.width) * level_extent.height * 4;
+                mipmapped.levels.push_back({size, level_size});
+                size = (size + level_size + 15) & ~vk::DeviceSize(15);
+                if (level_extent.width == 1 && level_extent.height == 1) break;
+            }
+            auto storage = std::make_shared<std::vector<unsigned char>>(size);
+            memcpy(storage->data(), image.data + image.levels[0].offset, mipmapped.levels[0].size);
+
+            for (uint32_t level=1; level<mipmapped.levels.size(); ++level) {
+                uint32_t src_width = std::max(image.extent.width >> (level-1), 1u);
+                uint32_t src_height = std::max(image.extent.height >> (level-1), 1u);
+                uint32_t dst_width = std::max(src_width / 2, 1u);
+                uint32_t dst_height = std::max(src_height / 2, 1u);
+                const unsigned char* src = storage->data() + mipmapped.levels[level-1].offset;
+                unsigned char* dst = storage->data() + mipmapped.levels[level].offset;
+
+                for (uint32_t y=0; y<dst_height; ++y) {
+                    const unsigned char* row0 = src + size_t(std::min(2*y, src_height-1)) * src_width * 4;
+                    const unsigned char* row1 = src + size_t(std::min(2*y+1, src_height-1)) * src_width * 4;
+                    for (uint32_t x=0; x<dst_width; ++x) {
+                        uint32_t x0 = std::min(2*x, src_width-1) * 4;
+                        uint32_t x1 = std::min(2*x+1, src_width-1) * 4;
+                        for (uint32_t c=0; c<4; ++c)
+                            dst[(size_t(y) * dst_width + x) * 4 + c] = (unsigned char) ((row0[x0+c] + row0[x1+c] + row1[x0+c] + row1[x1+c] + 2) / 4);
+                    }
+                }
+            }
+
+            mipmapped.data = storage->data();
+            mipmapped.storage = std::move(storage);
+            return mipmapped;
+        }
+
+    } // namespace texture_util
+
 }
\ No newline at end of file
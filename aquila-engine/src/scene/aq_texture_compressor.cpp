@@ -0,0 +1,470 @@
+#include "scene/aq_texture_compressor.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "util/thread_pool.hpp"
+
+namespace aq {
+namespace texture_util {
+
+    namespace {
+        template <int N>
+        float distance_squared(const float a[N], const float b[N]) {
+            float d = 0.0f;
+            for (int c=0; c<N; ++c) d += (a[c] - b[c]) * (a[c] - b[c]);
+            return d;
+        }
+
+        // Endpoints on the principal axis of the texels' distribution that span every texel's projection
+        template <int N>
+        void fit_principal_axis(const uint8_t texels[16][4], float endpoint0[N], float endpoint1[N]) {
+            float mean[N] = {};
+            for (int i=0; i<16; ++i)
+                for (int c=0; c<N; ++c) mean[c] += texels[i][c] / 16.0f;
+
+            float covariance[N][N] = {};
+            for (int i=0; i<16; ++i) {
+                for (int a=0; a<N; ++a)
+                    for (int b=0; b<N; ++b)
+                        covariance[a][b] += (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+            }
+
+            // Power iteration converges quickly enough for 16 points
+            float axis[N];
+            for (int c=0; c<N; ++c) axis[c] = 1.0f;
+            for (int iteration=0; iteration<8; ++iteration) {
+                float next[N] = {};
+                for (int a=0; a<N; ++a)
+                    for (int b=0; b<N; ++b) next[a] += covariance[a][b] * axis[b];
+                float length = 0.0f;
+                for (int c=0; c<N; ++c) length += next[c] * next[c];
+                length = std::sqrt(length);
+                if (length < 1e-6f) break; // Every texel is the same
+                for (int c=0; c<N; ++c) axis[c] = next[c] / length;
+            }
+
+            float t_min = 0.0f, t_max = 0.0f;
+            for (int i=0; i<16; ++i) {
+                float t = 0.0f;
+                for (int c=0; c<N; ++c) t += (texels[i][c] - mean[c]) * axis[c];
+                t_min = std::min(t_min, t);
+                t_max = std::max(t_max, t);
+            }
+            for (int c=0; c<N; ++c) {
+                endpoint0[c] = std::clamp(mean[c] + t_min * axis[c], 0.0f, 255.0f);
+                endpoint1[c] = std::clamp(mean[c] + t_max * axis[c], 0.0f, 255.0f);
+            }
+        }
+
+        // Least squares endpoints for texels interpolated with `weights` (0 is `endpoint0`, 1 is `endpoint1`)
+        // Returns false if the system is degenerate (eg. every texel uses the same weight)
+        template <int N>
+        bool refit_endpoints(const uint8_t texels[16][4], const float weights[16], float endpoint0[N], float endpoint1[N]) {
+            float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+            float ax[N] = {}, bx[N] = {};
+            for (int i=0; i<16; ++i) {
+                float b = weights[i], a = 1.0f - b;
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for (int c=0; c<N; ++c) {
+                    ax[c] += a * texels[i][c];
+                    bx[c] += b * texels[i][c];
+                }
+            }
+
+            float determinant = aa * bb - ab * ab;
+            if (std::abs(determinant) < 1e-6f) return false;
+            for (int c=0; c<N; ++c) {
+                endpoint0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+                endpoint1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+            }
+            return true;
+        }
+
+        // BC1
+
+        uint16_t to_565(const float color[3]) {
+            uint16_t r = uint16_t(std::lround(color[0] * 31.0f / 255.0f));
+            uint16_t g = uint16_t(std::lround(color[1] * 63.0f / 255.0f));
+            uint16_t b = uint16_t(std::lround(color[2] * 31.0f / 255.0f));
+            return uint16_t((r << 11) | (g << 5) | b);
+        }
+
+        void from_565(uint16_t color, float out[3]) {
+            uint32_t r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+            out[0] = float((r << 3) | (r >> 2));
+            out[1] = float((g << 2) | (g >> 4));
+            out[2] = float((b << 3) | (b >> 2));
+        }
+
+        // Always uses the four color mode (`color0 > color1`) so it's also valid as the color block of BC3
+        // Returns the squared error
+        float encode_bc1_endpoints(const uint8_t texels[16][4], uint16_t color0, uint16_t color1, uint8_t block[8], float weights[16]) {
+            if (color0 < color1) std::swap(color0, color1);
+
+            float palette[4][3];
+            from_565(color0, palette[0]);
+            from_565(color1, palette[1]);
+            for (int c=0; c<3; ++c) {
+                palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+                palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+            }
+            constexpr float palette_weights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+            uint32_t indices = 0;
+            float error = 0.0f;
+            for (int i=0; i<16; ++i) {
+                float texel[3] = {float(texels[i][0]), float(texels[i][1]), float(texels[i][2])};
+                uint32_t best_index = 0;
+                float best_distance = distance_squared<3>(texel, palette[0]);
+                // With equal endpoints the fourth color would be the three color mode's black
+                for (uint32_t p=1; p<(color0 == color1 ? 1u : 4u); ++p) {
+                    float distance = distance_squared<3>(texel, palette[p]);
+                    if (distance < best_distance) {
+                        best_distance = distance;
+                        best_index = p;
+                    }
+                }
+                indices |= best_index << (2 * i);
+                weights[i] = palette_weights[best_index];
+                error += best_distance;
+            }
+
+            block[0] = uint8_t(color0 & 0xFF);
+            block[1] = uint8_t(color0 >> 8);
+            block[2] = uint8_t(color1 & 0xFF);
+            block[3] = uint8_t(color1 >> 8);
+            memcpy(block + 4, &indices, 4); // Little endian
+            return error;
+        }
+
+        // BC4
+
+        void encode_bc4_endpoints(const uint8_t values[16], uint8_t block[8]) {
+            uint8_t value0 = *std::max_element(values, values + 16);
+            uint8_t value1 = *std::min_element(values, values + 16);
+
+            // `value0 > value1` selects the eight value mode
+            float palette[8] = {float(value0), float(value1)};
+            for (int p=2; p<8; ++p)
+                palette[p] = ((8 - p) * float(value0) + (p - 1) * float(value1)) / 7.0f;
+
+            uint64_t indices = 0;
+            for (int i=0; i<16; ++i) {
+                uint64_t best_index = 0;
+                float best_distance = std::abs(values[i] - palette[0]);
+                for (uint64_t p=1; p<(value0 == value1 ? 1u : 8u); ++p) {
+                    float distance = std::abs(values[i] - palette[p]);
+                    if (distance < best_distance) {
+                        best_distance = distance;
+                        best_index = p;
+                    }
+                }
+                indices |= best_index << (3 * i);
+            }
+
+            block[0] = value0;
+            block[1] = value1;
+            for (int b=0; b<6; ++b) block[2 + b] = uint8_t(indices >> (8 * b));
+        }
+
+        // BC7 (mode 6 only: one subset, 7 bit RGBA endpoints with a p-bit each and 4 bit indices)
+
+        constexpr uint32_t bc7_weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+        struct Bc7Mode6 {
+            uint8_t endpoints[2][4]; // 7 bits
+            uint8_t p_bits[2];
+            uint8_t indices[16];
+            float error;
+        };
+
+        // Finds the p-bits and indices for `endpoint0`/`endpoint1` with the least error
+        Bc7Mode6 quantize_bc7_mode6(const uint8_t texels[16][4], const float endpoint0[4], const float endpoint1[4]) {
+            Bc7Mode6 best;
+            best.error = INFINITY;
+
+            for (uint8_t p0=0; p0<2; ++p0) {
+                for (uint8_t p1=0; p1<2; ++p1) {
+                    Bc7Mode6 candidate;
+                    candidate.p_bits[0] = p0;
+                    candidate.p_bits[1] = p1;
+
+                    uint32_t unquantized[2][4];
+                    for (int c=0; c<4; ++c) {
+                        candidate.endpoints[0][c] = uint8_t(std::clamp(std::lround((endpoint0[c] - p0) / 2.0f), 0l, 127l));
+                        candidate.endpoints[1][c] = uint8_t(std::clamp(std::lround((endpoint1[c] - p1) / 2.0f), 0l, 127l));
+                        unquantized[0][c] = (uint32_t(candidate.endpoints[0][c]) << 1) | p0;
+                        unquantized[1][c] = (uint32_t(candidate.endpoints[1][c]) << 1) | p1;
+                    }
+
+                    float palette[16][4];
+                    for (int p=0; p<16; ++p)
+                        for (int c=0; c<4; ++c)
+                            palette[p][c] = float(((64 - bc7_weights[p]) * unquantized[0][c] + bc7_weights[p] * unquantized[1][c] + 32) >> 6);
+
+                    candidate.error = 0.0f;
+                    for (int i=0; i<16; ++i) {
+                        float texel[4] = {float(texels[i][0]), float(texels[i][1]), float(texels[i][2]), float(texels[i][3])};
+                        uint8_t best_index = 0;
+                        float best_distance = distance_squared<4>(texel, palette[0]);
+                        for (uint8_t p=1; p<16; ++p) {
+                            float distance = distance_squared<4>(texel, palette[p]);
+                            if (distance < best_distance) {
+                                best_distance = distance;
+                                best_index = p;
+                            }
+                        }
+                        candidate.indices[i] = best_index;
+                        candidate.error += best_distance;
+                    }
+
+                    if (candidate.error < best.error) best = candidate;
+                }
+            }
+
+            return best;
+        }
+
+        class BitWriter {
+        public:
+            BitWriter(uint8_t* bytes, size_t size) : bytes(bytes) { memset(bytes, 0, size); }
+
+            void write(uint32_t value, uint32_t bit_count) {
+                for (uint32_t b=0; b<bit_count; ++b, ++position)
+                    bytes[position / 8] |= uint8_t(((value >> b) & 1) << (position % 8));
+            }
+
+        private:
+            uint8_t* bytes;
+            uint32_t position = 0;
+        };
+
+        // Copies the 4x4 block at (`block_x`, `block_y`) out of an RGBA8 image, clamping at the edges
+        void load_block(const unsigned char* texels, vk::Extent2D extent, uint32_t block_x, uint32_t block_y, uint8_t block[16][4]) {
+            for (uint32_t y=0; y<4; ++y) {
+                uint32_t texel_y = std::min(block_y * 4 + y, extent.height - 1);
+                for (uint32_t x=0; x<4; ++x) {
+                    uint32_t texel_x = std::min(block_x * 4 + x, extent.width - 1);
+                    memcpy(block[y * 4 + x], texels + (size_t(texel_y) * extent.width + texel_x) * 4, 4);
+                }
+            }
+        }
+    }
+
+    namespace {
+        // Until an engine has checked its GPU, so offline cooking compresses
+        std::atomic<bool> block_compression_supported = true;
+    }
+
+    bool query_block_compression_support(vk::PhysicalDevice physical_device) {
+        bool supported = physical_device.getFeatures().textureCompressionBC;
+        for (vk::Format format : {
+            vk::Format::eBc1RgbUnormBlock, vk::Format::eBc3UnormBlock, vk::Format::eBc4UnormBlock,
+            vk::Format::eBc5UnormBlock, vk::Format::eBc7UnormBlock
+        }) {
+            if (!(physical_device.getFormatProperties(format).optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage))
+                supported = false;
+        }
+        block_compression_supported = supported;
+        if (!supported) std::cout << "GPU can't sample BC textures; textures are kept uncompressed" << std::endl;
+        return supported;
+    }
+
+    bool is_block_compression_supported() {
+        return block_compression_supported;
+    }
+
+    bool is_block_compressed(vk::Format format) {
+        switch (format) {
+        case vk::Format::eBc1RgbUnormBlock:
+        case vk::Format::eBc3UnormBlock:
+        case vk::Format::eBc4UnormBlock:
+        case vk::Format::eBc5UnormBlock:
+        case vk::Format::eBc7UnormBlock:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    vk::DeviceSize get_block_size(vk::Format format) {
+        switch (format) {
+        case vk::Format::eR8G8B8A8Unorm: return 4;
+        case vk::Format::eBc1RgbUnormBlock: return 8;
+        case vk::Format::eBc4UnormBlock: return 8;
+        case vk::Format::eBc3UnormBlock: return 16;
+        case vk::Format::eBc5UnormBlock: return 16;
+        case vk::Format::eBc7UnormBlock: return 16;
+        default: return 0;
+        }
+    }
+
+    vk::DeviceSize get_level_size(vk::Format format, vk::Extent2D extent) {
+        if (is_block_compressed(format))
+            return vk::DeviceSize((extent.width + 3) / 4) * ((extent.height + 3) / 4) * get_block_size(format);
+        return vk::DeviceSize(extent.width) * extent.height * get_block_size(format);
+    }
+
+    vk::Format choose_compressed_format(Material::TextureType type, bool has_alpha, bool high_quality) {
+        switch (type) {
+        case Material::Roughness:
+        case Material::Metalness:
+        case Material::AmbientOcclusion:
+            return vk::Format::eBc4UnormBlock;
+        case Material::Normal:
+            return vk::Format::eBc5UnormBlock;
+        case Material::Albedo:
+        default:
+            if (high_quality) return vk::Format::eBc7UnormBlock;
+            return has_alpha ? vk::Format::eBc3UnormBlock : vk::Format::eBc1RgbUnormBlock;
+        }
+    }
+
+    bool has_alpha(const ImageData& image) {
+        if (image.format != vk::Format::eR8G8B8A8Unorm || image.levels.empty()) return false;
+        const unsigned char* texels = image.data + image.levels[0].offset;
+        for (vk::DeviceSize i=3; i<image.levels[0].size; i+=4)
+            if (texels[i] != 255) return true;
+        return false;
+    }
+
+    std::optional<ImageData> compress(const ImageData& image, vk::Format format) {
+        if (image.format != vk::Format::eR8G8B8A8Unorm || image.levels.empty()) {
+            std::cerr << "Only RGBA8 images can be compressed." << std::endl;
+            return std::nullopt;
+        }
+
+        void (*encode_block)(const uint8_t[16][4], uint8_t*);
+        switch (format) {
+        case vk::Format::eBc1RgbUnormBlock: encode_block = encode_bc1_block; break;
+        case vk::Format::eBc3UnormBlock: encode_block = encode_bc3_block; break;
+        case vk::Format::eBc4UnormBlock:
+            encode_block = [](const uint8_t texels[16][4], uint8_t* block) {
+                uint8_t values[16];
+                for (int i=0; i<16; ++i) values[i] = texels[i][0];
+                encode_bc4_block(values, block);
+            };
+            break;
+        case vk::Format::eBc5UnormBlock: encode_block = encode_bc5_block; break;
+        case vk::Format::eBc7UnormBlock: encode_block = encode_bc7_block; break;
+        default:
+            std::cerr << "Unsupported texture compression format " << vk::to_string(format) << "." << std::endl;
+            return std::nullopt;
+        }
+
+        ImageData compressed;
+        compressed.format = format;
+        compressed.extent = image.extent;
+
+        // Levels are 16 byte aligned to satisfy the buffer offset alignment of image copies
+        vk::DeviceSize size = 0;
+        for (size_t level=0; level<image.levels.size(); ++level) {
+            vk::Extent2D level_extent(std::max(image.extent.width >> level, 1u), std::max(image.extent.height >> level, 1u));
+            vk::DeviceSize level_size = get_level_size(format, level_extent);
+            compressed.levels.push_back({size, level_size});
+            size = (size + level_size + 15) & ~vk::DeviceSize(15);
+        }
+        auto storage = std::make_shared<std::vector<unsigned char>>(size);
+
+        vk::DeviceSize block_size = get_block_size(format);
+        for (size_t level=0; level<image.levels.size(); ++level) {
+            vk::Extent2D level_extent(std::max(image.extent.width >> level, 1u), std::max(image.extent.height >> level, 1u));
+            uint32_t blocks_x = (level_extent.width + 3) / 4;
+            uint32_t blocks_y = (level_extent.height + 3) / 4;
+            const unsigned char* texels = image.data + image.levels[level].offset;
+            unsigned char* blocks = storage->data() + compressed.levels[level].offset;
+
+            ThreadPool::get_shared().parallel_for(blocks_y, [&](size_t block_y) {
+                uint8_t block_texels[16][4];
+                for (uint32_t block_x=0; block_x<blocks_x; ++block_x) {
+                    load_block(texels, level_extent, block_x, uint32_t(block_y), block_texels);
+                    encode_block(block_texels, blocks + (block_y * blocks_x + block_x) * block_size);
+                }
+            });
+        }
+
+        compressed.data = storage->data();
+        compressed.storage = std::move(storage);
+        return compressed;
+    }
+
+    void encode_bc1_block(const uint8_t texels[16][4], uint8_t block[8]) {
+        float endpoint0[3], endpoint1[3];
+        fit_principal_axis<3>(texels, endpoint0, endpoint1);
+
+        float weights[16];
+        float error = encode_bc1_endpoints(texels, to_565(endpoint1), to_565(endpoint0), block, weights);
+        if (error == 0.0f) return;
+
+        // One least squares pass with the chosen indices usually lowers the error noticeably
+        // `encode_bc1_endpoints` puts the larger endpoint first, which is what the weights refer to
+        uint8_t refit_block[8];
+        float refit_weights[16];
+        if (!refit_endpoints<3>(texels, weights, endpoint0, endpoint1)) return;
+        float refit_error = encode_bc1_endpoints(texels, to_565(endpoint0), to_565(endpoint1), refit_block, refit_weights);
+        if (refit_error < error) memcpy(block, refit_block, 8);
+    }
+
+    void encode_bc3_block(const uint8_t texels[16][4], uint8_t block[16]) {
+        uint8_t alpha[16];
+        for (int i=0; i<16; ++i) alpha[i] = texels[i][3];
+        encode_bc4_block(alpha, block);
+        encode_bc1_block(texels, block + 8);
+    }
+
+    void encode_bc4_block(const uint8_t values[16], uint8_t block[8]) {
+        encode_bc4_endpoints(values, block);
+    }
+
+    void encode_bc5_block(const uint8_t texels[16][4], uint8_t block[16]) {
+        uint8_t red[16], green[16];
+        for (int i=0; i<16; ++i) {
+            red[i] = texels[i][0];
+            green[i] = texels[i][1];
+        }
+        encode_bc4_block(red, block);
+        encode_bc4_block(green, block + 8);
+    }
+
+    void encode_bc7_block(const uint8_t texels[16][4], uint8_t block[16]) {
+        float endpoint0[4], endpoint1[4];
+        fit_principal_axis<4>(texels, endpoint0, endpoint1);
+        Bc7Mode6 mode6 = quantize_bc7_mode6(texels, endpoint0, endpoint1);
+
+        if (mode6.error > 0.0f) {
+            float weights[16];
+            for (int i=0; i<16; ++i) weights[i] = bc7_weights[mode6.indices[i]] / 64.0f;
+            if (refit_endpoints<4>(texels, weights, endpoint0, endpoint1)) {
+                Bc7Mode6 refit = quantize_bc7_mode6(texels, endpoint0, endpoint1);
+                if (refit.error < mode6.error) mode6 = refit;
+            }
+        }
+
+        // The first index is stored without its top bit so it has to be below 8
+        if (mode6.indices[0] >= 8) {
+            std::swap(mode6.endpoints[0], mode6.endpoints[1]);
+            std::swap(mode6.p_bits[0], mode6.p_bits[1]);
+            for (auto& index : mode6.indices) index = 15 - index;
+        }
+
+        BitWriter writer(block, 16);
+        writer.write(1 << 6, 7); // Mode 6
+        for (int c=0; c<4; ++c) {
+            writer.write(mode6.endpoints[0][c], 7);
+            writer.write(mode6.endpoints[1][c], 7);
+        }
+        writer.write(mode6.p_bits[0], 1);
+        writer.write(mode6.p_bits[1], 1);
+        writer.write(mode6.indices[0], 3);
+        for (int i=1; i<16; ++i) writer.write(mode6.indices[i], 4);
+    }
+
+} // namespace texture_util
+} // namespace aq
@@ -1,35 +1,118 @@
 #include "scene/aq_vertex.hpp"
 
+#include <cstring>
+
+#include <glm/gtc/packing.hpp>
+
 namespace aq {
 
     Vertex::Vertex(glm::vec4 position, glm::vec4 normal, glm::vec2 tex_coord)
     : position(position), normal(normal), tex_coord(tex_coord) {}
 
     Vertex::InputDescription Vertex::get_vertex_description() {
-        vk::VertexInputBindingDescription main_binding(0, sizeof(Vertex), vk::VertexInputRate::eVertex);
+        return VertexInputDescription<Vertex>::get();
+    }
 
-        vk::VertexInputAttributeDescription position_attribute(
-            0, // location
-            0, // binding
-            vk::Format::eR32G32B32A32Sfloat,
-            offsetof(Vertex, position)
-        );
+    VertexBounds VertexBounds::from_vertices(const std::vector<Vertex>& vertices) {
+        if (vertices.empty()) return {};
 
-        vk::VertexInputAttributeDescription normal_attribute(
-            1, // location
-            0, // binding
-            vk::Format::eR32G32B32A32Sfloat,
-            offsetof(Vertex, normal)
-        );
+        glm::vec3 min_position(vertices[0].position);
+        glm::vec3 max_position(vertices[0].position);
+        for (auto& vertex : vertices) {
+            min_position = glm::min(min_position, glm::vec3(vertex.position));
+            max_position = glm::max(max_position, glm::vec3(vertex.position));
+        }
+        return {min_position, max_position - min_position};
+    }
 
-        vk::VertexInputAttributeDescription color_attribute(
-            2, // location
-            0, // binding
-            vk::Format::eR32G32Sfloat,
-            offsetof(Vertex, tex_coord)
+    // Octahedral encoding from "A Survey of Efficient Representations for Independent Unit Vectors" (Cigolle et al. 2014)
+    glm::i16vec2 encode_octahedral(glm::vec3 normal) {
+        float l1_norm = glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+        if (l1_norm == 0.0f) return glm::i16vec2(0);
+
+        glm::vec2 p = glm::vec2(normal) / l1_norm;
+        if (normal.z < 0.0f) {
+            glm::vec2 sign_not_zero(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+            p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * sign_not_zero;
+        }
+        return glm::packSnorm<int16_t>(p);
+    }
+
+    glm::vec3 decode_octahedral(glm::i16vec2 encoded) {
+        glm::vec2 e = glm::unpackSnorm<float>(encoded);
+        glm::vec3 normal(e, 1.0f - glm::abs(e.x) - glm::abs(e.y));
+        float t = glm::max(-normal.z, 0.0f);
+        normal.x += normal.x >= 0.0f ? -t : t;
+        normal.y += normal.y >= 0.0f ? -t : t;
+        return glm::normalize(normal);
+    }
+
+    CompactVertex VertexLayout<CompactVertex>::pack(const Vertex& vertex, const VertexBounds&) {
+        return CompactVertex{
+            glm::vec3(vertex.position),
+            encode_octahedral(glm::vec3(vertex.normal)),
+            glm::packHalf(vertex.tex_coord)
+        };
+    }
+
+    QuantizedVertex VertexLayout<QuantizedVertex>::pack(const Vertex& vertex, const VertexBounds& bounds) {
+        // Flat axes (eg. a plane) have no extent; every vertex is at the minimum
+        glm::vec3 inverse_extent(
+            bounds.extent.x > 0.0f ? 1.0f / bounds.extent.x : 0.0f,
+            bounds.extent.y > 0.0f ? 1.0f / bounds.extent.y : 0.0f,
+            bounds.extent.z > 0.0f ? 1.0f / bounds.extent.z : 0.0f
         );
+        glm::vec3 normalized_position = (glm::vec3(vertex.position) - bounds.min) * inverse_extent;
+
+        return QuantizedVertex{
+            glm::packUnorm<uint16_t>(glm::vec4(normalized_position, 1.0f)),
+            encode_octahedral(glm::vec3(vertex.normal)),
+            glm::packHalf(vertex.tex_coord)
+        };
+    }
+
+    namespace {
+        template <typename V>
+        std::vector<unsigned char> pack_vertices_as(const std::vector<Vertex>& vertices, const VertexBounds& bounds) {
+            std::vector<unsigned char> data(vertices.size() * sizeof(V));
+            for (size_t i=0; i<vertices.size(); ++i) {
+                V packed_vertex = VertexLayout<V>::pack(vertices[i], bounds);
+                memcpy(data.data() + i*sizeof(V), &packed_vertex, sizeof(V));
+            }
+            return data;
+        }
+    }
+
+    std::vector<unsigned char> pack_vertices(VertexFormat format, const std::vector<Vertex>& vertices, const VertexBounds& bounds) {
+        switch (format) {
+            case VertexFormat::Compact: return pack_vertices_as<CompactVertex>(vertices, bounds);
+            case VertexFormat::Quantized: return pack_vertices_as<QuantizedVertex>(vertices, bounds);
+            default: return pack_vertices_as<Vertex>(vertices, bounds);
+        }
+    }
+
+    vk::DeviceSize get_vertex_size(VertexFormat format) {
+        switch (format) {
+            case VertexFormat::Compact: return sizeof(CompactVertex);
+            case VertexFormat::Quantized: return sizeof(QuantizedVertex);
+            default: return sizeof(Vertex);
+        }
+    }
+
+    Vertex::InputDescription get_vertex_description(VertexFormat format) {
+        switch (format) {
+            case VertexFormat::Compact: return VertexInputDescription<CompactVertex>::get();
+            case VertexFormat::Quantized: return VertexInputDescription<QuantizedVertex>::get();
+            default: return VertexInputDescription<Vertex>::get();
+        }
+    }
 
-        return InputDescription{{main_binding}, {position_attribute, normal_attribute, color_attribute}};
+    const char* get_vertex_shader(VertexFormat format) {
+        switch (format) {
+            case VertexFormat::Compact: return VertexLayout<CompactVertex>::vertex_shader;
+            case VertexFormat::Quantized: return VertexLayout<QuantizedVertex>::vertex_shader;
+            default: return VertexLayout<Vertex>::vertex_shader;
+        }
     }
 
-}
\ No newline at end of file
+}
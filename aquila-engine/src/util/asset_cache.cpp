@@ -0,0 +1,100 @@
+#include "util/asset_cache.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+#include "util/hash.hpp"
+#include "util/mapped_file.hpp"
+
+namespace aq {
+
+    namespace {
+        std::mutex shared_cache_mutex;
+        std::shared_ptr<AssetCache> shared_cache;
+    }
+
+    AssetCache::AssetCache(const std::string& directory) : directory(directory) {
+        if (!this->directory.empty() && this->directory.back() != '/' && this->directory.back() != '\\')
+            this->directory += '/';
+
+        std::error_code error;
+        std::filesystem::create_directories(this->directory, error);
+        if (error) std::cerr << "Failed to create asset cache directory " << this->directory << ": " << error.message() << std::endl;
+    }
+
+    std::shared_ptr<AssetCache> AssetCache::get_shared() {
+        std::lock_guard<std::mutex> lock(shared_cache_mutex);
+        return shared_cache;
+    }
+
+    void AssetCache::set_shared(std::shared_ptr<AssetCache> cache) {
+        std::lock_guard<std::mutex> lock(shared_cache_mutex);
+        shared_cache = std::move(cache);
+    }
+
+    uint64_t AssetCache::hash_file(const std::string& path) {
+        std::shared_ptr<MappedFile> file = MappedFile::open(path);
+        if (!file) return 0;
+        return xxhash64(file->data(), file->size());
+    }
+
+    uint64_t AssetCache::combine(uint64_t key, uint64_t value) {
+        return xxhash64(&value, sizeof(value), key);
+    }
+
+    uint64_t AssetCache::combine(uint64_t key, const void* data, size_t size) {
+        return xxhash64(data, size, key);
+    }
+
+    std::string AssetCache::get_path(uint64_t key, const std::string& extension) const {
+        char name[17];
+        snprintf(name, sizeof(name), "%016llx", (unsigned long long) key);
+        return directory + name + extension;
+    }
+
+    bool AssetCache::contains(uint64_t key, const std::string& extension) const {
+        std::error_code error;
+        return std::filesystem::is_regular_file(get_path(key, extension), error);
+    }
+
+    bool AssetCache::write(uint64_t key, const std::string& extension, const void* data, size_t size) {
+        std::string temporary_path = get_temporary_path(key, extension);
+        {
+            std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+            out.write((const char*) data, size);
+            if (!out) {
+                std::cerr << "Failed to write " << temporary_path << "." << std::endl;
+                return false;
+            }
+        }
+        return commit(temporary_path, key, extension);
+    }
+
+    std::string AssetCache::get_temporary_path(uint64_t key, const std::string& extension) {
+        // Unique across threads (the counter) and processes sharing the directory (the random token)
+        static const uint64_t process_token = (uint64_t(std::random_device{}()) << 32) | std::random_device{}();
+        static std::atomic<uint64_t> counter{0};
+        std::ostringstream suffix;
+        suffix << ".tmp" << std::hex << process_token << '-' << counter++;
+        return get_path(key, extension) + suffix.str();
+    }
+
+    bool AssetCache::commit(const std::string& temporary_path, uint64_t key, const std::string& extension) {
+        std::error_code error;
+        std::filesystem::rename(temporary_path, get_path(key, extension), error);
+        if (!error) return true;
+
+        // Someone else (eg. another thread or process) stored the entry first; entries with the same key are interchangeable
+        bool exists = contains(key, extension);
+        std::filesystem::remove(temporary_path, error);
+        if (!exists) std::cerr << "Failed to store " << get_path(key, extension) << " in the asset cache." << std::endl;
+        return exists;
+    }
+
+}
@@ -0,0 +1,87 @@
+#include "util/hash.hpp"
+
+namespace aq {
+
+    namespace {
+        constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+        constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+        constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+        constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+        constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+        uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+        // Little endian like the reference implementation
+        uint64_t read64(const unsigned char* p) {
+            uint64_t v = 0;
+            for (int i=7; i>=0; --i) v = (v << 8) | p[i];
+            return v;
+        }
+        uint32_t read32(const unsigned char* p) {
+            return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+        }
+
+        uint64_t round(uint64_t acc, uint64_t input) {
+            acc += input * prime2;
+            acc = rotl(acc, 31);
+            return acc * prime1;
+        }
+
+        uint64_t merge_round(uint64_t acc, uint64_t value) {
+            acc ^= round(0, value);
+            return acc * prime1 + prime4;
+        }
+    }
+
+    uint64_t xxhash64(const void* data, size_t size, uint64_t seed) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        const unsigned char* end = p + size;
+        uint64_t hash;
+
+        if (size >= 32) {
+            uint64_t v1 = seed + prime1 + prime2;
+            uint64_t v2 = seed + prime2;
+            uint64_t v3 = seed;
+            uint64_t v4 = seed - prime1;
+            do {
+                v1 = round(v1, read64(p)); p += 8;
+                v2 = round(v2, read64(p)); p += 8;
+                v3 = round(v3, read64(p)); p += 8;
+                v4 = round(v4, read64(p)); p += 8;
+            } while (end - p >= 32);
+
+            hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+            hash = merge_round(hash, v1);
+            hash = merge_round(hash, v2);
+            hash = merge_round(hash, v3);
+            hash = merge_round(hash, v4);
+        } else {
+            hash = seed + prime5;
+        }
+        hash += uint64_t(size);
+
+        while (end - p >= 8) {
+            hash ^= round(0, read64(p));
+            hash = rotl(hash, 27) * prime1 + prime4;
+            p += 8;
+        }
+        if (end - p >= 4) {
+            hash ^= uint64_t(read32(p)) * prime1;
+            hash = rotl(hash, 23) * prime2 + prime3;
+            p += 4;
+        }
+        while (p < end) {
+            hash ^= uint64_t(*p) * prime5;
+            hash = rotl(hash, 11) * prime1;
+            ++p;
+        }
+
+        hash ^= hash >> 33;
+        hash *= prime2;
+        hash ^= hash >> 29;
+        hash *= prime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+}
@@ -0,0 +1,91 @@
+#include "util/mapped_file.hpp"
+
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace aq {
+
+#ifdef _WIN32
+
+    std::shared_ptr<MappedFile> MappedFile::open(const std::string& path) {
+        std::shared_ptr<MappedFile> file(new MappedFile());
+
+        file->file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file->file_handle == INVALID_HANDLE_VALUE) {
+            file->file_handle = nullptr;
+            std::cerr << "Failed to open " << path << " for mapping." << std::endl;
+            return nullptr;
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file->file_handle, &size) || size.QuadPart == 0) {
+            std::cerr << "Failed to get the size of " << path << " (or it is empty)." << std::endl;
+            return nullptr;
+        }
+        file->mapping_size = (size_t) size.QuadPart;
+
+        file->mapping_handle = CreateFileMappingA(file->file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!file->mapping_handle) {
+            std::cerr << "Failed to map " << path << "." << std::endl;
+            return nullptr;
+        }
+        file->mapping = (const unsigned char*) MapViewOfFile(file->mapping_handle, FILE_MAP_READ, 0, 0, 0);
+        if (!file->mapping) {
+            std::cerr << "Failed to map " << path << "." << std::endl;
+            return nullptr;
+        }
+
+        return file;
+    }
+
+    MappedFile::~MappedFile() {
+        if (mapping) UnmapViewOfFile(mapping);
+        if (mapping_handle) CloseHandle(mapping_handle);
+        if (file_handle) CloseHandle(file_handle);
+    }
+
+#else
+
+    std::shared_ptr<MappedFile> MappedFile::open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Failed to open " << path << " for mapping." << std::endl;
+            return nullptr;
+        }
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+            std::cerr << "Failed to get the size of " << path << " (or it is empty)." << std::endl;
+            close(fd);
+            return nullptr;
+        }
+
+        void* mapping = mmap(nullptr, (size_t) file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // The mapping keeps its own reference to the file
+        if (mapping == MAP_FAILED) {
+            std::cerr << "Failed to map " << path << "." << std::endl;
+            return nullptr;
+        }
+
+        std::shared_ptr<MappedFile> file(new MappedFile());
+        file->mapping = (const unsigned char*) mapping;
+        file->mapping_size = (size_t) file_stat.st_size;
+        return file;
+    }
+
+    MappedFile::~MappedFile() {
+        if (mapping) munmap((void*) mapping, mapping_size);
+    }
+
+#endif
+
+}
@@ -0,0 +1,93 @@
+#include "util/thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+namespace aq {
+
+    ThreadPool::ThreadPool(uint thread_count) {
+        if (thread_count == 0) {
+            uint core_count = std::thread::hardware_concurrency(); // 0 if unknown
+            thread_count = std::max(core_count, 2u) - 1;
+        }
+
+        workers.reserve(thread_count);
+        for (uint i=0; i<thread_count; ++i)
+            workers.emplace_back(&ThreadPool::work, this);
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        task_available.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    ThreadPool& ThreadPool::get_shared() {
+        static ThreadPool shared_pool;
+        return shared_pool;
+    }
+
+    void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& func) {
+        if (count == 0) return;
+
+        // Indices are claimed one at a time so uneven work (eg. meshes of very different sizes) balances itself
+        // Helpers that start after every index has been claimed return right away; the state is shared
+        // since they can outlive this call.
+        struct State {
+            std::atomic<size_t> next_index{0};
+            size_t finished_count = 0;
+            std::mutex mutex;
+            std::condition_variable all_finished;
+        };
+        auto state = std::make_shared<State>();
+
+        auto run = [state, count, &func]() {
+            size_t finished = 0;
+            for (size_t i = state->next_index++; i < count; i = state->next_index++) {
+                func(i);
+                ++finished;
+            }
+            if (finished > 0) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished_count += finished;
+                if (state->finished_count == count) state->all_finished.notify_all();
+            }
+        };
+
+        // `func` is only called for claimed indices, which are all finished before this returns,
+        // so late helpers never touch it
+        size_t helper_count = std::min(count - 1, workers.size());
+        for (size_t i=0; i<helper_count; ++i)
+            enqueue(run);
+        run();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->all_finished.wait(lock, [&]() { return state->finished_count == count; });
+    }
+
+    void ThreadPool::enqueue(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        task_available.notify_one();
+    }
+
+    void ThreadPool::work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                task_available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return; // Stopping and nothing left to do
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+}
@@ -0,0 +1,297 @@
+#include "util/vk_defragmentation.hpp"
+
+#include <array>
+#include <algorithm>
+#include <iostream>
+
+namespace aq {
+
+    DefragmentationService::DefragmentationService() {}
+
+    bool DefragmentationService::init(
+        vma::Allocator* allocator,
+        vk::Device device,
+        UploadScheduler* upload_scheduler,
+        uint64_t frame_overlap,
+        vk::DeviceSize max_bytes_per_pass,
+        uint32_t max_moves_per_pass,
+        uint64_t auto_start_period
+    ) {
+        this->allocator = allocator;
+        this->device = device;
+        this->upload_scheduler = upload_scheduler;
+        this->frame_overlap = frame_overlap;
+        this->max_bytes_per_pass = max_bytes_per_pass;
+        this->max_moves_per_pass = max_moves_per_pass;
+        this->auto_start_period = auto_start_period;
+        return true;
+    }
+
+    void DefragmentationService::destroy() {
+        if (pass_pending) end_pass();
+        if (running) finish();
+        registrations.clear();
+    }
+
+    void DefragmentationService::register_buffer(AllocatedBuffer* buffer, vk::DeviceSize size, vk::BufferUsageFlags usage, std::function<void(DeletionQueue&)>&& on_moved) {
+        Registration registration{};
+        registration.buffer = buffer;
+        registration.size = size;
+        registration.usage = usage;
+        registration.on_moved = on_moved;
+        registrations[static_cast<VmaAllocation>(buffer->allocation)] = registration;
+        buffer->defragmentation_service = this;
+    }
+
+    void DefragmentationService::register_image(AllocatedImage* image, std::function<void(DeletionQueue&)>&& on_moved) {
+        Registration registration{};
+        registration.image = image;
+        registration.on_moved = on_moved;
+        registrations[static_cast<VmaAllocation>(image->allocation)] = registration;
+        image->defragmentation_service = this;
+    }
+
+    void DefragmentationService::release(vma::Allocation allocation) {
+        auto it = registrations.find(static_cast<VmaAllocation>(allocation));
+        if (it == registrations.end()) return;
+
+        if (pass_pending) {
+            for (uint32_t i=0; i<pass_info.moveCount; ++i) {
+                vma::DefragmentationMove& move = pass_info.pMoves[i];
+                if (move.srcAllocation == allocation && move.operation == vma::DefragmentationMoveOperation::eCopy) {
+                    CHECK_VK_RESULT(device.waitIdle(), "Failed to wait for device to idle");
+                    end_pass();
+                    break;
+                }
+            }
+        }
+
+        registrations.erase(it);
+    }
+
+    void DefragmentationService::start() {
+        if (running) return;
+
+        vma::DefragmentationInfo defragmentation_info{};
+        defragmentation_info.maxBytesPerPass = max_bytes_per_pass;
+        defragmentation_info.maxAllocationsPerPass = max_moves_per_pass;
+
+        vk::Result bd_result = allocator->beginDefragmentation(&defragmentation_info, &context);
+        if (bd_result != vk::Result::eSuccess) {
+            std::cerr << "Failed to begin defragmentation" << std::endl;
+            return;
+        }
+        running = true;
+    }
+
+    void DefragmentationService::update(uint64_t frame_number, vk::CommandBuffer cmd) {
+        if (!running) {
+            if (auto_start_period == 0 || frame_number < last_run_frame + auto_start_period) return;
+            last_run_frame = frame_number;
+            start();
+            if (!running) return;
+        }
+
+        if (pass_pending) {
+            // The frames that could still be using the old resources have to finish first
+            if (frame_number < pass_frame + frame_overlap) return;
+            end_pass();
+            if (!running) return;
+        }
+
+        begin_pass(frame_number, cmd);
+    }
+
+    void DefragmentationService::begin_pass(uint64_t frame_number, vk::CommandBuffer cmd) {
+        pass_info = vma::DefragmentationPassMoveInfo{};
+        vk::Result bdp_result = allocator->beginDefragmentationPass(context, &pass_info);
+        if (bdp_result == vk::Result::eSuccess) { // Nothing (left) to move
+            finish();
+            return;
+        }
+        if (bdp_result != vk::Result::eIncomplete) {
+            CHECK_VK_RESULT(bdp_result, "Failed to begin defragmentation pass");
+            finish();
+            return;
+        }
+
+        for (uint32_t i=0; i<pass_info.moveCount; ++i) {
+            vma::DefragmentationMove& move = pass_info.pMoves[i];
+
+            // Only registered resources can be moved; their owners are the only ones who know the handles
+            auto it = registrations.find(static_cast<VmaAllocation>(move.srcAllocation));
+            bool moved = false;
+            if (it != registrations.end()) {
+                if (it->second.buffer) moved = move_buffer(it->second, move);
+                else moved = move_image(it->second, move, cmd);
+            }
+            if (!moved) move.operation = vma::DefragmentationMoveOperation::eIgnore;
+        }
+
+        pass_pending = true;
+        pass_frame = frame_number;
+    }
+
+    void DefragmentationService::end_pass() {
+        stale_resources.flush();
+
+        // Moved allocations now refer to their new memory and the old memory is freed
+        vk::Result edp_result = allocator->endDefragmentationPass(context, &pass_info);
+        pass_pending = false;
+        if (edp_result != vk::Result::eIncomplete) {
+            CHECK_VK_RESULT(edp_result, "Failed to end defragmentation pass");
+            finish();
+        }
+    }
+
+    void DefragmentationService::finish() {
+        vma::DefragmentationStats defragmentation_stats{};
+        allocator->endDefragmentation(context, &defragmentation_stats);
+        running = false;
+
+        stats.bytes_moved += defragmentation_stats.bytesMoved;
+        stats.bytes_reclaimed += defragmentation_stats.bytesFreed;
+        stats.allocations_moved += defragmentation_stats.allocationsMoved;
+        stats.device_memory_blocks_freed += defragmentation_stats.deviceMemoryBlocksFreed;
+        stats.runs++;
+    }
+
+    bool DefragmentationService::move_buffer(Registration& registration, vma::DefragmentationMove& move) {
+        AllocatedBuffer* buffer = registration.buffer;
+        if (!(buffer->allocation == move.srcAllocation)) return false; // The owner has replaced the buffer since registering it
+
+        // Create the new buffer in the memory VMA chose
+
+        const std::vector<uint32_t>& queue_families = upload_scheduler->get_queue_families();
+        vk::BufferCreateInfo buffer_create_info = vk::BufferCreateInfo()
+            .setSize(registration.size)
+            .setUsage(registration.usage)
+            .setSharingMode(vk::SharingMode::eExclusive);
+        if (queue_families.size() > 1) {
+            buffer_create_info
+                .setSharingMode(vk::SharingMode::eConcurrent)
+                .setQueueFamilyIndices(queue_families);
+        }
+
+        auto[cb_result, new_buffer] = device.createBuffer(buffer_create_info);
+        CHECK_VK_RESULT_R(cb_result, false, "Failed to create buffer for defragmentation");
+        vk::Result bbm_result = allocator->bindBufferMemory(move.dstTmpAllocation, new_buffer);
+        if (bbm_result != vk::Result::eSuccess) {
+            CHECK_VK_RESULT(bbm_result, "Failed to bind buffer memory for defragmentation");
+            device.destroyBuffer(new_buffer);
+            return false;
+        }
+
+        // Copy on the upload queue so the copy is ordered with uploads into the old buffer
+
+        vk::Buffer old_buffer = buffer->buffer;
+        vk::DeviceSize size = registration.size;
+        upload_scheduler->record([old_buffer, new_buffer, size](vk::CommandBuffer cmd) {
+            cmd.copyBuffer(old_buffer, new_buffer, {vk::BufferCopy(0, 0, size)});
+        });
+
+        buffer->buffer = new_buffer;
+        vk::Device device = this->device;
+        stale_resources.push_function([device, old_buffer]() { device.destroyBuffer(old_buffer); });
+        if (registration.on_moved) registration.on_moved(stale_resources);
+
+        return true;
+    }
+
+    bool DefragmentationService::move_image(Registration& registration, vma::DefragmentationMove& move, vk::CommandBuffer cmd) {
+        AllocatedImage* image = registration.image;
+        if (!(image->allocation == move.srcAllocation)) return false;
+
+        // Create the new image in the memory VMA chose
+
+        const std::vector<uint32_t>& queue_families = upload_scheduler->get_queue_families();
+        vk::ImageCreateInfo image_create_info = vk::ImageCreateInfo()
+            .setImageType(vk::ImageType::e2D)
+            .setFormat(image->format)
+            .setExtent(image->extent)
+            .setMipLevels(image->mip_levels)
+            .setArrayLayers(1)
+            .setSamples(vk::SampleCountFlagBits::e1)
+            .setTiling(vk::ImageTiling::eOptimal)
+            .setUsage(image->usage);
+        if (queue_families.size() > 1) {
+            image_create_info
+                .setSharingMode(vk::SharingMode::eConcurrent)
+                .setQueueFamilyIndices(queue_families);
+        }
+
+        auto[ci_result, new_image] = device.createImage(image_create_info);
+        CHECK_VK_RESULT_R(ci_result, false, "Failed to create image for defragmentation");
+        vk::Result bim_result = allocator->bindImageMemory(move.dstTmpAllocation, new_image);
+        if (bim_result != vk::Result::eSuccess) {
+            CHECK_VK_RESULT(bim_result, "Failed to bind image memory for defragmentation");
+            device.destroyImage(new_image);
+            return false;
+        }
+
+        // Copy on the graphics queue; the old image may be read by earlier frames so its layout can only
+        // be changed after them, which a barrier in this frame's command buffer guarantees
+
+        vk::ImageSubresourceRange subresource_range(vk::ImageAspectFlagBits::eColor, 0, image->mip_levels, 0, 1);
+
+        std::array<vk::ImageMemoryBarrier, 2> transfer_barriers{
+            vk::ImageMemoryBarrier()
+                .setDstAccessMask(vk::AccessFlagBits::eTransferRead)
+                .setOldLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+                .setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+                .setImage(image->image)
+                .setSubresourceRange(subresource_range),
+            vk::ImageMemoryBarrier()
+                .setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+                .setOldLayout(vk::ImageLayout::eUndefined)
+                .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+                .setImage(new_image)
+                .setSubresourceRange(subresource_range)
+        };
+
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eTransfer,
+            {}, // dependency flags
+            {}, {}, // memory and buffer-memory barriers
+            transfer_barriers
+        );
+
+        std::vector<vk::ImageCopy> copies;
+        for (uint32_t mip_level=0; mip_level<image->mip_levels; ++mip_level) {
+            vk::ImageSubresourceLayers subresource(vk::ImageAspectFlagBits::eColor, mip_level, 0, 1);
+            vk::Extent3D mip_extent(
+                std::max(image->extent.width >> mip_level, 1u),
+                std::max(image->extent.height >> mip_level, 1u),
+                1
+            );
+            copies.push_back(vk::ImageCopy(subresource, {0,0,0}, subresource, {0,0,0}, mip_extent));
+        }
+        cmd.copyImage(image->image, vk::ImageLayout::eTransferSrcOptimal, new_image, vk::ImageLayout::eTransferDstOptimal, copies);
+
+        vk::ImageMemoryBarrier read_barrier = vk::ImageMemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+            .setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+            .setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+            .setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+            .setImage(new_image)
+            .setSubresourceRange(subresource_range);
+
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eFragmentShader,
+            {}, // dependency flags
+            {}, {}, // memory and buffer-memory barriers
+            {read_barrier}
+        );
+
+        vk::Image old_image = image->image;
+        image->image = new_image;
+        vk::Device device = this->device;
+        stale_resources.push_function([device, old_image]() { device.destroyImage(old_image); });
+        if (registration.on_moved) registration.on_moved(stale_resources);
+
+        return true;
+    }
+
+}
@@ -1,53 +1,153 @@
 #include "util/vk_descriptor_set_builder.hpp"
 
+#include <algorithm>
+
 namespace aq {
 
+    // Pools are never made bigger than this many sets
+    static constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+    const std::vector<DescriptorSetAllocator::PoolSizeRatio> DescriptorSetAllocator::default_pool_size_ratios{{
+        {vk::DescriptorType::eUniformBuffer, 1.0f},
+        {vk::DescriptorType::eUniformBufferDynamic, 1.0f},
+        {vk::DescriptorType::eStorageBuffer, 2.0f},
+        {vk::DescriptorType::eSampler, 0.5f},
+        {vk::DescriptorType::eSampledImage, 4.0f},
+        {vk::DescriptorType::eCombinedImageSampler, 4.0f}
+    }};
+
     DescriptorSetAllocator::DescriptorSetAllocator() {}
 
-    void DescriptorSetAllocator::init(vk::Device device) {
+    void DescriptorSetAllocator::init(vk::Device device, uint frame_overlap, const std::vector<PoolSizeRatio>& pool_size_ratios) {
         this->device = device;
+        this->pool_size_ratios = pool_size_ratios;
+        frame_pools.resize(frame_overlap);
     }
 
     void DescriptorSetAllocator::destroy() {
         for (auto& pool : descriptor_pools)
             device.destroyDescriptorPool(pool);
         descriptor_pools.clear();
+
+        long_lived_pools = Pools{};
+        for (auto& pools : frame_pools) pools = Pools{};
     }
 
-    vk::DescriptorPool DescriptorSetAllocator::new_pool(const std::vector<vk::DescriptorPoolSize>& pool_sizes) {
-        vk::DeviceSize total_pool_size = 0;
-        for (auto& pool_size : pool_sizes) total_pool_size += pool_size.descriptorCount;
-        vk::DescriptorPoolCreateInfo desc_pool_create_info({}, total_pool_size, pool_sizes);
+    vk::DescriptorSet DescriptorSetAllocator::allocate(vk::DescriptorSetLayout layout, const std::vector<vk::DescriptorPoolSize>& required_sizes) {
+        return allocate_from(long_lived_pools, layout, required_sizes);
+    }
+
+    vk::DescriptorSet DescriptorSetAllocator::allocate_per_frame(uint64_t frame_number, vk::DescriptorSetLayout layout, const std::vector<vk::DescriptorPoolSize>& required_sizes) {
+        return allocate_from(frame_pools[frame_number % frame_pools.size()], layout, required_sizes);
+    }
+
+    void DescriptorSetAllocator::next_frame(uint64_t frame_number) {
+        reset(frame_pools[frame_number % frame_pools.size()]);
+    }
+
+    vk::DescriptorPool DescriptorSetAllocator::new_pool(const std::vector<vk::DescriptorPoolSize>& pool_sizes, uint32_t max_sets) {
+        if (max_sets == 0) {
+            for (auto& pool_size : pool_sizes) max_sets += pool_size.descriptorCount;
+        }
+        vk::DescriptorPoolCreateInfo desc_pool_create_info({}, max_sets, pool_sizes);
 
         auto[result, descriptor_pool] = device.createDescriptorPool(desc_pool_create_info);
-        CHECK_VK_RESULT(result, "Failed to create descriptor pool");
+        CHECK_VK_RESULT_R(result, nullptr, "Failed to create descriptor pool");
 
         descriptor_pools.push_back(descriptor_pool);
         return descriptor_pool;
     }
 
+    vk::DescriptorSet DescriptorSetAllocator::allocate_from(Pools& pools, vk::DescriptorSetLayout layout, const std::vector<vk::DescriptorPoolSize>& required_sizes) {
+        vk::DescriptorPool pool = get_pool(pools);
+        if (!pool) return nullptr;
+
+        vk::DescriptorSetAllocateInfo ds_allocate_info(pool, 1, &layout);
+        vk::DescriptorSet descriptor_set;
+        vk::Result ads_result = device.allocateDescriptorSets(&ds_allocate_info, &descriptor_set);
+
+        if (ads_result == vk::Result::eErrorOutOfPoolMemory || ads_result == vk::Result::eErrorFragmentedPool) {
+            // Retry in a fresh pool
+            pools.full_pools.push_back(pool);
+            pool = get_pool(pools);
+            if (!pool) return nullptr;
+
+            ds_allocate_info.setDescriptorPool(pool);
+            ads_result = device.allocateDescriptorSets(&ds_allocate_info, &descriptor_set);
+
+            if ((ads_result == vk::Result::eErrorOutOfPoolMemory || ads_result == vk::Result::eErrorFragmentedPool) && !required_sizes.empty()) {
+                // The set is bigger than a whole pool; give it a pool of its own
+                pools.ready_pools.push_back(pool);
+                pool = new_pool(required_sizes, 1);
+                if (!pool) return nullptr;
+
+                ds_allocate_info.setDescriptorPool(pool);
+                ads_result = device.allocateDescriptorSets(&ds_allocate_info, &descriptor_set);
+                pools.full_pools.push_back(pool);
+                CHECK_VK_RESULT_R(ads_result, nullptr, "Failed to allocate descriptor set");
+                return descriptor_set;
+            }
+        }
+
+        if (ads_result != vk::Result::eSuccess) {
+            // Don't hand out a pool the set didn't fit in again; it's reset with the others
+            pools.full_pools.push_back(pool);
+            std::cerr << "Failed to allocate descriptor set: " << int(ads_result) << std::endl;
+            return nullptr;
+        }
+
+        pools.ready_pools.push_back(pool);
+        return descriptor_set;
+    }
+
+    vk::DescriptorPool DescriptorSetAllocator::get_pool(Pools& pools) {
+        if (!pools.ready_pools.empty()) {
+            vk::DescriptorPool pool = pools.ready_pools.back();
+            pools.ready_pools.pop_back();
+            return pool;
+        }
+
+        std::vector<vk::DescriptorPoolSize> pool_sizes;
+        for (auto& pool_size_ratio : pool_size_ratios) {
+            uint32_t descriptor_count = std::max(uint32_t(pool_size_ratio.ratio * pools.sets_per_pool), 1u);
+            pool_sizes.push_back({pool_size_ratio.type, descriptor_count});
+        }
+        vk::DescriptorPool pool = new_pool(pool_sizes, pools.sets_per_pool);
+
+        // Grow the next pool so the number of pools stays small
+        pools.sets_per_pool = std::min(pools.sets_per_pool * 2, MAX_SETS_PER_POOL);
+
+        return pool;
+    }
+
+    void DescriptorSetAllocator::reset(Pools& pools) {
+        for (auto& pool : pools.ready_pools)
+            device.resetDescriptorPool(pool);
+        for (auto& pool : pools.full_pools) {
+            device.resetDescriptorPool(pool);
+            pools.ready_pools.push_back(pool);
+        }
+        pools.full_pools.clear();
+    }
+
 
     DescriptorSetBuilder::DescriptorSetBuilder(DescriptorSetAllocator* descriptor_set_allocator, vk::Device device, uint multiplicity) : descriptor_set_allocator(descriptor_set_allocator), device(device), multiplicity(multiplicity) {}
 
     DescriptorSetBuilder& DescriptorSetBuilder::add_binding(vk::DescriptorSetLayoutBinding binding) {
         bindings.push_back(binding);
-        pool_sizes.push_back({binding.descriptorType, multiplicity * binding.descriptorCount});
+        pool_sizes.push_back({binding.descriptorType, binding.descriptorCount}); // Descriptors needed by one set
         return *this;
     }
 
     std::vector<vk::DescriptorSet> DescriptorSetBuilder::build() {
-        vk::DescriptorPool descriptor_pool = descriptor_set_allocator->new_pool(pool_sizes);
-
         vk::DescriptorSetLayoutCreateInfo ds_layout_create_info({}, bindings);
         auto[cdsl_res, descriptor_set_layout] = device.createDescriptorSetLayout(ds_layout_create_info);
         CHECK_VK_RESULT(cdsl_res, "Failed to create descriptor set layout");
         layout = descriptor_set_layout;
 
-        std::vector<vk::DescriptorSetLayout> descriptor_set_layouts(multiplicity, descriptor_set_layout);
-        vk::DescriptorSetAllocateInfo ds_allocate_info(descriptor_pool, descriptor_set_layouts);
-
-        auto[ads_res, descriptor_sets] = device.allocateDescriptorSets(ds_allocate_info);
-        CHECK_VK_RESULT(ads_res, "Failed to allocate descriptor sets");
+        std::vector<vk::DescriptorSet> descriptor_sets;
+        for (uint i=0; i<multiplicity; ++i)
+            descriptor_sets.push_back(descriptor_set_allocator->allocate(layout, pool_sizes));
 
         return descriptor_sets;
     }
@@ -0,0 +1,68 @@
+#include "util/vk_frame_allocator.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "util/vk_utility.hpp"
+
+namespace aq {
+
+    FrameAllocator::FrameAllocator() {}
+
+    bool FrameAllocator::init(vma::Allocator* allocator, uint frame_overlap, vk::DeviceSize frame_size, const vk::PhysicalDeviceLimits& limits) {
+        this->allocator = allocator;
+        this->frame_overlap = frame_overlap;
+        // Both alignments are powers of two so the larger one satisfies both
+        alignment = std::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment);
+        this->frame_size = vk_util::pad_uniform_buffer_size(frame_size, alignment);
+
+        buffer.owner = MemoryOwner::Transient;
+        if (!buffer.allocate(
+            allocator,
+            this->frame_size * frame_overlap,
+            // Transfer source so initial values can be copied into device local buffers (eg. indirect commands)
+            vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc,
+            vma::MemoryUsage::eCpuToGpu,
+            vk::MemoryPropertyFlagBits::eHostCoherent
+        )) return false;
+
+        auto[mm_result, buff_mem] = allocator->mapMemory(buffer.allocation);
+        CHECK_VK_RESULT_R(mm_result, false, "Failed to map frame allocator memory");
+        p_buffer_memory = (unsigned char*) buff_mem;
+
+        frame_offset = 0;
+        offset = 0;
+
+        return true;
+    }
+
+    void FrameAllocator::destroy() {
+        if (p_buffer_memory) {
+            allocator->unmapMemory(buffer.allocation);
+            p_buffer_memory = nullptr;
+        }
+        buffer.destroy();
+    }
+
+    void FrameAllocator::next_frame(uint64_t frame_number) {
+        frame_offset = frame_size * (frame_number % frame_overlap);
+        offset = frame_offset;
+    }
+
+    FrameAllocator::Allocation FrameAllocator::allocate(vk::DeviceSize size) {
+        Allocation allocation{};
+        vk::DeviceSize padded_size = vk_util::pad_uniform_buffer_size(size, alignment);
+        if (offset + padded_size > frame_offset + frame_size) {
+            std::cerr << "Frame allocator is out of space (" << frame_size << " bytes per frame)" << std::endl;
+            return allocation;
+        }
+
+        allocation.data = p_buffer_memory + offset;
+        allocation.offset = (uint32_t) offset;
+        allocation.size = size;
+        offset += padded_size;
+
+        return allocation;
+    }
+
+}
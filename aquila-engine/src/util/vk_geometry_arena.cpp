@@ -0,0 +1,149 @@
+#include "util/vk_geometry_arena.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace aq {
+
+    SuballocatedBuffer::SuballocatedBuffer() {}
+
+    bool SuballocatedBuffer::init(vma::Allocator* allocator, vk::DeviceSize initial_size, vk::BufferUsageFlags usage, UploadScheduler* upload_scheduler, RetirementQueue* retirement_queue, MemoryOwner owner) {
+        this->upload_scheduler = upload_scheduler;
+        this->retirement_queue = retirement_queue;
+
+        buffer.set_owner(owner);
+        if (!buffer.allocate(allocator, initial_size, usage, vma::MemoryUsage::eGpuOnly, {}, upload_scheduler->get_queue_families())) return false;
+
+        auto[cvb_result, block] = vma::createVirtualBlock(vma::VirtualBlockCreateInfo(initial_size));
+        CHECK_VK_RESULT_R(cvb_result, false, "Failed to create virtual block");
+        chunks.push_back({0, block});
+
+        return true;
+    }
+
+    void SuballocatedBuffer::destroy() {
+        for (auto& chunk : chunks) {
+            chunk.block.clearVirtualBlock();
+            chunk.block.destroy();
+        }
+        chunks.clear();
+        buffer.destroy();
+    }
+
+    SuballocatedBuffer::Allocation SuballocatedBuffer::allocate(vk::DeviceSize size, vk::DeviceSize alignment) {
+        Allocation allocation{};
+        allocation.size = size;
+        if (size == 0) return allocation;
+
+        // VMA only supports power of two alignments (eg. not vertex strides) and aligns relative to the chunk,
+        // whose offset (`grow`'s old size) can be anything, so the allocation is padded and its offset rounded up instead
+        vk::DeviceSize virtual_size = alignment > 1 ? size + alignment - 1 : size;
+        auto align_offset = [alignment](vk::DeviceSize offset) {
+            return alignment > 1 ? (offset + alignment - 1) / alignment * alignment : offset;
+        };
+
+        vma::VirtualAllocationCreateInfo alloc_create_info(virtual_size, 1);
+
+        for (uint32_t i=0; i<chunks.size(); ++i) {
+            vk::DeviceSize offset;
+            vk::Result va_result = chunks[i].block.virtualAllocate(&alloc_create_info, &allocation.virtual_allocation, &offset);
+            if (va_result == vk::Result::eSuccess) {
+                allocation.chunk = i;
+                allocation.offset = align_offset(chunks[i].offset + offset);
+                return allocation;
+            }
+        }
+
+        // Nothing fits; grow the buffer and allocate from the new chunk
+        if (!grow(virtual_size)) return allocation;
+
+        vk::DeviceSize offset;
+        vk::Result va_result = chunks.back().block.virtualAllocate(&alloc_create_info, &allocation.virtual_allocation, &offset);
+        CHECK_VK_RESULT_R(va_result, allocation, "Failed to suballocate from grown buffer");
+        allocation.chunk = chunks.size() - 1;
+        allocation.offset = align_offset(chunks.back().offset + offset);
+        return allocation;
+    }
+
+    void SuballocatedBuffer::free(Allocation& allocation) {
+        // The allocation might outlive the buffer (eg. a mesh destroyed after cleanup)
+        if (!allocation.is_valid() || allocation.chunk >= chunks.size()) return;
+        chunks[allocation.chunk].block.virtualFree(allocation.virtual_allocation);
+        allocation = Allocation{};
+    }
+
+    bool SuballocatedBuffer::grow(vk::DeviceSize min_additional_size) {
+        vk::DeviceSize old_size = buffer.get_size();
+        // Double the buffer so growing stays rare
+        vk::DeviceSize additional_size = std::max(old_size, min_additional_size);
+
+        if (!buffer.resize(old_size + additional_size, upload_scheduler, retirement_queue)) {
+            std::cerr << "Failed to grow suballocated buffer." << std::endl;
+            return false;
+        }
+
+        auto[cvb_result, block] = vma::createVirtualBlock(vma::VirtualBlockCreateInfo(additional_size));
+        CHECK_VK_RESULT_R(cvb_result, false, "Failed to create virtual block");
+        chunks.push_back({old_size, block});
+
+        return true;
+    }
+
+
+    GeometryArena::GeometryArena() {}
+
+    bool GeometryArena::init(
+        vma::Allocator* allocator,
+        vk::DeviceSize initial_vertex_capacity,
+        vk::DeviceSize initial_index_capacity,
+        vk::DeviceSize initial_meshlet_capacity,
+        UploadScheduler* upload_scheduler,
+        RetirementQueue* retirement_queue
+    ) {
+        this->allocator = allocator;
+        this->upload_scheduler = upload_scheduler;
+
+        if (!vertices.init(allocator, initial_vertex_capacity, vk::BufferUsageFlagBits::eVertexBuffer, upload_scheduler, retirement_queue, MemoryOwner::Mesh)) return false;
+        // The meshlet culling shader reads the indices too
+        if (!indices.init(allocator, initial_index_capacity, vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer, upload_scheduler, retirement_queue, MemoryOwner::Mesh)) return false;
+        if (!meshlets.init(allocator, initial_meshlet_capacity, vk::BufferUsageFlagBits::eStorageBuffer, upload_scheduler, retirement_queue, MemoryOwner::Mesh)) return false;
+
+        return true;
+    }
+
+    void GeometryArena::destroy() {
+        shared_geometries.clear();
+        vertices.destroy();
+        indices.destroy();
+        meshlets.destroy();
+    }
+
+    const GeometryArena::SharedGeometry* GeometryArena::acquire_shared_geometry(uint64_t hash) {
+        auto it = shared_geometries.find(hash);
+        if (it == shared_geometries.end()) return nullptr;
+        ++it->second.references;
+        return &it->second;
+    }
+
+    void GeometryArena::add_shared_geometry(uint64_t hash, const SharedGeometry& geometry) {
+        SharedGeometry& shared_geometry = shared_geometries[hash] = geometry;
+        shared_geometry.references = 1;
+    }
+
+    void GeometryArena::release_shared_geometry(uint64_t hash) {
+        auto it = shared_geometries.find(hash);
+        if (it == shared_geometries.end() || --it->second.references > 0) return;
+
+        free_vertices(it->second.vertices);
+        free_indices(it->second.indices);
+        free_meshlets(it->second.meshlets);
+        shared_geometries.erase(it);
+    }
+
+    void GeometryArena::enable_defragmentation(DefragmentationService* defragmentation_service) {
+        vertices.enable_defragmentation(defragmentation_service);
+        indices.enable_defragmentation(defragmentation_service);
+        meshlets.enable_defragmentation(defragmentation_service);
+    }
+
+}
@@ -104,6 +104,21 @@ namespace aq {
                 return;
             }
 
+            // Look for a dedicated transfer queue family for uploads
+            // Only families without image transfer granularity restrictions are considered
+            transfer_queue_family = graphics_present_queue_family;
+            for (size_t i=0; i<supported_queue_families.size(); ++i) {
+                vk::QueueFlags queue_flags = supported_queue_families[i].queueFlags;
+                vk::Extent3D granularity = supported_queue_families[i].minImageTransferGranularity;
+                if ((queue_flags & vk::QueueFlagBits::eTransfer) &&
+                    !(queue_flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)) &&
+                    granularity == vk::Extent3D(1, 1, 1)
+                ) {
+                    transfer_queue_family = i;
+                    break;
+                }
+            }
+
             // Check extension support
             vk::Result edep_result;
             std::tie(edep_result, supported_device_extensions) = gpu.enumerateDeviceExtensionProperties();
@@ -125,6 +140,34 @@ namespace aq {
                 return;
             }
 
+            // Check support for the Vulkan 1.2 features the device is created with
+            // (timeline semaphores for `UploadScheduler`, descriptor indexing for the bindless texture table)
+            vk::PhysicalDeviceProperties properties = gpu.getProperties();
+            if (properties.apiVersion < VK_API_VERSION_1_2) {
+                std::cerr << properties.deviceName.data() << " does not support Vulkan 1.2." << std::endl;
+                score = -1;
+                return;
+            }
+            auto features = gpu.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceTimelineSemaphoreFeatures, vk::PhysicalDeviceDescriptorIndexingFeatures>();
+            const auto& timeline_semaphore_features = features.get<vk::PhysicalDeviceTimelineSemaphoreFeatures>();
+            const auto& descriptor_indexing_features = features.get<vk::PhysicalDeviceDescriptorIndexingFeatures>();
+            if (!timeline_semaphore_features.timelineSemaphore) {
+                std::cerr << properties.deviceName.data() << " does not support timeline semaphores." << std::endl;
+                score = -1;
+                return;
+            }
+            if (!descriptor_indexing_features.shaderSampledImageArrayNonUniformIndexing ||
+                !descriptor_indexing_features.runtimeDescriptorArray ||
+                !descriptor_indexing_features.descriptorBindingPartiallyBound ||
+                !descriptor_indexing_features.descriptorBindingVariableDescriptorCount ||
+                !descriptor_indexing_features.descriptorBindingSampledImageUpdateAfterBind ||
+                !descriptor_indexing_features.descriptorBindingUpdateUnusedWhilePending
+            ) {
+                std::cerr << properties.deviceName.data() << " does not support the descriptor indexing features needed for bindless textures." << std::endl;
+                score = -1;
+                return;
+            }
+
             // Check swap chain support
             sw_ch_support = SwapChainSupportDetails(gpu, surface);
 
@@ -243,11 +286,14 @@ namespace aq {
             return true;
         }
 
-        bool VulkanInitializer::create_device(std::unordered_map<std::string, bool>& device_extensions, const vk::PhysicalDeviceFeatures& requested_features) {
+        bool VulkanInitializer::create_device(std::unordered_map<std::string, bool>& device_extensions, const vk::PhysicalDeviceFeatures& requested_features, const void* features_p_next) {
             float queue_priorites = 1.0f;
-            std::array<vk::DeviceQueueCreateInfo, 1> device_queue_create_infos{{
+            std::vector<vk::DeviceQueueCreateInfo> device_queue_create_infos{
                 {{}, gpu_support.graphics_present_queue_family, 1, &queue_priorites}
-            }};
+            };
+            if (gpu_support.transfer_queue_family != gpu_support.graphics_present_queue_family) {
+                device_queue_create_infos.push_back({{}, gpu_support.transfer_queue_family, 1, &queue_priorites});
+            }
 
             // Warn about unsupported device extensions and update `device_extensions`
             // so that supported extensions are `true` and unsupported extensions are
@@ -267,6 +313,7 @@ namespace aq {
             vk::PhysicalDeviceFeatures device_features{};
 
             vk::DeviceCreateInfo device_create_info({}, device_queue_create_infos, {}, gpu_support.supported_requested_device_extensions, &requested_features);
+            device_create_info.pNext = features_p_next;
 
             vk::Result cd_result;
             std::tie(cd_result, device) = gpu.createDevice(device_create_info);
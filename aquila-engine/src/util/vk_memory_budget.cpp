@@ -0,0 +1,123 @@
+#include "util/vk_memory_budget.hpp"
+
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+namespace aq {
+
+    namespace {
+        std::array<std::atomic<uint64_t>, (size_t) MemoryOwner::Count> owner_bytes{};
+        std::array<std::atomic<uint64_t>, (size_t) MemoryOwner::Count> owner_allocations{};
+    }
+
+    const char* to_string(MemoryOwner owner) {
+        switch (owner) {
+            case MemoryOwner::Other: return "other";
+            case MemoryOwner::Mesh: return "mesh";
+            case MemoryOwner::Texture: return "texture";
+            case MemoryOwner::MaterialTable: return "material_table";
+            case MemoryOwner::LightTable: return "light_table";
+            case MemoryOwner::Staging: return "staging";
+            case MemoryOwner::Swapchain: return "swapchain";
+            case MemoryOwner::Transient: return "transient";
+            default: return "unknown";
+        }
+    }
+
+    MemoryBudget::MemoryBudget() {}
+
+    void MemoryBudget::init(vma::Allocator* allocator, bool memory_budget_extension_enabled) {
+        this->allocator = allocator;
+        this->memory_budget_extension_enabled = memory_budget_extension_enabled;
+    }
+
+    void MemoryBudget::track(MemoryOwner owner, vk::DeviceSize size) {
+        owner_bytes[(size_t) owner] += size;
+        owner_allocations[(size_t) owner] += 1;
+    }
+
+    void MemoryBudget::untrack(MemoryOwner owner, vk::DeviceSize size) {
+        owner_bytes[(size_t) owner] -= size;
+        owner_allocations[(size_t) owner] -= 1;
+    }
+
+    MemoryBudget::OwnerUsage MemoryBudget::get_owner_usage(MemoryOwner owner) {
+        return {owner_bytes[(size_t) owner].load(), owner_allocations[(size_t) owner].load()};
+    }
+
+    std::vector<MemoryBudget::HeapUsage> MemoryBudget::get_heap_usages() {
+        const vk::PhysicalDeviceMemoryProperties* memory_properties = allocator->getMemoryProperties();
+
+        std::vector<vma::Budget> budgets(memory_properties->memoryHeapCount);
+        allocator->getHeapBudgets(budgets.data());
+
+        std::vector<HeapUsage> heap_usages(budgets.size());
+        for (size_t i=0; i<budgets.size(); ++i) {
+            const vk::MemoryHeap& heap = memory_properties->memoryHeaps[i];
+            heap_usages[i].size = heap.size;
+            heap_usages[i].budget = budgets[i].budget;
+            heap_usages[i].usage = budgets[i].usage;
+            heap_usages[i].block_bytes = budgets[i].statistics.blockBytes;
+            heap_usages[i].allocation_bytes = budgets[i].statistics.allocationBytes;
+            heap_usages[i].device_local = bool(heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+        }
+        return heap_usages;
+    }
+
+    vk::DeviceSize MemoryBudget::get_remaining_budget() {
+        vk::DeviceSize remaining = 0;
+        for (auto& heap_usage : get_heap_usages()) {
+            if (heap_usage.device_local && heap_usage.budget > heap_usage.usage)
+                remaining += heap_usage.budget - heap_usage.usage;
+        }
+        return remaining;
+    }
+
+    std::string MemoryBudget::to_json() {
+        std::stringstream json;
+        json << "{\n";
+        json << "    \"memory_budget_extension\": " << (memory_budget_extension_enabled ? "true" : "false") << ",\n";
+
+        json << "    \"owners\": {\n";
+        for (size_t i=0; i<(size_t) MemoryOwner::Count; ++i) {
+            OwnerUsage owner_usage = get_owner_usage((MemoryOwner) i);
+            json << "        \"" << to_string((MemoryOwner) i) << "\": { "
+                 << "\"bytes\": " << owner_usage.bytes << ", "
+                 << "\"allocations\": " << owner_usage.allocations << " }"
+                 << (i+1 < (size_t) MemoryOwner::Count ? "," : "") << "\n";
+        }
+        json << "    },\n";
+
+        std::vector<HeapUsage> heap_usages = get_heap_usages();
+        json << "    \"heaps\": [\n";
+        for (size_t i=0; i<heap_usages.size(); ++i) {
+            const HeapUsage& heap_usage = heap_usages[i];
+            json << "        { "
+                 << "\"device_local\": " << (heap_usage.device_local ? "true" : "false") << ", "
+                 << "\"size\": " << heap_usage.size << ", "
+                 << "\"budget\": " << heap_usage.budget << ", "
+                 << "\"usage\": " << heap_usage.usage << ", "
+                 << "\"block_bytes\": " << heap_usage.block_bytes << ", "
+                 << "\"allocation_bytes\": " << heap_usage.allocation_bytes << " }"
+                 << (i+1 < heap_usages.size() ? "," : "") << "\n";
+        }
+        json << "    ],\n";
+
+        json << "    \"remaining_budget\": " << get_remaining_budget() << "\n";
+        json << "}\n";
+        return json.str();
+    }
+
+    bool MemoryBudget::dump_json(const std::string& path) {
+        std::ofstream file(path);
+        if (!file.is_open()) {
+            std::cerr << "Failed to open " << path << " for the memory budget dump." << std::endl;
+            return false;
+        }
+        file << to_json();
+        return true;
+    }
+
+}
@@ -10,7 +10,9 @@ namespace aq {
         size_t reserve_size,
         vk::WriteDescriptorSet* descriptors,
         vma::Allocator* allocator, 
-        vk_util::UploadContext upload_context
+        vk_util::UploadContext upload_context,
+        RetirementQueue* retirement_queue,
+        MemoryOwner owner
     ) {
         this->object_size = object_size;
         buffer_size = reserve_size;
@@ -18,12 +20,14 @@ namespace aq {
 
         this->allocator = allocator;
         ctx = upload_context;
+        this->retirement_queue = retirement_queue;
 
         buffers.resize(frame_overlap);
         vk::DeviceSize allocation_size = buffer_size * object_size;
         for (auto i=0; i<frame_overlap; ++i) {
             auto& buffer = buffers[i];
 
+            buffer.buffer.set_owner(owner);
             buffer.buffer.allocate(allocator, allocation_size, vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eCpuToGpu, vk::MemoryPropertyFlagBits::eHostCoherent);
 
             auto mm_res = allocator->mapMemory(buffer.buffer.get_allocation(), (void**) &buffer.buff_mem);
@@ -80,7 +84,9 @@ namespace aq {
             }
             // Resize buffer to have enough space
             vk::DeviceSize new_byte_size = buffer_size * object_size;
-            if (!buffer.buffer.resize(new_byte_size, ctx)) std::cerr << "Failed to resize resizeable buffer." << std::endl;
+            // The buffers are host visible so this is a memcpy rather than a GPU copy
+            allocator->unmapMemory(buffer.buffer.get_allocation());
+            if (!buffer.buffer.resize(new_byte_size, retirement_queue)) std::cerr << "Failed to resize resizeable buffer." << std::endl;
             // Get the pointer to the new memory
             auto mm_res = allocator->mapMemory(buffer.buffer.get_allocation(), (void**) &buffer.buff_mem);
             CHECK_VK_RESULT(mm_res, "Failed to map buffer memory after resize.");
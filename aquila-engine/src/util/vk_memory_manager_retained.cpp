@@ -1,5 +1,7 @@
 #include "util/vk_memory_manager_retained.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 namespace aq {
@@ -12,20 +14,25 @@ namespace aq {
         size_t reserve_size,
         vk::WriteDescriptorSet* descriptors,
         vma::Allocator* allocator, 
-        vk_util::UploadContext upload_context
+        vk_util::UploadContext upload_context,
+        RetirementQueue* retirement_queue,
+        MemoryOwner owner
     ) {
         this->object_size = object_size;
         buffer_size = reserve_size;
+        this->reserve_size = reserve_size;
         end_index = 0;
 
         this->allocator = allocator;
         ctx = upload_context;
+        this->retirement_queue = retirement_queue;
 
         buffers.resize(frame_overlap);
         vk::DeviceSize allocation_size = buffer_size * object_size;
         for (auto i=0; i<frame_overlap; ++i) {
             auto& buffer = buffers[i];
 
+            buffer.buffer.set_owner(owner);
             buffer.buffer.allocate(allocator, allocation_size, vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eCpuToGpu, vk::MemoryPropertyFlagBits::eHostCoherent);
 
             auto mm_res = allocator->mapMemory(buffer.buffer.get_allocation(), (void**) &buffer.buff_mem);
@@ -48,81 +55,161 @@ namespace aq {
             buffer.buffer.destroy();
         }
         buffers.clear();
-        free_memory.clear();
+        shadow.clear();
+        handle_slots.clear();
+        slot_handles.clear();
+        free_handles.clear();
+        free_slots.clear();
     }
 
     ManagedMemoryIndex MemoryManagerRetained::add_object(void* object) {
-        ManagedMemoryIndex object_index;
-        if (!free_memory.empty()) {
-            object_index = free_memory.front();
-            free_memory.pop_front();
+        size_t slot;
+        if (!free_slots.empty()) {
+            slot = free_slots.back();
+            free_slots.pop_back();
         } else {
-            object_index = end_index;
+            slot = end_index;
             end_index++;
+            // Grows geometrically (like `buffer_size`) so adding objects is amortized O(1)
+            if (shadow.size() < end_index * object_size) shadow.resize(std::max(end_index, buffer_size) * object_size);
+            slot_handles.resize(end_index);
         }
 
-        std::shared_ptr<std::byte[]> memory(new std::byte[object_size]);
-        memcpy(memory.get(), object, object_size);
-        for (auto& buffer : buffers) {
-            buffer.update_queue.push_back({Action::Type::Add, 1, object_index, memory});
+        ManagedMemoryIndex handle;
+        if (!free_handles.empty()) {
+            handle = free_handles.back();
+            free_handles.pop_back();
+        } else {
+            handle = handle_slots.size();
+            handle_slots.push_back(INVALID_SLOT);
         }
-        return object_index;
+
+        handle_slots[handle] = slot;
+        slot_handles[slot] = handle;
+
+        update_object(handle, object);
+        return handle;
     }
 
     void MemoryManagerRetained::update_object(ManagedMemoryIndex index, void* object) {
-        std::shared_ptr<std::byte[]> memory(new std::byte[object_size]);
-        memcpy(memory.get(), object, object_size);
-        for (auto& buffer : buffers) {
-            buffer.update_queue.push_back({Action::Type::Update, 1, index, memory});
-        }
+        size_t slot = handle_slots[index];
+        memcpy(shadow.data() + slot * object_size, object, object_size);
+        mark_dirty(slot);
     }
 
     void MemoryManagerRetained::remove_object(ManagedMemoryIndex index) {
-        // Make sure `index` isn't already in `free_memory`
-        if (std::find(free_memory.begin(), free_memory.end(), index) == free_memory.end()) {
-            free_memory.push_back(index);
-            // Currently I do nothing with the memory of removed objects
-            // for (auto& buffer : buffers) {    
-            //     buffer.update_queue.push_back({Action::Type::Remove, 1, index, nullptr});
-            // }
+        // Make sure `index` wasn't already removed
+        if (index >= handle_slots.size() || handle_slots[index] == INVALID_SLOT) return;
+
+        free_slots.push_back(handle_slots[index]);
+        handle_slots[index] = INVALID_SLOT;
+        free_handles.push_back(index);
+        // Currently I do nothing with the memory of removed objects
+    }
+
+    size_t MemoryManagerRetained::compact() {
+        size_t nr_objects = get_nr_objects();
+
+        // Every hole below `nr_objects` gets filled with an object from at or above `nr_objects`
+        std::vector<bool> is_free(end_index, false);
+        for (size_t slot : free_slots) is_free[slot] = true;
+
+        size_t nr_moved = 0;
+        size_t src = end_index;
+        for (size_t dst = 0; dst < nr_objects; ++dst) {
+            if (!is_free[dst]) continue;
+
+            do { --src; } while (is_free[src]);
+
+            memcpy(shadow.data() + dst * object_size, shadow.data() + src * object_size, object_size);
+            ManagedMemoryIndex handle = slot_handles[src];
+            handle_slots[handle] = dst;
+            slot_handles[dst] = handle;
+            mark_dirty(dst);
+            ++nr_moved;
         }
+
+        end_index = nr_objects;
+        free_slots.clear();
+        slot_handles.resize(end_index);
+
+        // Shrink the shadow copy and (lazily, in `update`) the buffers
+        buffer_size = std::max(reserve_size, end_index*3/2);
+        shadow.resize(buffer_size * object_size);
+        shadow.shrink_to_fit();
+
+        // Objects past `end_index` no longer exist so they shouldn't be uploaded
+        for (auto& buffer : buffers) {
+            size_t first_word = (end_index + 63) / 64;
+            if (buffer.dirty.size() > first_word) buffer.dirty.resize(first_word);
+            if (end_index % 64 != 0 && !buffer.dirty.empty()) buffer.dirty.back() &= (uint64_t(1) << (end_index % 64)) - 1;
+        }
+
+        return nr_moved;
     }
 
     void MemoryManagerRetained::update(uint safe_frame) {
         auto& buffer = buffers[safe_frame];
-        for (auto& action : buffer.update_queue) {
-            switch (action.type) {
-            case Action::Type::Add: {
-                // Make sure the buffer has enough space
-                size_t size_needed = action.index + action.count;
-                size_t bytes_needed = size_needed * object_size;
-                if (bytes_needed > buffer.buffer.get_size()) { // We need to resize
-                    if (size_needed > buffer_size) { // Calculate new `buffer_size`
-                        buffer_size = size_needed*3/2;
-                    }
-                    // Resize buffer to have enough space
-                    vk::DeviceSize new_byte_size = buffer_size * object_size;
-                    if (!buffer.buffer.resize(new_byte_size, ctx)) std::cerr << "Failed to resize resizeable buffer." << std::endl;
-                    // Get the pointer to the new memory
-                    auto mm_res = allocator->mapMemory(buffer.buffer.get_allocation(), (void**) &buffer.buff_mem);
-                    CHECK_VK_RESULT(mm_res, "Failed to map buffer memory after resize.");
-                    // Make sure to update descriptor sets too
-                    vk::DescriptorBufferInfo buffer_info(buffer.buffer.get_buffer(), 0, new_byte_size);
-                    buffer.write_descriptor.setPBufferInfo(&buffer_info);
-                    ctx.device.updateDescriptorSets({buffer.write_descriptor}, {});
+
+        // Make sure the buffer has enough space
+        size_t bytes_needed = end_index * object_size;
+        bool should_shrink = buffer.buffer.get_size() > buffer_size * object_size; // `compact` shrunk `buffer_size`
+        if (bytes_needed > buffer.buffer.get_size() || should_shrink) { // We need to resize
+            if (end_index > buffer_size) { // Calculate new `buffer_size`
+                buffer_size = end_index*3/2;
+            }
+            // Resize buffer to have enough space
+            vk::DeviceSize new_byte_size = buffer_size * object_size;
+            // The buffers are host visible so this is a memcpy rather than a GPU copy
+            allocator->unmapMemory(buffer.buffer.get_allocation());
+            if (!buffer.buffer.resize(new_byte_size, retirement_queue)) std::cerr << "Failed to resize resizeable buffer." << std::endl;
+            // Get the pointer to the new memory
+            auto mm_res = allocator->mapMemory(buffer.buffer.get_allocation(), (void**) &buffer.buff_mem);
+            CHECK_VK_RESULT(mm_res, "Failed to map buffer memory after resize.");
+            // Make sure to update descriptor sets too
+            vk::DescriptorBufferInfo buffer_info(buffer.buffer.get_buffer(), 0, new_byte_size);
+            buffer.write_descriptor.setPBufferInfo(&buffer_info);
+            ctx.device.updateDescriptorSets({buffer.write_descriptor}, {});
+        }
+
+        // Copy every run of consecutive dirty objects from the shadow copy with a single `memcpy`
+
+        auto copy_run = [this, &buffer](size_t first, size_t last) {
+            size_t memory_offset = first * object_size;
+            memcpy(buffer.buff_mem + memory_offset, shadow.data() + memory_offset, (last - first) * object_size);
+        };
+
+        size_t run_start = SIZE_MAX;
+        for (size_t word_index = 0; word_index < buffer.dirty.size(); ++word_index) {
+            uint64_t word = buffer.dirty[word_index];
+            if (word == 0 && run_start == SIZE_MAX) continue;
+            if (word == UINT64_MAX && run_start != SIZE_MAX) {
+                buffer.dirty[word_index] = 0;
+                continue;
+            }
+
+            for (size_t bit = 0; bit < 64; ++bit) {
+                bool is_dirty = word & (uint64_t(1) << bit);
+                size_t index = word_index * 64 + bit;
+                if (is_dirty && run_start == SIZE_MAX) {
+                    run_start = index;
+                } else if (!is_dirty && run_start != SIZE_MAX) {
+                    copy_run(run_start, index);
+                    run_start = SIZE_MAX;
                 }
-            } // Intentional fallthrough to `Action::Type::Update`
-            case Action::Type::Update: {
-                assert((action.index + action.count) * object_size <= buffer.buffer.get_size()); // Make sure the location is valid
-                size_t memory_offset = action.index * object_size;
-                memcpy(buffer.buff_mem+memory_offset, action.memory.get(), action.count*object_size);
-            } break;
-            case Action::Type::Remove:
-                // Do nothing. If we really want to be safe, we can 0 the memory
-                break;
             }
+            buffer.dirty[word_index] = 0;
+        }
+        if (run_start != SIZE_MAX) copy_run(run_start, std::min(buffer.dirty.size() * 64, end_index));
+    }
+
+    void MemoryManagerRetained::mark_dirty(size_t slot) {
+        size_t word_index = slot / 64;
+        uint64_t bit = uint64_t(1) << (slot % 64);
+        for (auto& buffer : buffers) {
+            if (buffer.dirty.size() <= word_index) buffer.dirty.resize(std::max(word_index + 1, buffer.dirty.size() * 2));
+            buffer.dirty[word_index] |= bit;
         }
-        buffer.update_queue.clear();
     }
 
-}
\ No newline at end of file
+}
@@ -1,51 +1,117 @@
 #include "util/vk_resizable_buffer.hpp"
 
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 
 #include "util/vk_utility.hpp"
+#include "util/vk_upload_scheduler.hpp"
+#include "util/vk_defragmentation.hpp"
 
 namespace aq {
 
     ResizableBuffer::ResizableBuffer() {}
 
-    bool ResizableBuffer::allocate(vma::Allocator* allocator, vk::DeviceSize allocation_size, const vk::BufferUsageFlags& usage, const vma::MemoryUsage& memory_usage, vk::MemoryPropertyFlags memory_property_flags) {
+    bool ResizableBuffer::allocate(vma::Allocator* allocator, vk::DeviceSize allocation_size, const vk::BufferUsageFlags& usage, const vma::MemoryUsage& memory_usage, vk::MemoryPropertyFlags memory_property_flags, const std::vector<uint32_t>& queue_families) {
         this->memory_property_flags = memory_property_flags;
+        this->queue_families = queue_families;
         usage_flags = usage | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
         memory_usage_flags = memory_usage;
         this->allocator = allocator;
         buffer_size = allocation_size;
 
-        return buffer.allocate(allocator, allocation_size, usage_flags, memory_usage_flags, memory_property_flags);
+        buffer.owner = owner;
+        return buffer.allocate(allocator, allocation_size, usage_flags, memory_usage_flags, memory_property_flags, queue_families);
     }
 
-    bool ResizableBuffer::resize(vk::DeviceSize new_size, const vk_util::UploadContext& ctx, vma::Allocator* allocator) {
-        if (allocator) this->allocator = allocator;
+    bool ResizableBuffer::resize(vk::DeviceSize new_size, RetirementQueue* retirement_queue, vk::CommandBuffer cmd) {
+        AllocatedBuffer new_buffer{};
+        if (!create_replacement(new_size, new_buffer)) return false;
+
+        // Transfer contents of the old buffer into the new one
 
-        // Create the new buffer
+        vk::DeviceSize copy_size = std::min(buffer_size, new_size);
+        if (is_host_visible()) {
+            auto[mmo_result, old_memory] = allocator->mapMemory(buffer.allocation);
+            CHECK_VK_RESULT_R(mmo_result, false, "Failed to map old buffer for resize");
+            auto[mmn_result, new_memory] = allocator->mapMemory(new_buffer.allocation);
+            CHECK_VK_RESULT_R(mmn_result, false, "Failed to map new buffer for resize");
+
+            memcpy(new_memory, old_memory, copy_size);
+            allocator->flushAllocation(new_buffer.allocation, 0, copy_size);
+
+            allocator->unmapMemory(new_buffer.allocation);
+            allocator->unmapMemory(buffer.allocation);
+        } else if (cmd) {
+            cmd.copyBuffer(buffer.buffer, new_buffer.buffer, {vk::BufferCopy(0, 0, copy_size)});
+        } else {
+            std::cerr << "Resizing a buffer that is not host visible requires a command buffer." << std::endl;
+            new_buffer.destroy();
+            return false;
+        }
+
+        retire(retirement_queue, new_buffer, new_size);
 
+        return true;
+    }
+
+    bool ResizableBuffer::resize(vk::DeviceSize new_size, UploadScheduler* upload_scheduler, RetirementQueue* retirement_queue) {
         AllocatedBuffer new_buffer{};
-        new_buffer.allocate(this->allocator, new_size, usage_flags, memory_usage_flags, memory_property_flags);
+        if (!create_replacement(new_size, new_buffer)) return false;
 
-        // Transfer contents of the old buffer into the new one
+        // Schedule the transfer of the old buffer's contents into the new one
 
         vk::DeviceSize copy_size = std::min(buffer_size, new_size);
-        vk_util::immediate_submit([this, &copy_size, &new_buffer](vk::CommandBuffer cmd) {
+        vk::Buffer old_buffer = buffer.buffer;
+        vk::Buffer new_vk_buffer = new_buffer.buffer;
+        UploadScheduler::Ticket ticket = upload_scheduler->record([old_buffer, new_vk_buffer, copy_size](vk::CommandBuffer cmd) {
             vk::BufferCopy buffer_copy(0, 0, copy_size);
-            cmd.copyBuffer(buffer.buffer, new_buffer.buffer, {buffer_copy});
-        }, ctx);
+            cmd.copyBuffer(old_buffer, new_vk_buffer, {buffer_copy});
+        });
 
-        // Destroy the old buffer and replace with the new buffer
+        retire(retirement_queue, new_buffer, new_size, upload_scheduler, ticket);
+
+        return true;
+    }
+
+    bool ResizableBuffer::is_host_visible() {
+        vk::MemoryPropertyFlags memory_properties = allocator->getAllocationMemoryProperties(buffer.allocation);
+        return bool(memory_properties & vk::MemoryPropertyFlagBits::eHostVisible);
+    }
+
+    bool ResizableBuffer::create_replacement(vk::DeviceSize new_size, AllocatedBuffer& new_buffer) {
+        new_buffer.owner = owner;
+        if (!new_buffer.allocate(allocator, new_size, usage_flags, memory_usage_flags, memory_property_flags, queue_families)) {
+            std::cerr << "Failed to allocate buffer of size " << new_size << " for resize." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void ResizableBuffer::retire(RetirementQueue* retirement_queue, AllocatedBuffer& new_buffer, vk::DeviceSize new_size, UploadScheduler* upload_scheduler, UploadScheduler::Ticket ticket) {
+        AllocatedBuffer old_buffer = buffer;
+        if (upload_scheduler) {
+            // The copy only goes out with the scheduler's next flush, which can be after the retired frames have
+            // finished, so the old buffer is handed on to the scheduler to also wait for the copy
+            retirement_queue->retire([old_buffer, upload_scheduler, ticket]() { upload_scheduler->destroy_after(old_buffer, ticket); });
+        } else {
+            retirement_queue->retire([old_buffer]() mutable { old_buffer.destroy(); });
+        }
 
-        buffer.destroy();
         buffer = new_buffer;
         buffer_size = new_size;
 
-        return true;
+        if (defragmentation_service)
+            defragmentation_service->register_buffer(&buffer, buffer_size, usage_flags);
     }
 
     void ResizableBuffer::destroy() {
         buffer.destroy();
     }
 
+    void ResizableBuffer::enable_defragmentation(DefragmentationService* defragmentation_service) {
+        this->defragmentation_service = defragmentation_service;
+        defragmentation_service->register_buffer(&buffer, buffer_size, usage_flags);
+    }
+
 }
\ No newline at end of file
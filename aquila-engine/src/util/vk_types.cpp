@@ -1,9 +1,14 @@
 #include "util/vk_types.hpp"
 
+#include <algorithm>
+
 #define VMA_IMPLEMENTATION
 #include <vk_mem_alloc.h>
 
 #include "util/vk_utility.hpp"
+#include "util/vk_upload_scheduler.hpp"
+#include "util/vk_defragmentation.hpp"
+#include "util/vk_memory_budget.hpp"
 
 namespace aq {
 
@@ -23,14 +28,42 @@ namespace aq {
     }
 
 
+    RetirementQueue::RetirementQueue(uint64_t frame_overlap) : frame_overlap(frame_overlap) {}
+
+    void RetirementQueue::next_frame(uint64_t frame_number) {
+        this->frame_number = frame_number;
+        while (!deletors.empty() && deletors.front().first + frame_overlap <= frame_number) {
+            deletors.front().second();
+            deletors.pop_front();
+        }
+    }
+
+    void RetirementQueue::retire(std::function<void()>&& function) {
+        deletors.push_back({frame_number, function});
+    }
+
+    void RetirementQueue::flush() {
+        for (auto& deletor : deletors) {
+            deletor.second();
+        }
+        deletors.clear();
+    }
+
+
     AllocatedBuffer::AllocatedBuffer() : buffer(nullptr), allocation(nullptr), allocator(nullptr) {}
 
-    bool AllocatedBuffer::allocate(vma::Allocator* allocator, vk::DeviceSize allocation_size, vk::BufferUsageFlags usage, vma::MemoryUsage memory_usage, vk::MemoryPropertyFlags memory_property_flags) {
+    bool AllocatedBuffer::allocate(vma::Allocator* allocator, vk::DeviceSize allocation_size, vk::BufferUsageFlags usage, vma::MemoryUsage memory_usage, vk::MemoryPropertyFlags memory_property_flags, const std::vector<uint32_t>& queue_families) {
         vk::BufferCreateInfo buffer_create_info = vk::BufferCreateInfo()
             .setSize(allocation_size)
             .setUsage(usage)
             .setSharingMode(vk::SharingMode::eExclusive);
 
+        if (queue_families.size() > 1) {
+            buffer_create_info
+                .setSharingMode(vk::SharingMode::eConcurrent)
+                .setQueueFamilyIndices(queue_families);
+        }
+
         vma::AllocationCreateInfo alloc_create_info({}, memory_usage, memory_property_flags);
 
         auto[cb_result, buff_alloc] = allocator->createBuffer(buffer_create_info, alloc_create_info);
@@ -39,6 +72,9 @@ namespace aq {
 
         this->allocator = allocator;
 
+        tracked_size = allocator->getAllocationInfo(allocation).size;
+        MemoryBudget::track(owner, tracked_size);
+
         return true;
     }
 
@@ -56,7 +92,12 @@ namespace aq {
 
     void AllocatedBuffer::destroy() {
         if (allocator) {
+            if (defragmentation_service) defragmentation_service->release(allocation);
+            defragmentation_service = nullptr;
+
             allocator->destroyBuffer(buffer, allocation);
+            MemoryBudget::untrack(owner, tracked_size);
+            tracked_size = 0;
             
             buffer = nullptr;
             allocation = nullptr;
@@ -73,101 +114,87 @@ namespace aq {
     AllocatedBuffer& AllocatedBuffer::operator=(const AllocatedBuffer& rhs) {
         buffer = rhs.buffer;
         allocation = rhs.allocation;
+        owner = rhs.owner;
         allocator = rhs.allocator;
+        tracked_size = rhs.tracked_size;
+        defragmentation_service = rhs.defragmentation_service;
         return *this;
     }
 
 
     AllocatedImage::AllocatedImage() {}
 
-    bool AllocatedImage::upload(void* texture_data, int width, int height, vma::Allocator* allocator, const vk_util::UploadContext& upload_context) {
-        vk::DeviceSize image_size = width * height * 4;
-        vk::Format image_format = vk::Format::eR8G8B8A8Unorm;
-
-        // Create the staging buffer
+    bool AllocatedImage::upload(void* texture_data, int width, int height, UploadScheduler* upload_scheduler) {
+        return upload(texture_data, vk::DeviceSize(width) * height * 4, vk::Format::eR8G8B8A8Unorm, vk::Extent2D(width, height), {0}, upload_scheduler);
+    }
 
-        AllocatedBuffer staging_buffer;
-        if (!staging_buffer.upload(texture_data, allocator, image_size, vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eCpuOnly)) return false;
+    bool AllocatedImage::upload(
+        const void* texture_data, vk::DeviceSize size,
+        vk::Format format, vk::Extent2D extent,
+        const std::vector<vk::DeviceSize>& level_offsets,
+        UploadScheduler* upload_scheduler
+    ) {
+        vma::Allocator* allocator = upload_scheduler->get_allocator();
+        this->format = format;
+        this->extent = vk::Extent3D(extent, 1);
+        mip_levels = uint32_t(level_offsets.size());
+        // Transfer src so the image can be copied when it is moved by defragmentation
+        usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc;
 
         // Create the image buffer
 
-        vk::Extent3D extent(width, height, 1);
-
         vk::ImageCreateInfo image_create_info = vk::ImageCreateInfo()
             .setImageType(vk::ImageType::e2D)
-            .setFormat(image_format)
-            .setExtent(extent)
-            .setMipLevels(1)
+            .setFormat(format)
+            .setExtent(this->extent)
+            .setMipLevels(mip_levels)
             .setArrayLayers(1)
             .setSamples(vk::SampleCountFlagBits::e1)
             .setTiling(vk::ImageTiling::eOptimal)
-            .setUsage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst);
+            .setUsage(usage);
+
+        // The image is written by the upload queue and read by the graphics queue
+        const std::vector<uint32_t>& queue_families = upload_scheduler->get_queue_families();
+        if (queue_families.size() > 1) {
+            image_create_info
+                .setSharingMode(vk::SharingMode::eConcurrent)
+                .setQueueFamilyIndices(queue_families);
+        }
 
         vma::AllocationCreateInfo alloc_create_info({}, vma::MemoryUsage::eGpuOnly);
 
         auto[ci_res, image_alloc] = allocator->createImage(image_create_info, alloc_create_info);
+        CHECK_VK_RESULT_R(ci_res, false, "Failed to create image");
         set(image_alloc);
 
-        // Transfer contents of staging buffer into image buffer
-
-        vk_util::immediate_submit([this, &staging_buffer, &extent](vk::CommandBuffer cmd) {
-            // Transition image to be usable as transfer dst
-
-            vk::ImageSubresourceRange subresource_range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-
-            vk::ImageMemoryBarrier image_transfer_memory_barrier = vk::ImageMemoryBarrier()
-                .setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
-                .setOldLayout(vk::ImageLayout::eUndefined)
-                .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
-                .setImage(image)
-                .setSubresourceRange(subresource_range);
-
-            cmd.pipelineBarrier(
-                vk::PipelineStageFlagBits::eTopOfPipe,
-                vk::PipelineStageFlagBits::eTransfer,
-                {}, // dependency flags
-                {}, {}, // memory and buffer-memory barriers
-                {image_transfer_memory_barrier}
-            );
-
-            // Actual data transfer
-
-            vk::BufferImageCopy copy = vk::BufferImageCopy()
-                .setImageSubresource({ vk::ImageAspectFlagBits::eColor, 0, 0, 1 })
-                .setImageExtent(extent);
-
-            cmd.copyBufferToImage(staging_buffer.buffer, image, vk::ImageLayout::eTransferDstOptimal, {copy});
+        this->allocator = allocator;
 
-            // Transition image to be readable by shader
+        tracked_size = allocator->getAllocationInfo(allocation).size;
+        MemoryBudget::track(owner, tracked_size);
 
-            vk::ImageMemoryBarrier image_read_memory_barrier = vk::ImageMemoryBarrier()
-                .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
-                .setDstAccessMask(vk::AccessFlagBits::eShaderRead)
-                .setOldLayout(vk::ImageLayout::eTransferDstOptimal)
-                .setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
-                .setImage(image)
-                .setSubresourceRange(subresource_range);
+        // Schedule the transfer; the texture data is copied into staging memory immediately
 
-            cmd.pipelineBarrier(
-                vk::PipelineStageFlagBits::eTransfer,
-                vk::PipelineStageFlagBits::eFragmentShader,
-                {}, // dependency flags
-                {}, {}, // memory and buffer-memory barriers
-                {image_read_memory_barrier}
+        std::vector<vk::BufferImageCopy> copies;
+        for (uint32_t level=0; level<mip_levels; ++level) {
+            copies.push_back(vk::BufferImageCopy()
+                .setBufferOffset(level_offsets[level])
+                .setImageSubresource({vk::ImageAspectFlagBits::eColor, level, 0, 1})
+                .setImageExtent({std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u), 1})
             );
-
-        }, upload_context);
-
-        staging_buffer.destroy();
-
-        this->allocator = allocator;
+        }
+        upload_ticket = upload_scheduler->upload_image(image, mip_levels, texture_data, size, copies);
 
         return true;
     }
 
     void AllocatedImage::destroy() {
         if (allocator) {
+            if (defragmentation_service) defragmentation_service->release(allocation);
+            defragmentation_service = nullptr;
+
             allocator->destroyImage(image, allocation);
+            MemoryBudget::untrack(owner, tracked_size);
+            tracked_size = 0;
             
             image = nullptr;
             allocation = nullptr;
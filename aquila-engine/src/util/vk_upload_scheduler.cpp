@@ -0,0 +1,313 @@
+#include "util/vk_upload_scheduler.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace aq {
+
+    // Satisfies the buffer offset alignment of every format we upload
+    static constexpr vk::DeviceSize STAGING_ALIGNMENT = 16;
+
+    UploadScheduler::UploadScheduler() {}
+
+    bool UploadScheduler::init(
+        vk::Device device,
+        vma::Allocator* allocator,
+        vk::Queue queue,
+        uint32_t queue_family,
+        uint32_t graphics_queue_family,
+        vk::DeviceSize staging_capacity
+    ) {
+        this->device = device;
+        this->allocator = allocator;
+        this->queue = queue;
+        this->queue_family = queue_family;
+        this->staging_capacity = staging_capacity;
+
+        queue_families = {queue_family};
+        if (graphics_queue_family != queue_family) queue_families.push_back(graphics_queue_family);
+
+        // Create the timeline semaphore
+
+        vk::SemaphoreTypeCreateInfo semaphore_type_create_info(vk::SemaphoreType::eTimeline, 0);
+        vk::SemaphoreCreateInfo semaphore_create_info{};
+        semaphore_create_info.pNext = &semaphore_type_create_info;
+
+        vk::Result cs_result;
+        std::tie(cs_result, timeline_semaphore) = device.createSemaphore(semaphore_create_info);
+        CHECK_VK_RESULT_R(cs_result, false, "Failed to create upload timeline semaphore");
+
+        // Create the staging ring buffer (stays mapped for the lifetime of the scheduler)
+
+        staging_buffer.owner = MemoryOwner::Staging;
+        if (!staging_buffer.allocate(allocator, staging_capacity, vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eCpuOnly, vk::MemoryPropertyFlagBits::eHostCoherent))
+            return false;
+
+        auto[mm_result, memory] = allocator->mapMemory(staging_buffer.allocation);
+        CHECK_VK_RESULT_R(mm_result, false, "Failed to map staging ring buffer");
+        staging_memory = (std::byte*) memory;
+
+        current.ticket = 1;
+
+        return true;
+    }
+
+    void UploadScheduler::destroy() {
+        if (!device) return;
+
+        if (current.recording) submit_current();
+        wait(get_last_submitted());
+        collect();
+
+        for (auto& retired_buffer : retired_buffers) retired_buffer.second.destroy();
+        retired_buffers.clear();
+
+        for (auto& command_pool : free_command_pools) device.destroyCommandPool(command_pool);
+        free_command_pools.clear();
+
+        if (staging_memory) allocator->unmapMemory(staging_buffer.allocation);
+        staging_memory = nullptr;
+        staging_buffer.destroy();
+
+        device.destroySemaphore(timeline_semaphore);
+        device = nullptr;
+    }
+
+    UploadScheduler::Ticket UploadScheduler::upload_buffer(vk::Buffer dst, vk::DeviceSize dst_offset, const void* data, vk::DeviceSize size) {
+        auto[src, src_offset] = get_staging(data, size);
+        if (!src) return current.ticket;
+
+        get_command_buffer().copyBuffer(src, dst, {vk::BufferCopy(src_offset, dst_offset, size)});
+
+        return current.ticket;
+    }
+
+    UploadScheduler::Ticket UploadScheduler::upload_image(vk::Image dst, vk::Extent3D extent, const void* data, vk::DeviceSize size) {
+        vk::BufferImageCopy copy = vk::BufferImageCopy()
+            .setBufferOffset(0)
+            .setImageSubresource({ vk::ImageAspectFlagBits::eColor, 0, 0, 1 })
+            .setImageExtent(extent);
+        return upload_image(dst, 1, data, size, {copy});
+    }
+
+    UploadScheduler::Ticket UploadScheduler::upload_image(vk::Image dst, uint32_t mip_levels, const void* data, vk::DeviceSize size, std::vector<vk::BufferImageCopy> copies) {
+        auto[src, src_offset] = get_staging(data, size);
+        if (!src) return current.ticket;
+
+        vk::CommandBuffer cmd = get_command_buffer();
+
+        // Transition image to be usable as transfer dst
+
+        vk::ImageSubresourceRange subresource_range(vk::ImageAspectFlagBits::eColor, 0, mip_levels, 0, 1);
+
+        vk::ImageMemoryBarrier image_transfer_memory_barrier = vk::ImageMemoryBarrier()
+            .setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+            .setOldLayout(vk::ImageLayout::eUndefined)
+            .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+            .setImage(dst)
+            .setSubresourceRange(subresource_range);
+
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTopOfPipe,
+            vk::PipelineStageFlagBits::eTransfer,
+            {}, // dependency flags
+            {}, {}, // memory and buffer-memory barriers
+            {image_transfer_memory_barrier}
+        );
+
+        // Actual data transfer
+        // The staging offset is aligned to `STAGING_ALIGNMENT` so offsets that are aligned in `data` stay aligned
+
+        for (auto& copy : copies) copy.bufferOffset += src_offset;
+        cmd.copyBufferToImage(src, dst, vk::ImageLayout::eTransferDstOptimal, copies);
+
+        // Transition image to be readable by shader
+        // The transfer queue might not support shader stages; visibility to the graphics queue
+        // comes from it waiting on the timeline semaphore
+
+        vk::ImageMemoryBarrier image_read_memory_barrier = vk::ImageMemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+            .setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+            .setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+            .setImage(dst)
+            .setSubresourceRange(subresource_range);
+
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eBottomOfPipe,
+            {}, // dependency flags
+            {}, {}, // memory and buffer-memory barriers
+            {image_read_memory_barrier}
+        );
+
+        return current.ticket;
+    }
+
+    UploadScheduler::Ticket UploadScheduler::record(std::function<void(vk::CommandBuffer)>&& function) {
+        vk::CommandBuffer cmd = get_command_buffer();
+
+        vk::MemoryBarrier memory_barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite);
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eTransfer,
+            {}, // dependency flags
+            {memory_barrier}, {}, {}
+        );
+
+        function(cmd);
+
+        return current.ticket;
+    }
+
+    void UploadScheduler::destroy_after(AllocatedBuffer buffer, Ticket ticket) {
+        retired_buffers.push_back({ticket, buffer});
+    }
+
+    UploadScheduler::Ticket UploadScheduler::flush() {
+        if (current.recording) submit_current();
+        collect();
+        return get_last_submitted();
+    }
+
+    bool UploadScheduler::is_complete(Ticket ticket) {
+        auto[gscv_result, value] = device.getSemaphoreCounterValue(timeline_semaphore);
+        CHECK_VK_RESULT_R(gscv_result, false, "Failed to query upload timeline semaphore");
+        return value >= ticket;
+    }
+
+    bool UploadScheduler::wait(Ticket ticket, uint64_t timeout) {
+        if (ticket == 0) return true;
+        if (ticket >= current.ticket) {
+            if (!current.recording) return true; // Nothing was recorded for `ticket`
+            submit_current();
+        }
+        ticket = std::min(ticket, get_last_submitted());
+
+        vk::SemaphoreWaitInfo wait_info({}, 1, &timeline_semaphore, &ticket);
+        CHECK_VK_RESULT_R(device.waitSemaphores(wait_info, timeout), false, "Failed to wait for upload");
+        return true;
+    }
+
+    vk::CommandBuffer UploadScheduler::get_command_buffer() {
+        if (current.recording) return current.command_buffer;
+
+        // Reuse the command pool of a finished batch if there is one
+
+        if (free_command_pools.empty()) {
+            vk::CommandPoolCreateInfo command_pool_create_info(vk::CommandPoolCreateFlagBits::eTransient, queue_family);
+            vk::CommandPool command_pool;
+            vk::Result ccp_result;
+            std::tie(ccp_result, command_pool) = device.createCommandPool(command_pool_create_info);
+            CHECK_VK_RESULT(ccp_result, "Failed to create upload command pool");
+            free_command_pools.push_back(command_pool);
+        }
+        current.command_pool = free_command_pools.back();
+        free_command_pools.pop_back();
+
+        vk::CommandBufferAllocateInfo cmd_buff_alloc_info(current.command_pool, vk::CommandBufferLevel::ePrimary, 1);
+        auto[acb_result, cmd_buffs] = device.allocateCommandBuffers(cmd_buff_alloc_info);
+        CHECK_VK_RESULT(acb_result, "Failed to allocate upload command buffer");
+        current.command_buffer = cmd_buffs[0];
+
+        vk::CommandBufferBeginInfo cmd_buff_begin_info(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+        CHECK_VK_RESULT(current.command_buffer.begin(cmd_buff_begin_info), "Failed to begin upload command buffer");
+        current.recording = true;
+
+        return current.command_buffer;
+    }
+
+    void UploadScheduler::submit_current() {
+        CHECK_VK_RESULT(current.command_buffer.end(), "Failed to end upload command buffer");
+
+        vk::TimelineSemaphoreSubmitInfo timeline_submit_info(0, nullptr, 1, &current.ticket);
+        vk::SubmitInfo submit_info(0, nullptr, nullptr, 1, &current.command_buffer, 1, &timeline_semaphore);
+        submit_info.pNext = &timeline_submit_info;
+        CHECK_VK_RESULT(queue.submit(1, &submit_info, nullptr), "Failed to submit uploads");
+
+        current.recording = false;
+        current.staging_end = staging_head;
+        in_flight.push_back(current);
+
+        Batch next_batch{};
+        next_batch.ticket = current.ticket + 1;
+        current = next_batch;
+    }
+
+    void UploadScheduler::collect() {
+        auto[gscv_result, completed] = device.getSemaphoreCounterValue(timeline_semaphore);
+        CHECK_VK_RESULT(gscv_result, "Failed to query upload timeline semaphore");
+
+        while (!in_flight.empty() && in_flight.front().ticket <= completed) {
+            Batch& batch = in_flight.front();
+            if (batch.uses_staging) staging_tail = batch.staging_end;
+
+            // Resetting the command pool will also free the batch's command buffer
+            device.resetCommandPool(batch.command_pool);
+            free_command_pools.push_back(batch.command_pool);
+
+            in_flight.pop_front();
+        }
+
+        while (!retired_buffers.empty() && retired_buffers.front().first <= completed) {
+            retired_buffers.front().second.destroy();
+            retired_buffers.pop_front();
+        }
+    }
+
+    std::optional<vk::DeviceSize> UploadScheduler::allocate_staging(vk::DeviceSize size) {
+        if (size > staging_capacity) return {};
+
+        while (true) {
+            bool in_use = current.uses_staging;
+            for (auto& batch : in_flight) in_use |= batch.uses_staging;
+
+            std::optional<vk::DeviceSize> offset;
+            if (!in_use) {
+                staging_head = 0;
+                staging_tail = 0;
+                offset = 0;
+            } else {
+                vk::DeviceSize aligned_head = (staging_head + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+                if (staging_head >= staging_tail) {
+                    // Free memory is at the end of the buffer and the start (before `staging_tail`)
+                    if (aligned_head + size <= staging_capacity) offset = aligned_head;
+                    else if (size < staging_tail) offset = 0;
+                } else {
+                    // `staging_head` has wrapped around; free memory is between it and `staging_tail`
+                    if (aligned_head + size < staging_tail) offset = aligned_head;
+                }
+            }
+
+            if (offset) {
+                staging_head = *offset + size;
+                current.uses_staging = true;
+                return offset;
+            }
+
+            // No room. Submit what is recorded and wait for the oldest batch to release its staging memory
+            if (current.recording) submit_current();
+            if (!in_flight.empty()) wait(in_flight.front().ticket);
+            collect();
+        }
+    }
+
+    std::pair<vk::Buffer, vk::DeviceSize> UploadScheduler::get_staging(const void* data, vk::DeviceSize size) {
+        std::optional<vk::DeviceSize> offset = allocate_staging(size);
+        if (offset) {
+            memcpy(staging_memory + *offset, data, size);
+            return {staging_buffer.buffer, *offset};
+        }
+
+        // Too big for the ring buffer; use a temporary staging buffer that is destroyed once the upload is finished
+        AllocatedBuffer temporary_buffer;
+        temporary_buffer.owner = MemoryOwner::Staging;
+        if (!temporary_buffer.upload((void*) data, allocator, size, vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eCpuOnly)) {
+            std::cerr << "Failed to create staging buffer for upload of " << size << " bytes." << std::endl;
+            return {nullptr, 0};
+        }
+        destroy_after(temporary_buffer, current.ticket);
+        return {temporary_buffer.buffer, 0};
+    }
+
+}
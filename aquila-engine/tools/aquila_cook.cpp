@@ -0,0 +1,43 @@
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <scene/aq_cooked_model.hpp>
+
+// Cooks a model into a `.aqmesh` that `CookedModelLoader` (or the editor's "Load Model") can load
+// Usage: aquila-cook [--no-lods] [--no-texture-compression] <model> [output]
+// The output defaults to the model's path with `cooked_model::extension`; compressed textures are written next to it.
+int main(int argc, char* argv[]) {
+    std::optional<aq::mesh_util::LodOptions> lod_options = aq::mesh_util::LodOptions{};
+    bool compress_textures = true;
+    std::vector<std::string> paths;
+
+    for (int i=1; i<argc; ++i) {
+        std::string argument = argv[i];
+        if (argument == "--no-lods") lod_options = std::nullopt;
+        else if (argument == "--no-texture-compression") compress_textures = false;
+        else if (argument.rfind("--", 0) == 0) {
+            std::cerr << "Unknown option " << argument << std::endl;
+            return 1;
+        }
+        else paths.push_back(argument);
+    }
+    if (paths.empty() || paths.size() > 2) {
+        std::cerr << "Usage: " << argv[0] << " [--no-lods] [--no-texture-compression] <model> [output]" << std::endl;
+        return 1;
+    }
+
+    std::filesystem::path model_path = paths[0];
+    std::filesystem::path output_path = paths.size() > 1 ? std::filesystem::path(paths[1]) : std::filesystem::path(model_path).replace_extension(aq::cooked_model::extension);
+    // `ModelLoader` finds textures relative to the directory so it has to end with a separator
+    std::string directory = model_path.has_parent_path() ? (model_path.parent_path() / "").string() : std::string();
+
+    if (!aq::cooked_model::cook(directory, model_path.filename().string(), output_path.string(), {}, lod_options, compress_textures)) {
+        std::cerr << "Failed to cook " << model_path << std::endl;
+        return 1;
+    }
+    std::cout << "Cooked " << model_path << " into " << output_path << std::endl;
+    return 0;
+}
@@ -12,6 +12,7 @@
 #include <imgui.h>
 
 #include <scene/aq_model_loader.hpp>
+#include <util/asset_cache.hpp>
 #include <scene/aq_light.hpp>
 #include <editor/aq_mesh_creator.hpp>
 
@@ -127,6 +128,7 @@ void GameplayEngine::run() {
 
 void GameplayEngine::init_meshes() {
     std::string resource_path = std::string(SANDBOX_PROJECT_PATH) + "/resources/";
+    aq::AssetCache::set_shared(std::make_shared<aq::AssetCache>(std::string(SANDBOX_PROJECT_PATH) + "/.asset-cache/"));
 
     triangle_mesh = std::make_shared<aq::Mesh>("triangles");
 
@@ -171,8 +173,8 @@ void GameplayEngine::init_meshes() {
     aquila_engine.root_node->rotation = glm::quat(glm::vec3(0.0f, 3.1415f, 0.0f));
 
 
-    aq::ModelLoader model_loader2(resource_path, "test_scene.glb");
-    aquila_engine.root_node->add_node(model_loader2.get_root_node());
+    // Shows up once it's loaded and uploaded
+    aquila_engine.load_model_async(resource_path + "test_scene.glb");
 
     std::shared_ptr<aq::Node> rect = std::make_shared<aq::Node>("test");
     rect->position.y = -3.0f;
@@ -213,6 +215,5 @@ void GameplayEngine::init_meshes() {
     aquila_engine.upload_materials({triangle_mesh->material});
     aquila_engine.upload_materials(model_loader.get_materials());
     aquila_engine.get_material_manager()->remove_material(triangle_mesh->material);
-    aquila_engine.upload_materials(model_loader2.get_materials());
     aquila_engine.get_material_manager()->add_material(triangle_mesh->material);
 }
\ No newline at end of file